@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+namespace SysPlatform {
+
+/// Hash map keyed by object addresses, used for side tables that attach state
+/// to objects whose layout cannot change.
+///
+/// Open addressing with linear probing and backward-shift deletion, so there
+/// are no tombstones and lookups stay short after many inserts and erases.
+/// The table doubles when it is half full. Only insert() allocates, find() and
+/// erase() never do. The map is not thread safe, callers serialize access.
+/// A default constructed map holds no memory, so it can be used from static
+/// constructors regardless of initialization order.
+template <typename Value>
+class AddressMap {
+public:
+    constexpr AddressMap() = default;
+    AddressMap(const AddressMap&) = delete;
+    AddressMap& operator=(const AddressMap&) = delete;
+
+    /// Insert or overwrite the value of a key. Overwriting never allocates.
+    /// @returns false if the table could not grow
+    bool insert(const void* key, const Value& value) {
+        Value* existing = find(key);
+        if (existing) {
+            *existing = value;
+            return true;
+        }
+        if ((m_size + 1) * 2 > m_capacity) {
+            if (!grow()) { return false; }
+        }
+        uintptr_t k = toKey(key);
+        unsigned  i = slotOf(k);
+        while (m_slots[i].key) { i = (i + 1) & (m_capacity - 1); }
+        m_size++;
+        m_slots[i].key   = k;
+        m_slots[i].value = value;
+        return true;
+    }
+
+    /// @returns the value of a key, or nullptr if it is not in the map
+    Value* find(const void* key) {
+        if (!m_capacity) { return nullptr; }
+        uintptr_t k = toKey(key);
+        for (unsigned i = slotOf(k); m_slots[i].key; i = (i + 1) & (m_capacity - 1)) {
+            if (m_slots[i].key == k) { return &m_slots[i].value; }
+        }
+        return nullptr;
+    }
+
+    /// Remove a key
+    /// @returns false if it was not in the map
+    bool erase(const void* key) {
+        if (!m_capacity) { return false; }
+        uintptr_t k = toKey(key);
+        unsigned  i = slotOf(k);
+        while (m_slots[i].key != k) {
+            if (!m_slots[i].key) { return false; }
+            i = (i + 1) & (m_capacity - 1);
+        }
+        // shift back later entries of the probe run so no lookup hits a hole
+        unsigned hole = i;
+        for (unsigned j = (i + 1) & (m_capacity - 1); m_slots[j].key; j = (j + 1) & (m_capacity - 1)) {
+            unsigned home = slotOf(m_slots[j].key);
+            bool movable = (hole <= j) ? ((home <= hole) || (home > j)) : ((home <= hole) && (home > j));
+            if (movable) {
+                m_slots[hole] = m_slots[j];
+                hole = j;
+            }
+        }
+        m_slots[hole].key = 0;
+        m_size--;
+        return true;
+    }
+
+    /// Make room for count entries so that many inserts do not allocate
+    /// @returns false if the table could not grow
+    bool reserve(unsigned count) {
+        while (count * 2 > m_capacity) {
+            if (!grow()) { return false; }
+        }
+        return true;
+    }
+
+    unsigned size() const { return m_size; }
+
+private:
+    struct Slot {
+        uintptr_t key; // 0 marks an empty slot
+        Value     value;
+    };
+
+    static uintptr_t toKey(const void* key) { return reinterpret_cast<uintptr_t>(key); }
+
+    unsigned slotOf(uintptr_t key) const {
+        uint32_t h = static_cast<uint32_t>(key) ^ static_cast<uint32_t>(static_cast<uint64_t>(key) >> 32);
+        h ^= h >> 16;
+        h *= 0x45D9F3BU;
+        h ^= h >> 16;
+        return h & (m_capacity - 1);
+    }
+
+    bool grow() {
+        unsigned capacity = m_capacity ? 2 * m_capacity : INITIAL_CAPACITY;
+        Slot* slots = static_cast<Slot*>(calloc(capacity, sizeof(Slot)));
+        if (!slots) { return false; }
+
+        Slot*    old         = m_slots;
+        unsigned oldCapacity = m_capacity;
+        m_slots    = slots;
+        m_capacity = capacity;
+        for (unsigned i = 0; i < oldCapacity; i++) {
+            if (!old[i].key) { continue; }
+            unsigned j = slotOf(old[i].key);
+            while (m_slots[j].key) { j = (j + 1) & (m_capacity - 1); }
+            m_slots[j] = old[i];
+        }
+        free(old);
+        return true;
+    }
+
+    static constexpr unsigned INITIAL_CAPACITY = 64;
+
+    Slot*    m_slots    = nullptr;
+    unsigned m_capacity = 0;
+    unsigned m_size     = 0;
+};
+
+}
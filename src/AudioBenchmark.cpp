@@ -0,0 +1,161 @@
+#include "Arduino.h"
+#include "sysPlatform/SysTypes.h"
+#include "sysPlatform/SysCpuControl.h"
+#include "sysPlatform/SysTimer.h"
+#include "sysPlatform/SysLogger.h"
+#include "AudioBlockPool.h"
+#include "SysRingBuffer.h"
+#include "AudioBenchmark.h"
+
+namespace SysPlatform {
+
+namespace {
+
+constexpr unsigned NUM_BENCH_BLOCKS = 8;  // two inputs and one output per update, rotated
+
+// pointer layout, as set up by AudioMemory()
+DMAMEM audio_block_float32_t benchHeaders[NUM_BENCH_BLOCKS];
+DMAMEM __attribute__((aligned(32))) float benchBuffers[NUM_BENCH_BLOCKS * AUDIO_BLOCK_SAMPLES];
+
+// contiguous layout, as set up by AudioMemoryContiguous()
+DMAMEM AudioBlockSlot<audio_block_float32_t> benchSlots[NUM_BENCH_BLOCKS];
+
+constexpr float GAIN0 = 0.5f;
+constexpr float GAIN1 = 0.25f;
+
+// The kernels are kept out of line so both are compiled and scheduled alike
+__attribute__((noinline)) void mixPointer(audio_block_float32_t* a, audio_block_float32_t* b, audio_block_float32_t* out)
+{
+    const float* pa = a->data;
+    const float* pb = b->data;
+    float* po = out->data;
+    for (unsigned i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+        po[i] = pa[i] * GAIN0 + pb[i] * GAIN1;
+    }
+    out->flags = a->flags | b->flags;
+}
+
+__attribute__((noinline)) void mixContiguous(audio_block_float32_t* a, audio_block_float32_t* b, audio_block_float32_t* out)
+{
+    const float* pa = audioBlockSamples(a);
+    const float* pb = audioBlockSamples(b);
+    float* po = audioBlockSamples(out);
+    for (unsigned i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+        po[i] = pa[i] * GAIN0 + pb[i] * GAIN1;
+    }
+    out->flags = a->flags | b->flags;
+}
+
+uint32_t runMix(audio_block_float32_t* blocks[], void (*mix)(audio_block_float32_t*, audio_block_float32_t*, audio_block_float32_t*),
+    unsigned iterations)
+{
+    uint32_t total = 0;
+    for (unsigned n = 0; n < iterations; n++) {
+        arm_dcache_flush_delete(benchHeaders, sizeof(benchHeaders));
+        arm_dcache_flush_delete(benchBuffers, sizeof(benchBuffers));
+        arm_dcache_flush_delete(benchSlots, sizeof(benchSlots));
+
+        unsigned k = n % NUM_BENCH_BLOCKS;
+        audio_block_float32_t* a   = blocks[k];
+        audio_block_float32_t* b   = blocks[(k + 3) % NUM_BENCH_BLOCKS];
+        audio_block_float32_t* out = blocks[(k + 5) % NUM_BENCH_BLOCKS];
+
+        SysCpuControl::disableIrqs();
+        uint32_t start = SysTimer::cycleCnt32();
+        mix(a, b, out);
+        total += SysTimer::cycleCnt32() - start;
+        SysCpuControl::enableIrqs();
+    }
+    return total;
+}
+
+constexpr unsigned RING_BENCH_CAPACITY = 64;
+SysSpscRing<uint32_t, RING_BENCH_CAPACITY> benchSpsc;
+SysMpscRing<uint32_t, RING_BENCH_CAPACITY> benchMpsc;
+
+template <typename Ring>
+uint32_t runRing(Ring& ring, unsigned values, unsigned batch)
+{
+    uint32_t in[RING_BENCH_BATCH];
+    uint32_t out[RING_BENCH_BATCH];
+    volatile uint32_t sink = 0;
+    for (unsigned i = 0; i < RING_BENCH_BATCH; i++) { in[i] = i; }
+
+    SysCpuControl::disableIrqs();
+    uint32_t start = SysTimer::cycleCnt32();
+    for (unsigned n = 0; n < values; n += batch) {
+        if (batch == 1) {
+            ring.push(in[0]);
+            ring.pop(out[0]);
+        } else {
+            ring.pushBatch(in, batch);
+            ring.popBatch(out, batch);
+        }
+        sink = out[0];
+    }
+    uint32_t total = SysTimer::cycleCnt32() - start;
+    SysCpuControl::enableIrqs();
+    (void)sink;
+    return total;
+}
+
+}
+
+void benchmarkAudioBlockLayout(unsigned iterations, AudioLayoutBenchmark& result)
+{
+    audio_block_float32_t* pointerBlocks[NUM_BENCH_BLOCKS];
+    audio_block_float32_t* contiguousBlocks[NUM_BENCH_BLOCKS];
+
+    for (unsigned i = 0; i < NUM_BENCH_BLOCKS; i++) {
+        benchHeaders[i].data  = benchBuffers + i * AUDIO_BLOCK_SAMPLES;
+        benchHeaders[i].flags = 0;
+        benchSlots[i].header.data  = benchSlots[i].samples;
+        benchSlots[i].header.flags = 0;
+        for (unsigned s = 0; s < AUDIO_BLOCK_SAMPLES; s++) {
+            benchHeaders[i].data[s]  = static_cast<float>(s) / AUDIO_BLOCK_SAMPLES;
+            benchSlots[i].samples[s] = static_cast<float>(s) / AUDIO_BLOCK_SAMPLES;
+        }
+        pointerBlocks[i]    = &benchHeaders[i];
+        contiguousBlocks[i] = &benchSlots[i].header;
+    }
+
+    result.iterations       = iterations;
+    result.pointerCycles    = runMix(pointerBlocks, mixPointer, iterations);
+    result.contiguousCycles = runMix(contiguousBlocks, mixContiguous, iterations);
+}
+
+void printAudioBlockLayoutBenchmark(unsigned iterations)
+{
+    if (iterations == 0) { return; }
+    AudioLayoutBenchmark result;
+    benchmarkAudioBlockLayout(iterations, result);
+    sysLogger.printf("Audio block layout, gain/mix over %u updates of %u samples:\n", iterations, AUDIO_BLOCK_SAMPLES);
+    sysLogger.printf("    pointer layout:    %lu cycles/update\n", (unsigned long)(result.pointerCycles / iterations));
+    sysLogger.printf("    contiguous layout: %lu cycles/update\n", (unsigned long)(result.contiguousCycles / iterations));
+}
+
+void benchmarkRingBuffers(unsigned values, RingBufferBenchmark& result)
+{
+    values -= values % RING_BENCH_BATCH;
+    result.values          = values;
+    result.spscCycles      = runRing(benchSpsc, values, 1);
+    result.spscBatchCycles = runRing(benchSpsc, values, RING_BENCH_BATCH);
+    result.mpscCycles      = runRing(benchMpsc, values, 1);
+    result.mpscBatchCycles = runRing(benchMpsc, values, RING_BENCH_BATCH);
+}
+
+void printRingBufferBenchmark(unsigned values)
+{
+    RingBufferBenchmark result;
+    benchmarkRingBuffers(values, result);
+    if (result.values == 0) { return; }
+    // two decimals, a round trip is only a few tens of cycles
+    auto perValue = [&](uint32_t cycles) { return (unsigned long)((uint64_t)cycles * 100U / result.values); };
+    sysLogger.printf("Ring buffers, push and pop of %u values:\n", result.values);
+    sysLogger.printf("    SPSC single:   %lu.%02lu cycles/value\n", perValue(result.spscCycles) / 100, perValue(result.spscCycles) % 100);
+    sysLogger.printf("    SPSC batch %u: %lu.%02lu cycles/value\n", RING_BENCH_BATCH, perValue(result.spscBatchCycles) / 100, perValue(result.spscBatchCycles) % 100);
+    sysLogger.printf("    MPSC single:   %lu.%02lu cycles/value\n", perValue(result.mpscCycles) / 100, perValue(result.mpscCycles) % 100);
+    sysLogger.printf("    MPSC batch %u: %lu.%02lu cycles/value\n", RING_BENCH_BATCH, perValue(result.mpscBatchCycles) / 100, perValue(result.mpscBatchCycles) % 100);
+}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+namespace SysPlatform {
+
+/// Cycle counts of a two-input gain/mix node run over both audio block layouts
+struct AudioLayoutBenchmark {
+    unsigned iterations       = 0;
+    uint32_t pointerCycles    = 0; ///< separate header and buffer arrays, samples via block->data
+    uint32_t contiguousCycles = 0; ///< AudioBlockSlot layout, samples via audioBlockSamples()
+};
+
+/// Run a gain/mix kernel, out = a * g0 + b * g1, over a set of blocks in each
+/// layout and measure it with the cycle counter. The data cache is cleaned and
+/// invalidated before every iteration so the result includes the cost of
+/// bringing headers and samples in from memory, as in the audio ISR where the
+/// blocks were last touched by another node or by DMA.
+/// Uses its own static blocks, the audio pools are not touched.
+/// @param iterations number of node updates to time on each layout
+/// @param result receives the total cycles per layout
+void benchmarkAudioBlockLayout(unsigned iterations, AudioLayoutBenchmark& result);
+
+/// Run benchmarkAudioBlockLayout() and log the per-update averages
+void printAudioBlockLayoutBenchmark(unsigned iterations = 1000);
+
+/// Cycle counts of moving 32-bit values through SysSpscRing and SysMpscRing
+struct RingBufferBenchmark {
+    unsigned values           = 0; ///< values pushed and popped per variant
+    uint32_t spscCycles       = 0; ///< push() then pop() of one value at a time
+    uint32_t spscBatchCycles  = 0; ///< pushBatch() then popBatch() of RING_BENCH_BATCH values
+    uint32_t mpscCycles       = 0;
+    uint32_t mpscBatchCycles  = 0;
+};
+
+/// Values per pushBatch()/popBatch() call in benchmarkRingBuffers()
+constexpr unsigned RING_BENCH_BATCH = 8;
+
+/// Time push/pop round trips through both ring buffers from a single context,
+/// the uncontended cost the audio ISR pays per parameter or meter value.
+/// @param values number of values to move through each variant, rounded down
+/// to a multiple of RING_BENCH_BATCH
+/// @param result receives the total cycles per variant
+void benchmarkRingBuffers(unsigned values, RingBufferBenchmark& result);
+
+/// Run benchmarkRingBuffers() and log the cycles per value
+void printRingBufferBenchmark(unsigned values = 8192);
+
+}
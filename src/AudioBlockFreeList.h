@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace SysPlatform {
+
+/// Lock-free free list of audio pool block indices.
+///
+/// The list is a LIFO stack threaded through a caller-supplied array of 16-bit
+/// links, one per pool block. The head word packs a 16-bit ABA tag above the
+/// 16-bit index of the top block so a pop that races with a pop/push pair from
+/// a higher priority interrupt is detected and retried. On Cortex-M7 the
+/// compare-exchange compiles to an LDREX/STREX pair, so allocation and release
+/// are O(1) and never mask interrupts. A retry only happens when the operation
+/// was preempted by another context that touched the same list.
+class AudioBlockFreeList {
+public:
+    static constexpr uint16_t EMPTY = 0xFFFFU;
+
+    AudioBlockFreeList() = default;
+
+    /// Link blocks [0, num) into the list so they are handed out lowest index first.
+    /// Must not be called while any other context is using the list.
+    /// @param links storage for one link per block, at least num entries
+    /// @param num number of blocks in the pool, must be less than EMPTY
+    void reset(uint16_t* links, unsigned num) {
+        m_links = links;
+        m_num   = num;
+        for (unsigned i = 0; i < num; i++) {
+            m_links[i] = (i + 1 < num) ? static_cast<uint16_t>(i + 1) : EMPTY;
+        }
+        m_head.store(num ? 0U : EMPTY, std::memory_order_release);
+    }
+
+    /// Remove a block from the list.
+    /// @returns the block index, or -1 if the list is empty
+    int pop() {
+        uint32_t head = m_head.load(std::memory_order_acquire);
+        uint32_t next;
+        do {
+            uint16_t index = head & 0xFFFFU;
+            if (index == EMPTY) { return -1; }
+            next = ((head + 0x10000U) & 0xFFFF0000U) | m_links[index];
+        } while (!m_head.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire));
+        return static_cast<int>(head & 0xFFFFU);
+    }
+
+    /// Return a block to the list
+    /// @param index the block index previously obtained from pop()
+    void push(unsigned index) {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        uint32_t next;
+        do {
+            m_links[index] = head & 0xFFFFU;
+            next = ((head + 0x10000U) & 0xFFFF0000U) | index;
+        } while (!m_head.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    /// @returns the number of blocks managed by the list
+    unsigned capacity() const { return m_num; }
+
+private:
+    std::atomic<uint32_t> m_head{EMPTY};  // [31:16] ABA tag, [15:0] index of the top block
+    uint16_t*             m_links = nullptr;
+    unsigned              m_num   = 0;
+};
+
+}
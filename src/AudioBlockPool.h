@@ -0,0 +1,321 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include "sysPlatform/AudioStream.h"
+#include "AudioBlockFreeList.h"
+
+/// Block flag set on blocks whose samples are all zero. A producer that knows
+/// its output is silent sets it so readers can skip processing. allocate()
+/// clears it and receiveWritable() clears it on the block it hands out.
+constexpr uint8_t SILENT_MASK = 0x2;
+static_assert((SILENT_MASK & FLOAT_MASK) == 0, "SILENT_MASK collides with FLOAT_MASK");
+
+namespace SysPlatform {
+
+/// Storage of the shared zero block, use audioZeroBlockFloat() instead
+extern audio_block_float32_t audioZeroBlockStorage;
+
+/// @returns true if the block is the shared zero block
+inline bool isAudioZeroBlock(const void* block)
+{
+    return block == static_cast<const void*>(&audioZeroBlockStorage);
+}
+
+/// Atomically add a reference to a pool block. Safe against a concurrent
+/// release() of the same block from a DMA interrupt.
+template <typename BlockType>
+inline void audioBlockAddRef(BlockType* block)
+{
+    if (isAudioZeroBlock(block)) { return; }
+    __atomic_add_fetch(&block->ref_count, 1, __ATOMIC_RELAXED);
+}
+
+/// Atomically drop a reference from a pool block.
+/// @returns the reference count before the decrement. Zero means the block was
+/// already free, or is the shared zero block, and nothing was changed.
+template <typename BlockType>
+inline unsigned audioBlockDropRef(BlockType* block)
+{
+    if (isAudioZeroBlock(block)) { return 0; }
+    auto count = __atomic_load_n(&block->ref_count, __ATOMIC_RELAXED);
+    do {
+        if (count == 0) { return 0; }
+    } while (!__atomic_compare_exchange_n(&block->ref_count, &count, count - 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return count;
+}
+
+/// One block of the contiguous pool layout. The header sits at the start of
+/// a 32-byte cache line and the samples follow in the next line, so a block
+/// is a single allocation and its payload is aligned for DMA cache maintenance.
+/// The header data pointer is still set for source compatibility, but hot loops
+/// can use audioBlockSamples() to compute the payload address without loading it.
+template <typename BlockType>
+struct AudioBlockSlot {
+    using SampleType = typename std::remove_pointer<decltype(BlockType::data)>::type;
+
+    alignas(32) BlockType header;
+    alignas(32) SampleType samples[AUDIO_BLOCK_SAMPLES];
+};
+
+/// Byte offset from the block header to its payload in the contiguous layout
+constexpr size_t AUDIO_BLOCK_PAYLOAD_OFFSET = offsetof(AudioBlockSlot<audio_block_float32_t>, samples);
+static_assert(offsetof(AudioBlockSlot<audio_block_t>, samples) == AUDIO_BLOCK_PAYLOAD_OFFSET,
+    "int16 and float32 slots must place the payload at the same offset");
+
+/// @returns the payload of a block from a contiguous pool without loading the
+/// data pointer. Only valid when AudioPools::isContiguous() is true.
+inline float* audioBlockSamples(audio_block_float32_t* block)
+{
+    return reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(block) + AUDIO_BLOCK_PAYLOAD_OFFSET);
+}
+
+inline int16_t* audioBlockSamples(audio_block_t* block)
+{
+    return reinterpret_cast<int16_t*>(reinterpret_cast<uint8_t*>(block) + AUDIO_BLOCK_PAYLOAD_OFFSET);
+}
+
+/// @returns the shared zero block. It holds AUDIO_BLOCK_SAMPLES zero samples,
+/// has SILENT_MASK set and is not part of any pool. It can be transmitted to
+/// any number of inputs and released any number of times without reference
+/// counting, and it is valid as both an int16 and a float32 block.
+/// receiveWritable() never hands it out, it allocates a zeroed block instead.
+audio_block_float32_t* audioZeroBlockFloat();
+
+inline audio_block_t* audioZeroBlock() { return reinterpret_cast<audio_block_t*>(audioZeroBlockFloat()); }
+
+/// @returns true if the block is missing or flagged silent
+template <typename BlockType>
+inline bool isAudioBlockSilent(const BlockType* block)
+{
+    return !block || (block->flags & SILENT_MASK);
+}
+
+/// Flag a block as all zeros. Only for blocks the caller owns exclusively.
+template <typename BlockType>
+inline void markAudioBlockSilent(BlockType* block)
+{
+    if (block) { block->flags |= SILENT_MASK; }
+}
+
+/// Telemetry of one audio block pool
+struct AudioPoolStats {
+    uint16_t numBlocks = 0; ///< blocks in the pool
+    uint16_t used      = 0; ///< blocks currently allocated
+    uint16_t usedMax   = 0; ///< most blocks allocated at once since the last resetMax()
+    uint32_t failures  = 0; ///< allocations that found the pool empty
+};
+
+/// A fixed pool of audio blocks that all carry the same sample type. The block
+/// headers and the sample buffers are supplied by the caller, so each pool is
+/// sized for its own sample width. Allocation and release go through an
+/// AudioBlockFreeList and are lock-free.
+template <typename BlockType>
+class AudioBlockPool {
+public:
+    using SampleType = typename std::remove_pointer<decltype(BlockType::data)>::type;
+
+    AudioBlockPool() = default;
+
+    /// Place all blocks onto the free list. Must not be called while any other
+    /// context is using the pool.
+    /// @param blocks array of num block headers
+    /// @param num number of blocks, clamped to maxBlocks
+    /// @param buffers storage for num * AUDIO_BLOCK_SAMPLES samples, or nullptr
+    /// if the data pointers are already set
+    /// @param links free list storage for at least maxBlocks entries
+    /// @param maxBlocks capacity of links
+    /// @returns the number of blocks in the pool
+    unsigned initialize(BlockType* blocks, unsigned num, SampleType* buffers, uint16_t* links, unsigned maxBlocks) {
+        if (num > maxBlocks) { num = maxBlocks; }
+        m_blocks = blocks;
+        m_stride = sizeof(BlockType);
+        for (unsigned i = 0; i < num; i++) {
+            if (buffers) { blocks[i].data = buffers + i * AUDIO_BLOCK_SAMPLES; }
+        }
+        return reset(num, links);
+    }
+
+    /// Place all slots of a contiguous layout onto the free list. Must not be
+    /// called while any other context is using the pool.
+    /// @param slots array of num slots, the headers' data pointers are set to the slot payloads
+    /// @param num number of slots, clamped to maxBlocks
+    /// @param links free list storage for at least maxBlocks entries
+    /// @param maxBlocks capacity of links
+    /// @returns the number of blocks in the pool
+    unsigned initialize(AudioBlockSlot<BlockType>* slots, unsigned num, uint16_t* links, unsigned maxBlocks) {
+        if (num > maxBlocks) { num = maxBlocks; }
+        m_blocks = &slots[0].header;
+        m_stride = sizeof(AudioBlockSlot<BlockType>);
+        for (unsigned i = 0; i < num; i++) {
+            slots[i].header.data = slots[i].samples;
+        }
+        return reset(num, links);
+    }
+
+    /// Take a block from the pool with a reference count of one. The flags are
+    /// left to the caller.
+    /// @returns the block, or nullptr if the pool is empty or not initialized
+    BlockType* allocate() {
+        int index = m_freeList.pop();
+        if (index < 0) {
+            __atomic_add_fetch(&m_failures, 1, __ATOMIC_RELAXED);
+            return nullptr;
+        }
+        uint16_t used = __atomic_add_fetch(&m_used, 1, __ATOMIC_RELAXED);
+        if (used > m_usedMax) { m_usedMax = used; }
+        BlockType* block = blockAt(index);
+        block->ref_count = 1;
+        return block;
+    }
+
+    /// Return a block whose reference count has dropped to zero
+    void free(BlockType* block) {
+        m_freeList.push(block->memory_pool_index);
+        __atomic_sub_fetch(&m_used, 1, __ATOMIC_RELAXED);
+    }
+
+    /// Forcibly return every block to the pool
+    void releaseAll() {
+        for (unsigned i = 0; i < m_num; i++) {
+            blockAt(i)->ref_count = 0;
+            blockAt(i)->flags = 0;
+        }
+        m_freeList.reset(m_links, m_num);
+        m_used = 0;
+    }
+
+    /// @returns true if the block header belongs to this pool
+    bool owns(const void* block) const {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(block);
+        uintptr_t base = reinterpret_cast<uintptr_t>(m_blocks);
+        return (addr >= base) && (addr < base + m_num * m_stride);
+    }
+
+    /// @returns the block header with the given memory_pool_index
+    BlockType* blockAt(unsigned index) const {
+        return reinterpret_cast<BlockType*>(reinterpret_cast<uint8_t*>(m_blocks) + index * m_stride);
+    }
+
+    /// @returns true if the pool uses the contiguous AudioBlockSlot layout
+    bool isContiguous() const { return m_stride == sizeof(AudioBlockSlot<BlockType>); }
+
+    AudioPoolStats stats() const {
+        AudioPoolStats s;
+        s.numBlocks = m_num;
+        s.used      = m_used;
+        s.usedMax   = m_usedMax;
+        s.failures  = m_failures;
+        return s;
+    }
+
+    /// Restart the peak usage tracking from the current usage
+    void resetMax() { m_usedMax = m_used; }
+
+private:
+    unsigned reset(unsigned num, uint16_t* links) {
+        m_links = links;
+        m_num   = static_cast<uint16_t>(num);
+        for (unsigned i = 0; i < num; i++) {
+            blockAt(i)->memory_pool_index = i;
+            blockAt(i)->ref_count = 0;
+        }
+        m_freeList.reset(links, num);
+        m_used     = 0;
+        m_usedMax  = 0;
+        m_failures = 0;
+        return num;
+    }
+
+    AudioBlockFreeList m_freeList;
+    BlockType*         m_blocks   = nullptr;
+    uint16_t*          m_links    = nullptr;
+    uint16_t           m_stride   = sizeof(BlockType); ///< bytes from one block header to the next
+    uint16_t           m_num      = 0;
+    uint16_t           m_used     = 0;
+    uint16_t           m_usedMax  = 0;
+    uint32_t           m_failures = 0;
+};
+
+/// Access to the int16 and float32 audio block pools behind AudioStream.
+///
+/// The float32 pool is the one set up by AudioStream::initialize_memory(). The
+/// int16 pool is optional. Once initializeInt16() has been called,
+/// AudioStream::allocate() and receiveWritable() take half-size blocks from it
+/// and only fall back to the float32 pool when it is exhausted. Without it,
+/// int16 blocks come from the float32 pool as before. AudioStream::memory_used
+/// and memory_used_max report the sum over both pools.
+class AudioPools {
+public:
+    /// Set up the int16 pool
+    /// @param data array of num block headers
+    /// @param num number of blocks
+    /// @param dataBuffers storage for num * AUDIO_BLOCK_SAMPLES samples, or nullptr
+    static void initializeInt16(audio_block_t* data, unsigned num, int16_t* dataBuffers);
+
+    /// Set up the float32 pool with the contiguous layout. Replaces AudioMemory().
+    static void initializeFloat(AudioBlockSlot<audio_block_float32_t>* slots, unsigned num);
+
+    /// Set up the int16 pool with the contiguous layout. Replaces AudioMemoryInt16().
+    static void initializeInt16(AudioBlockSlot<audio_block_t>* slots, unsigned num);
+
+    /// @returns true if every initialized pool uses the contiguous layout, so
+    /// audioBlockSamples() is valid for any block
+    static bool isContiguous();
+
+    /// Allocate from the int16 pool, falling back to the float32 pool
+    static audio_block_t* allocateInt16();
+
+    /// Allocate from the float32 pool
+    static audio_block_float32_t* allocateFloat();
+
+    static AudioPoolStats int16Stats();
+    static AudioPoolStats floatStats();
+
+    /// @returns the number of int16 allocations served by the float32 pool
+    static uint32_t int16Fallbacks();
+
+    /// Restart peak usage tracking on both pools
+    static void resetMax();
+};
+
+/// Maps a sample type to its audio block type for allocateAudioBlock<T>()
+template <typename T> struct AudioBlockOf;
+template <> struct AudioBlockOf<int16_t> { using type = audio_block_t; };
+template <> struct AudioBlockOf<float>   { using type = audio_block_float32_t; };
+
+/// Allocate an audio block of the pool that matches the sample type, e.g.
+/// allocateAudioBlock<int16_t>() or allocateAudioBlock<float>(). Release it
+/// with AudioStream::release(), which returns it to the pool it came from.
+/// @returns the block with a reference count of one, or nullptr
+template <typename T>
+typename AudioBlockOf<T>::type* allocateAudioBlock();
+
+template <>
+inline audio_block_t* allocateAudioBlock<int16_t>() { return AudioPools::allocateInt16(); }
+
+template <>
+inline audio_block_float32_t* allocateAudioBlock<float>() { return AudioPools::allocateFloat(); }
+
+}
+
+/// Set up the int16 pool. Like AudioMemory(), it must be used once from setup().
+#define AudioMemoryInt16(num) ({ \
+    static DMAMEM audio_block_t data[num]; \
+    static DMAMEM __attribute__((aligned(32))) int16_t buffers[(num) * AUDIO_BLOCK_SAMPLES]; \
+    SysPlatform::AudioPools::initializeInt16(data, num, buffers); \
+})
+
+/// Set up the float32 pool with header and payload contiguous in each block
+#define AudioMemoryContiguous(num) ({ \
+    static DMAMEM SysPlatform::AudioBlockSlot<audio_block_float32_t> slots[num]; \
+    SysPlatform::AudioPools::initializeFloat(slots, num); \
+})
+
+/// Set up the int16 pool with header and payload contiguous in each block
+#define AudioMemoryInt16Contiguous(num) ({ \
+    static DMAMEM SysPlatform::AudioBlockSlot<audio_block_t> slots[num]; \
+    SysPlatform::AudioPools::initializeInt16(slots, num); \
+})
@@ -0,0 +1,169 @@
+#include "sysPlatform/SysTypes.h"
+#include "sysPlatform/SysTimer.h"
+#include "sysPlatform/SysCpuTelemetry.h"
+#include "sysPlatform/AudioStream.h"
+#include "AudioClock.h"
+
+using namespace SysPlatform;
+
+namespace {
+int32_t roundToInt(float value)
+{
+    return (int32_t)(value + ((value < 0.0f) ? -0.5f : 0.5f));
+}
+
+uint64_t toSample(const AudioClockSnapshot& s, uint32_t cycles)
+{
+    if (s.cyclesPerSample <= 0.0f) { return 0; }
+    int64_t sample = (int64_t)s.sample + roundToInt((float)(int32_t)(cycles - s.cycles) / s.cyclesPerSample);
+    return (sample > 0) ? (uint64_t)sample : 0;
+}
+
+uint32_t toCycles(const AudioClockSnapshot& s, uint64_t sample)
+{
+    return s.cycles + (uint32_t)roundToInt((float)(int64_t)(sample - s.sample) * s.cyclesPerSample);
+}
+}
+
+AudioClockSnapshot    AudioClock::m_slots[2];
+std::atomic<uint32_t> AudioClock::m_seq(0);
+uint32_t              AudioClock::m_windowStart    = 0;
+uint32_t              AudioClock::m_windowBlocks   = 0;
+float                 AudioClock::m_cyclesPerMicro = 0.0f;
+float                 AudioClock::m_nominalSampleRate = AUDIO_SAMPLE_RATE_EXACT;
+volatile bool         AudioClock::m_resetRequested = false;
+volatile bool         AudioClock::m_rateChanged    = false;
+
+void AudioClock::beginBlock(uint32_t cycleNow)
+{
+    uint32_t seq = m_seq.load(std::memory_order_relaxed);
+    const AudioClockSnapshot& last = m_slots[seq & 1U];
+    AudioClockSnapshot& next = m_slots[(seq + 1U) & 1U];
+    uint32_t micros = SysTimer::micros();
+
+    if ((seq == 0) || m_resetRequested) {
+        float cpuHz = (float)SysCpuTelemetry::getCpuFreqHz();
+        m_cyclesPerMicro       = cpuHz / 1e6f;
+        // keep counting across a reset, only the anchor and the rate move
+        next.sample            = seq ? last.sample + AUDIO_BLOCK_SAMPLES : 0;
+        next.block             = seq ? last.block + 1U : 0;
+        next.cycles            = cycleNow;
+        next.micros            = micros;
+        bool keepRate          = seq && (last.cyclesPerSample > 0.0f) && !m_rateChanged;
+        next.cyclesPerSample   = keepRate ? last.cyclesPerSample : cpuHz / m_nominalSampleRate;
+        m_windowStart          = cycleNow;
+        m_windowBlocks         = 0;
+        m_resetRequested       = false;
+        m_rateChanged          = false;
+    } else {
+        float blockCycles = last.cyclesPerSample * AUDIO_BLOCK_SAMPLES;
+        // count the blocks that elapsed, normally one, more if updates were missed
+        int32_t  elapsed = (int32_t)(cycleNow - last.cycles);
+        uint32_t blocks  = (elapsed > 0) ? (uint32_t)((float)elapsed / blockCycles + 0.5f) : 1U;
+        if (blocks == 0) { blocks = 1; }
+
+        // Phase loop: step the timestamp by the expected block length and move
+        // it part of the way towards the measurement, so interrupt latency
+        // jitter is averaged out while the timeline still follows the I2S clock.
+        uint32_t predicted = last.cycles + (uint32_t)(blockCycles * blocks + 0.5f);
+        int32_t  error     = (int32_t)(cycleNow - predicted);
+        next.cycles  = predicted + (error >> PHASE_SHIFT);
+        next.sample  = last.sample + (uint64_t)blocks * AUDIO_BLOCK_SAMPLES;
+        next.block   = last.block + blocks;
+        // micros of the smoothed timestamp, not of the raw one
+        next.micros  = micros - (uint32_t)(int32_t)((float)(int32_t)(cycleNow - next.cycles) / m_cyclesPerMicro);
+
+        // Rate loop: measure the cycles per sample over a long window. The
+        // window stays well below the 32-bit cycle counter wrap.
+        next.cyclesPerSample = last.cyclesPerSample;
+        m_windowBlocks += blocks;
+        if (m_windowBlocks >= RATE_WINDOW_BLOCKS) {
+            float measured = (float)(cycleNow - m_windowStart) / (float)(m_windowBlocks * AUDIO_BLOCK_SAMPLES);
+            next.cyclesPerSample += (measured - next.cyclesPerSample) * 0.25f;
+            m_windowStart  = cycleNow;
+            m_windowBlocks = 0;
+        }
+    }
+    m_seq.store(seq + 1U, std::memory_order_release);
+}
+
+void AudioClock::reset()
+{
+    m_resetRequested = true;
+}
+
+void AudioClock::setNominalSampleRate(float hz)
+{
+    if ((hz <= 0.0f) || (hz == m_nominalSampleRate)) { return; }
+    m_nominalSampleRate = hz;
+    m_rateChanged       = true;
+    m_resetRequested    = true;
+}
+
+// The writer only ever fills the slot that is not current, so a copy of the
+// current slot is consistent unless the writer published twice meanwhile.
+const AudioClockSnapshot& AudioClock::readSlot(AudioClockSnapshot& copy)
+{
+    while (true) {
+        uint32_t seq = m_seq.load(std::memory_order_acquire);
+        copy = m_slots[seq & 1U];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_seq.load(std::memory_order_relaxed) - seq < 2U) { return copy; }
+    }
+}
+
+void AudioClock::snapshot(AudioClockSnapshot& snapshot)
+{
+    readSlot(snapshot);
+}
+
+uint64_t AudioClock::blockSample()
+{
+    AudioClockSnapshot s;
+    return readSlot(s).sample;
+}
+
+uint64_t AudioClock::blockCount()
+{
+    AudioClockSnapshot s;
+    return readSlot(s).block;
+}
+
+uint64_t AudioClock::now()
+{
+    return cyclesToSample(SysTimer::cycleCnt32());
+}
+
+uint64_t AudioClock::cyclesToSample(uint32_t cycles)
+{
+    AudioClockSnapshot s;
+    return toSample(readSlot(s), cycles);
+}
+
+uint32_t AudioClock::sampleToCycles(uint64_t sample)
+{
+    AudioClockSnapshot s;
+    return toCycles(readSlot(s), sample);
+}
+
+uint64_t AudioClock::microsToSample(uint32_t micros)
+{
+    AudioClockSnapshot s;
+    readSlot(s);
+    return toSample(s, s.cycles + (uint32_t)roundToInt((float)(int32_t)(micros - s.micros) * m_cyclesPerMicro));
+}
+
+uint32_t AudioClock::sampleToMicros(uint64_t sample)
+{
+    AudioClockSnapshot s;
+    readSlot(s);
+    if (m_cyclesPerMicro <= 0.0f) { return s.micros; }
+    return s.micros + (uint32_t)roundToInt((float)(int32_t)(toCycles(s, sample) - s.cycles) / m_cyclesPerMicro);
+}
+
+float AudioClock::measuredSampleRate()
+{
+    AudioClockSnapshot s;
+    readSlot(s);
+    return (s.cyclesPerSample > 0.0f) ? m_cyclesPerMicro * 1e6f / s.cyclesPerSample : 0.0f;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/// The audio timeline at the start of one block
+struct AudioClockSnapshot {
+    uint64_t sample          = 0;    ///< sample time of the first sample of the block
+    uint64_t block           = 0;    ///< blocks since the clock started, including missed ones
+    uint32_t cycles          = 0;    ///< cycle counter at that sample, smoothed by the drift loop
+    uint32_t micros          = 0;    ///< SysTimer::micros() at that sample
+    float    cyclesPerSample = 0.0f; ///< measured length of one sample in CPU cycles
+};
+
+/// Global sample clock of the audio update.
+///
+/// software_isr() calls beginBlock() once per update, which advances a 64-bit
+/// sample counter by one block. The counter runs on the I2S clock. Blocks the
+/// update missed, for example after an overrun swallowed an interrupt, are
+/// detected from the elapsed cycles and still counted. The I2S clock and the
+/// CPU clock come from different oscillators. A drift loop therefore measures
+/// the cycles per sample over a long window and smooths the cycle timestamp
+/// of each block start against interrupt latency. The conversions between
+/// sample time, cycle counts and SysTimer::micros() stay accurate to a few
+/// samples over any run length.
+///
+/// The state is published through two alternating snapshots with a sequence
+/// number, so it can be read from threads and from interrupts of any priority
+/// without masking the audio update.
+class AudioClock {
+public:
+    /// Advance the clock by one block. Called from software_isr() only.
+    /// @param cycleNow cycle counter at the start of the update
+    static void beginBlock(uint32_t cycleNow);
+
+    /// Re-anchor the timeline to the cycle counter and SysTimer::micros() at
+    /// the next block. The sample and block counters keep counting, so sample
+    /// times already handed out stay valid.
+    static void reset();
+
+    /// @returns false until the first block has been counted
+    static bool isRunning() { return m_seq.load(std::memory_order_acquire) != 0; }
+
+    /// @param snapshot receives the timeline at the start of the most recent block
+    static void snapshot(AudioClockSnapshot& snapshot);
+
+    /// @returns the sample time of the start of the most recent block
+    static uint64_t blockSample();
+
+    /// @returns the number of blocks since the clock started
+    static uint64_t blockCount();
+
+    /// @returns the current sample time, interpolated from the cycle counter
+    static uint64_t now();
+
+    /// Convert a cycle counter value within a few seconds of now to sample time
+    static uint64_t cyclesToSample(uint32_t cycles);
+
+    /// Convert a sample time within a few seconds of now to a cycle counter value
+    static uint32_t sampleToCycles(uint64_t sample);
+
+    /// Convert a SysTimer::micros() value within a few seconds of now to sample time
+    static uint64_t microsToSample(uint32_t micros);
+
+    /// Convert a sample time within a few seconds of now to a SysTimer::micros() value
+    static uint32_t sampleToMicros(uint64_t sample);
+
+    /// @returns the I2S sample rate measured against the CPU clock
+    static float measuredSampleRate();
+
+    /// Set the sample rate the I2S clock is configured for. A change
+    /// re-anchors the timeline like reset() and restarts the rate loop from
+    /// the new rate. The counters keep counting, in samples of the new rate
+    /// from the next block on.
+    static void setNominalSampleRate(float hz);
+
+    /// @returns the sample rate the I2S clock is configured for
+    static float nominalSampleRate() { return m_nominalSampleRate; }
+
+    static constexpr unsigned RATE_WINDOW_BLOCKS = 256; ///< blocks per cycles-per-sample measurement, ~0.7 s at 48 kHz/128
+    static constexpr int      PHASE_SHIFT        = 3;   ///< block start timestamps move 1/8 of their error towards the measurement
+
+private:
+    static const AudioClockSnapshot& readSlot(AudioClockSnapshot& copy);
+
+    static AudioClockSnapshot    m_slots[2];
+    static std::atomic<uint32_t> m_seq;         ///< odd while m_slots[1] is current, 0 before the first block
+    static uint32_t              m_windowStart; ///< cycle counter at the start of the rate window
+    static uint32_t              m_windowBlocks;
+    static float                 m_cyclesPerMicro;
+    static float                 m_nominalSampleRate;
+    static volatile bool         m_resetRequested;
+    static volatile bool         m_rateChanged; ///< the next reset must not keep the measured rate
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+
+namespace SysPlatform {
+
+/// Load shedding policy of AudioDeadlineMonitor. Loads are in percent of the
+/// block period.
+struct AudioDeadlinePolicy {
+    bool     enableShedding     = false; ///< bypass sheddable nodes when the load is too high
+    uint8_t  shedLoadPercent    = 90;    ///< start shedding when an update exceeds this load, or overruns
+    uint8_t  restoreLoadPercent = 70;    ///< an update below this load counts towards restoring
+    uint16_t restoreHoldUpdates = 375;   ///< consecutive updates below restoreLoadPercent before restoring, ~1 s at 48 kHz/128
+    uint8_t  lateStartPercent   = 10;    ///< an update starting this much later than one period after the previous start is late
+};
+
+/// Counters of AudioDeadlineMonitor
+struct AudioDeadlineStats {
+    uint32_t updates     = 0; ///< audio updates measured
+    uint32_t overruns    = 0; ///< updates that took longer than one block period
+    uint32_t lateStarts  = 0; ///< updates that started late, e.g. after an overrun or a blocked interrupt
+    uint32_t shedEvents  = 0; ///< times shedding was switched on
+    uint32_t lastCycles  = 0; ///< duration of the most recent update
+    uint32_t worstCycles = 0; ///< longest update
+};
+
+/// @returns the length in cycles, rounded, of a period of samples at
+/// sampleRate on a CPU clocked at cpuHz, e.g. the block period for
+/// AudioDeadlineMonitor::setPeriod()
+inline uint32_t audioPeriodCycles(uint32_t cpuHz, unsigned samples, float sampleRate) {
+    return static_cast<uint32_t>((float)cpuHz * samples / sampleRate + 0.5f);
+}
+
+/// Deadline accounting for the audio update against the block period.
+///
+/// The monitor only does arithmetic on cycle timestamps passed in by the
+/// caller, it never reads a clock itself. software_isr() feeds it the cycle
+/// counter, a host build can feed it a simulated clock. All timestamps are
+/// 32-bit and only differences are used, so the counter may wrap.
+class AudioDeadlineMonitor {
+public:
+    AudioDeadlineMonitor() = default;
+
+    /// @param periodCycles length of one block period in cycles, 0 turns off
+    /// the overrun, late start and shedding checks until a period is set
+    void setPeriod(uint32_t periodCycles) { m_period = periodCycles; }
+    uint32_t period() const { return m_period; }
+
+    void setPolicy(const AudioDeadlinePolicy& policy) { m_policy = policy; if (!policy.enableShedding) { m_shedding = false; } }
+    const AudioDeadlinePolicy& policy() const { return m_policy; }
+
+    /// Mark the start of an audio update
+    /// @param now current cycle count
+    void beginUpdate(uint32_t now) {
+        if (m_period && m_hasStart) {
+            uint32_t interval = now - m_start;
+            if (interval > m_period + percentOf(m_policy.lateStartPercent)) { m_stats.lateStarts++; }
+        }
+        m_start    = now;
+        m_hasStart = true;
+    }
+
+    /// Mark the end of an audio update and run the shedding policy
+    /// @param now current cycle count
+    /// @returns true if the update overran the block period
+    bool endUpdate(uint32_t now) {
+        uint32_t cycles = now - m_start;
+        m_stats.updates++;
+        m_stats.lastCycles = cycles;
+        if (cycles > m_stats.worstCycles) { m_stats.worstCycles = cycles; }
+        if (!m_period) { return false; }
+
+        bool overrun = cycles > m_period;
+        if (overrun) { m_stats.overruns++; }
+        if (!m_policy.enableShedding) { return overrun; }
+
+        if (overrun || (cycles > percentOf(m_policy.shedLoadPercent))) {
+            if (!m_shedding) { m_stats.shedEvents++; }
+            m_shedding  = true;
+            m_goodCount = 0;
+        } else if (m_shedding) {
+            // Load measured while shedding does not include the bypassed
+            // nodes, so demand a sustained margin before restoring them.
+            if (cycles < percentOf(m_policy.restoreLoadPercent)) {
+                if (++m_goodCount >= m_policy.restoreHoldUpdates) { m_shedding = false; m_goodCount = 0; }
+            } else {
+                m_goodCount = 0;
+            }
+        }
+        return overrun;
+    }
+
+    /// @returns true while sheddable nodes should be bypassed
+    bool isShedding() const { return m_shedding; }
+
+    /// @returns the load of the most recent update in percent of the block period
+    unsigned lastLoadPercent() const {
+        return m_period ? static_cast<unsigned>((uint64_t)m_stats.lastCycles * 100U / m_period) : 0;
+    }
+
+    const AudioDeadlineStats& stats() const { return m_stats; }
+
+    /// Clear the counters and stop shedding. The next update is not checked for a late start.
+    void reset() {
+        m_stats     = AudioDeadlineStats();
+        m_shedding  = false;
+        m_goodCount = 0;
+        m_hasStart  = false;
+    }
+
+private:
+    uint32_t percentOf(unsigned percent) const { return static_cast<uint32_t>((uint64_t)m_period * percent / 100U); }
+
+    AudioDeadlinePolicy m_policy;
+    AudioDeadlineStats  m_stats;
+    uint32_t            m_period    = 0;
+    uint32_t            m_start     = 0;
+    uint16_t            m_goodCount = 0;
+    bool                m_hasStart  = false;
+    bool                m_shedding  = false;
+};
+
+}
@@ -0,0 +1,1164 @@
+#include <cstdlib>
+#include <cstring>
+#include "sysPlatform/SysTypes.h"
+#include "sysPlatform/SysTimer.h"
+#include "sysPlatform/SysCpuTelemetry.h"
+#include "sysPlatform/SysCpuControl.h"
+#include "sysPlatform/SysLogger.h"
+#include "AudioBlockPool.h"
+#include "AddressMap.h"
+#include "AudioGraph.h"
+#include "AudioClock.h"
+#include "SysCriticalSection.h"
+#include "SysAudioInterrupts.h"
+#include "EventResponder.h"
+
+using namespace SysPlatform;
+
+AudioPlan               AudioGraph::m_plans[2];
+std::atomic<AudioPlan*> AudioGraph::m_published(nullptr);
+std::atomic<bool>       AudioGraph::m_valid(false);
+volatile bool           AudioGraph::m_inProcess = false;
+AudioPlanEntry*         AudioGraph::m_current   = nullptr;
+CycleHistogram          AudioGraph::m_totalCycles;
+AudioDeadlineMonitor    AudioGraph::m_deadline;
+unsigned                AudioGraph::m_deadlineSamples = 0;
+CycleHistogram          AudioGraph::m_triggerLatency;
+CycleHistogram          AudioGraph::m_triggerJitter;
+volatile uint32_t       AudioGraph::m_triggerCycles  = 0;
+volatile bool           AudioGraph::m_triggerPending = false;
+uint32_t                AudioGraph::m_lastTrigger    = 0;
+volatile unsigned       AudioGraph::m_transactionDepth = 0;
+volatile bool           AudioGraph::m_recompile        = false;
+volatile bool           AudioGraph::m_stale            = false;
+std::atomic<AudioPlan*> AudioGraph::m_pending(nullptr);
+volatile uint8_t        AudioGraph::m_fadeState = AudioGraph::FADE_IDLE;
+float                   AudioGraph::m_fadeDelta = 0.0f;
+float                   AudioGraph::m_fadeGain  = 1.0f;
+float                   AudioGraph::m_fadeStart = 1.0f;
+bool                    AudioGraph::m_releaseUnconsumed = true;
+uint32_t                AudioGraph::m_leakedBlocks      = 0;
+unsigned                AudioGraph::m_lowTierDivisor    = 1;
+unsigned                AudioGraph::m_lowTierCount      = 0;
+volatile unsigned       AudioGraph::m_lowTierPending    = 0;
+
+namespace {
+// Stream internals, bound by the first AudioConnection
+const AudioStreamAccess* streamAccess = nullptr;
+
+// Runs the compile deferred by topologyChanged() from yield()
+EventResponder compileEvent;
+bool           compileEventAttached = false;
+
+void compileDeferred(EventResponderRef)
+{
+    AudioGraph::compileIfStale();
+}
+
+// Scratch tables used while compiling. They are kept between compiles so
+// rewiring a preset does not churn the heap.
+struct CompileEdge {
+    uint16_t         src;
+    uint16_t         dst;
+    bool             feedback;
+    AudioConnection* conn;
+};
+
+struct CompileScratch {
+    AudioStream** streams    = nullptr;
+    uint16_t*     edgeBegin  = nullptr; // first edge of each stream, plus one terminator
+    uint16_t*     inDegree   = nullptr;
+    uint16_t*     order      = nullptr;
+    uint16_t*     rank       = nullptr; // plan index of each stream
+    uint16_t*     path       = nullptr; // predecessor walk used to find a cycle
+    uint16_t*     pathEdge   = nullptr;
+    uint16_t*     pathStep   = nullptr;
+    bool*         placed     = nullptr;
+    unsigned      nodeCapacity = 0;
+    CompileEdge*  edges      = nullptr;
+    unsigned      edgeCapacity = 0;
+};
+CompileScratch scratch;
+
+// Node telemetry is kept per stream rather than per plan entry so it
+// survives recompiles. Each AudioNodeStats is allocated once, the table only
+// holds pointers so growing it never moves stats the ISR uses.
+struct NodeRecord {
+    const AudioStream* stream;
+    AudioNodeStats*    stats;
+    uint8_t            entryFlags; // AUDIO_ENTRY_* flags set by the user, copied into each plan entry
+    AudioHandoff*      handoff;    // one queue per input once the node has been put in the low tier
+    uint8_t            numHandoffs;
+};
+NodeRecord* nodeRecords         = nullptr;
+unsigned    numNodeRecords      = 0;
+unsigned    nodeRecordsCapacity = 0;
+
+// Connection side tables. Keys are the connection, and the address of the
+// input queue slot a connection feeds, which is unique per input.
+AddressMap<AudioConnection**> prevLinks;   // link pointing at the connection, in unused or a destination_list
+AddressMap<AudioConnection*>  inputOwners; // &dst->inputQueue[index] -> connection feeding it
+
+NodeRecord* findRecord(const AudioStream* stream)
+{
+    for (unsigned i = 0; i < numNodeRecords; i++) {
+        if (nodeRecords[i].stream == stream) { return &nodeRecords[i]; }
+    }
+    return nullptr;
+}
+
+// Blocks on feedback edges are read in the next cycle, after every forward
+// reader. Blocks handed off to the low tier are read after both.
+unsigned readOrder(const AudioFanout& f)
+{
+    if (f.flags & AUDIO_FANOUT_HANDOFF) { return 0x20000U + f.dstEntry; }
+    return ((f.flags & AUDIO_FANOUT_FEEDBACK) ? 0x10000U : 0U) + f.dstEntry;
+}
+
+// A reader can take over the block in receiveWritable() without a copy only
+// when no other reader of the same output runs after it.
+bool isLastReader(const AudioPlanEntry& entry, const AudioFanout& f)
+{
+    for (const AudioFanout* other = entry.fanoutBegin; other != entry.fanoutEnd; ++other) {
+        if ((other == &f) || (other->srcIndex != f.srcIndex)) { continue; }
+        if ((readOrder(*other) > readOrder(f)) || ((readOrder(*other) == readOrder(f)) && (other > &f))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Queue a block for a low tier input, taking a reference. Block update only.
+void pushHandoff(AudioHandoff& handoff, audio_block_float32_t* block)
+{
+    // only the consumer can make room, so a full check on the producer side holds
+    if (handoff.queue.full()) {
+        handoff.dropped++;
+        return;
+    }
+    audioBlockAddRef(block);
+    handoff.queue.push(block);
+}
+
+// Take the oldest queued block, with its reference. Low tier only, or with
+// the low tier masked.
+audio_block_float32_t* popHandoff(AudioHandoff& handoff)
+{
+    audio_block_float32_t* block = nullptr;
+    handoff.queue.pop(block);
+    return block;
+}
+
+template <typename T>
+bool growArray(T*& array, unsigned count)
+{
+    T* grown = (T*)realloc(array, count * sizeof(T));
+    if (!grown) { return false; }
+    array = grown;
+    return true;
+}
+}
+
+// Find or create the record of a stream. Thread context only. The returned
+// pointer is only valid until the next call.
+static NodeRecord* recordFor(const AudioStream* stream)
+{
+    NodeRecord* record = findRecord(stream);
+    if (record) { return record; }
+
+    if (numNodeRecords == nodeRecordsCapacity) {
+        unsigned capacity = nodeRecordsCapacity ? 2 * nodeRecordsCapacity : 16;
+        if (!growArray(nodeRecords, capacity)) { return nullptr; }
+        nodeRecordsCapacity = capacity;
+    }
+    AudioNodeStats* stats = (AudioNodeStats*)malloc(sizeof(AudioNodeStats));
+    if (!stats) { return nullptr; }
+    *stats = AudioNodeStats();
+    record = &nodeRecords[numNodeRecords++];
+    record->stream     = stream;
+    record->stats      = stats;
+    record->entryFlags = 0;
+    record->handoff    = nullptr;
+    record->numHandoffs = 0;
+    return record;
+}
+
+void AudioGraph::bindStreamAccess(const AudioStreamAccess* access)
+{
+    streamAccess = access;
+}
+
+void AudioGraph::invalidate()
+{
+    if (m_transactionDepth) { return; }
+    m_valid.store(false, std::memory_order_release);
+}
+
+void AudioGraph::topologyChanged()
+{
+    // a transaction compiles on commit
+    if (m_transactionDepth) { return; }
+    m_stale = true;
+    if (!compileEventAttached) {
+        compileEventAttached = true;
+        compileEvent.attach(compileDeferred);
+    }
+    compileEvent.triggerEvent();
+}
+
+void AudioGraph::compileIfStale()
+{
+    if (m_stale) { compile(); }
+}
+
+const AudioPlan* AudioGraph::plan()
+{
+    if (!m_valid.load(std::memory_order_acquire)) { return nullptr; }
+    return m_published.load(std::memory_order_acquire);
+}
+
+bool AudioGraph::reserve(AudioPlan& plan, unsigned numEntries, unsigned numFanout)
+{
+    if (numEntries > plan.entryCapacity) {
+        AudioPlanEntry* entries = (AudioPlanEntry*)realloc(plan.entries, numEntries * sizeof(AudioPlanEntry));
+        if (!entries) { return false; }
+        plan.entries = entries;
+        // the ordered ID table never has more slots than there are entries
+        AudioPlanEntry** ordered = (AudioPlanEntry**)realloc(plan.orderedEntries, numEntries * sizeof(AudioPlanEntry*));
+        if (!ordered) { return false; }
+        plan.orderedEntries = ordered;
+        plan.entryCapacity  = numEntries;
+    }
+    if (numFanout > plan.fanoutCapacity) {
+        AudioFanout* fanout = (AudioFanout*)realloc(plan.fanout, numFanout * sizeof(AudioFanout));
+        if (!fanout) { return false; }
+        plan.fanout         = fanout;
+        plan.fanoutCapacity = numFanout;
+    }
+    return true;
+}
+
+void AudioGraph::addEntry(AudioPlan& plan, unsigned node)
+{
+    AudioPlanEntry& entry = plan.entries[plan.numEntries++];
+    entry.stream      = scratch.streams[node];
+    entry.inputs      = streamAccess->inputQueue(entry.stream);
+    entry.numInputs   = streamAccess->numInputs(entry.stream);
+    NodeRecord* record = recordFor(entry.stream);
+    entry.stats       = record ? record->stats : nullptr;
+    entry.flags       = record ? record->entryFlags : 0;
+    entry.handoff     = (entry.flags & AUDIO_ENTRY_LOW_TIER) ? record->handoff : nullptr;
+    entry.fanoutBegin = plan.fanout + plan.numFanout;
+    for (unsigned e = scratch.edgeBegin[node]; e < scratch.edgeBegin[node + 1]; e++) {
+        const CompileEdge& edge = scratch.edges[e];
+        AudioFanout& f = plan.fanout[plan.numFanout++];
+        f.queue    = streamAccess->inputQueue(streamAccess->destination(edge.conn)) + streamAccess->destinationIndex(edge.conn);
+        f.srcIndex = streamAccess->sourceIndex(edge.conn);
+        f.flags    = edge.feedback ? AUDIO_FANOUT_FEEDBACK : 0;
+        f.dstEntry = scratch.rank[edge.dst];
+        f.handoff  = nullptr;
+        if (edge.feedback) { plan.numFeedback++; }
+    }
+    entry.fanoutEnd = plan.fanout + plan.numFanout;
+}
+
+// Collect the streams and their connections into index based tables
+bool AudioGraph::gatherEdges(unsigned numStreams, unsigned numEdges)
+{
+    if (numStreams + 1 > scratch.nodeCapacity) {
+        if (!growArray(scratch.streams, numStreams + 1) || !growArray(scratch.edgeBegin, numStreams + 1) ||
+            !growArray(scratch.inDegree, numStreams + 1) || !growArray(scratch.order, numStreams + 1) ||
+            !growArray(scratch.rank, numStreams + 1) ||
+            !growArray(scratch.path, numStreams + 1) || !growArray(scratch.pathEdge, numStreams + 1) ||
+            !growArray(scratch.pathStep, numStreams + 1) || !growArray(scratch.placed, numStreams + 1)) {
+            return false;
+        }
+        scratch.nodeCapacity = numStreams + 1;
+    }
+    if (numEdges > scratch.edgeCapacity) {
+        if (!growArray(scratch.edges, numEdges)) { return false; }
+        scratch.edgeCapacity = numEdges;
+    }
+
+    unsigned node = 0;
+    for (AudioStream* s = streamAccess->firstUpdate(); s; s = streamAccess->nextUpdate(s)) {
+        scratch.streams[node++] = s;
+    }
+
+    unsigned edge = 0;
+    for (node = 0; node < numStreams; node++) {
+        scratch.edgeBegin[node] = edge;
+        for (AudioConnection* c = streamAccess->destinationList(scratch.streams[node]); c; c = *streamAccess->nextDest(c)) {
+            unsigned dst = 0;
+            while ((dst < numStreams) && (scratch.streams[dst] != streamAccess->destination(c))) { dst++; }
+            if (dst == numStreams) { continue; } // destination is not a registered stream
+            scratch.edges[edge].src      = node;
+            scratch.edges[edge].dst      = dst;
+            scratch.edges[edge].feedback = (dst == node);
+            scratch.edges[edge].conn     = c;
+            edge++;
+        }
+    }
+    scratch.edgeBegin[numStreams] = edge;
+    return true;
+}
+
+// Find a cycle among the unplaced nodes and mark one of its edges as feedback.
+// Every unplaced node still has an unplaced predecessor, so walking backwards
+// from any of them must revisit a node. The cycle is entered at the node
+// already fed by a placed node, so the signal path flows into the loop in
+// order, falling back to the earliest constructed node. The cycle edge into
+// the entry node becomes the feedback edge.
+void AudioGraph::breakCycle(unsigned numStreams, unsigned start)
+{
+    constexpr uint16_t NOT_VISITED = 0xFFFFU;
+    unsigned numEdges = scratch.edgeBegin[numStreams];
+    for (unsigned n = 0; n < numStreams; n++) { scratch.pathStep[n] = NOT_VISITED; }
+
+    unsigned len  = 0;
+    unsigned node = start;
+    while (scratch.pathStep[node] == NOT_VISITED) {
+        scratch.pathStep[node] = len;
+        scratch.path[len] = node;
+        unsigned e = 0;
+        while ((e < numEdges) && !((scratch.edges[e].dst == node) && !scratch.edges[e].feedback && !scratch.placed[scratch.edges[e].src])) { e++; }
+        if (e == numEdges) { return; } // should never happen, the node would be ready
+        scratch.pathEdge[len++] = e;
+        node = scratch.edges[e].src;
+    }
+
+    // path[pathStep[node]] .. path[len-1] is the cycle
+    unsigned pick    = scratch.pathStep[node];
+    bool     pickFed = false;
+    for (unsigned i = scratch.pathStep[node]; i < len; i++) {
+        bool fed = false;
+        for (unsigned e = 0; e < numEdges && !fed; e++) {
+            fed = (scratch.edges[e].dst == scratch.path[i]) && scratch.placed[scratch.edges[e].src];
+        }
+        if ((fed && !pickFed) || ((fed == pickFed) && (scratch.path[i] < scratch.path[pick]))) {
+            pick    = i;
+            pickFed = fed;
+        }
+    }
+    scratch.edges[scratch.pathEdge[pick]].feedback = true;
+    scratch.inDegree[scratch.path[pick]]--;
+}
+
+// Kahn's algorithm, always taking the earliest constructed ready node so an
+// acyclic graph built in dataflow order keeps its original order. Cycles are
+// broken one feedback edge at a time when no node is ready.
+void AudioGraph::sortTopological(unsigned numStreams)
+{
+    unsigned numEdges = scratch.edgeBegin[numStreams];
+    for (unsigned n = 0; n < numStreams; n++) {
+        scratch.inDegree[n] = 0;
+        scratch.placed[n]   = false;
+    }
+    for (unsigned e = 0; e < numEdges; e++) {
+        if (!scratch.edges[e].feedback) { scratch.inDegree[scratch.edges[e].dst]++; }
+    }
+
+    unsigned numPlaced = 0;
+    while (numPlaced < numStreams) {
+        unsigned next = numStreams;
+        unsigned firstUnplaced = numStreams;
+        for (unsigned n = 0; n < numStreams; n++) {
+            if (scratch.placed[n]) { continue; }
+            if (firstUnplaced == numStreams) { firstUnplaced = n; }
+            if (scratch.inDegree[n] == 0) { next = n; break; }
+        }
+
+        if (next == numStreams) {
+            breakCycle(numStreams, firstUnplaced);
+            continue;
+        }
+
+        scratch.placed[next]       = true;
+        scratch.order[numPlaced++] = next;
+        for (unsigned e = scratch.edgeBegin[next]; e < scratch.edgeBegin[next + 1]; e++) {
+            if (!scratch.edges[e].feedback) { scratch.inDegree[scratch.edges[e].dst]--; }
+        }
+    }
+}
+
+// Map the IDs used by the ordered update mode onto plan entries so the
+// ordered traversal can use the compiled fan-out tables as well.
+void AudioGraph::compileOrdered(AudioPlan& plan)
+{
+    plan.numOrdered = 0;
+    plan.stepEntry  = nullptr;
+    AudioStream* step = streamAccess->stepUpdateObject();
+    for (unsigned i = 0; i < plan.numEntries; i++) {
+        if (plan.entries[i].stream == step) { plan.stepEntry = &plan.entries[i]; }
+    }
+    AudioStream** ordered = streamAccess->orderedUpdateArray();
+    if (!ordered) { return; }
+
+    for (unsigned id = 0; id < plan.numEntries && ordered[id]; id++) {
+        AudioPlanEntry* match = nullptr;
+        for (unsigned i = 0; i < plan.numEntries; i++) {
+            if (plan.entries[i].stream == ordered[id]) { match = &plan.entries[i]; break; }
+        }
+        plan.orderedEntries[plan.numOrdered++] = match;
+    }
+}
+
+bool AudioGraph::compile()
+{
+    // A compile requested from an interrupt that preempted the audio update
+    // must not touch the plans. Leave the plan stale so the ISR falls back.
+    if (m_inProcess) { invalidate(); return false; }
+    // inside a transaction the old plan keeps running until the commit,
+    // which compiles again if the request came in after its own build
+    if (m_transactionDepth) { m_recompile = true; return false; }
+
+    AudioPlan* published = m_published.load(std::memory_order_acquire);
+    AudioPlan& plan = (published == &m_plans[0]) ? m_plans[1] : m_plans[0];
+    if (!build(plan)) { return false; }
+
+    m_published.store(&plan, std::memory_order_release);
+    m_valid.store(true, std::memory_order_release);
+    return true;
+}
+
+bool AudioGraph::build(AudioPlan& plan)
+{
+    // no connection has been constructed yet
+    if (!streamAccess) { return false; }
+    m_stale = false;
+
+    unsigned numStreams = 0;
+    unsigned numFanout  = 0;
+    for (AudioStream* s = streamAccess->firstUpdate(); s; s = streamAccess->nextUpdate(s)) {
+        numStreams++;
+        for (AudioConnection* c = streamAccess->destinationList(s); c; c = *streamAccess->nextDest(c)) { numFanout++; }
+    }
+
+    if (!reserve(plan, numStreams, numFanout) || !gatherEdges(numStreams, numFanout)) {
+        invalidate();
+        return false;
+    }
+    sortTopological(numStreams);
+    for (unsigned i = 0; i < numStreams; i++) {
+        scratch.rank[scratch.order[i]] = i;
+    }
+
+    plan.numEntries  = 0;
+    plan.numFanout   = 0;
+    plan.numFeedback = 0;
+    for (unsigned i = 0; i < numStreams; i++) {
+        addEntry(plan, scratch.order[i]);
+    }
+    resolveTiers(plan);
+    markInPlace(plan);
+    compileOrdered(plan);
+    return true;
+}
+
+// Keep a low tier node in the low tier only if all its outputs stay in the
+// low tier, then route the edges crossing from the high tier through the
+// destination's handoff queues.
+void AudioGraph::resolveTiers(AudioPlan& plan)
+{
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (unsigned i = plan.numEntries; i-- > 0;) {
+            AudioPlanEntry& entry = plan.entries[i];
+            if (!(entry.flags & AUDIO_ENTRY_LOW_TIER)) { continue; }
+            bool keep = !streamAccess->useOrderedUpdate();
+            for (const AudioFanout* f = entry.fanoutBegin; keep && (f != entry.fanoutEnd); ++f) {
+                keep = plan.entries[f->dstEntry].flags & AUDIO_ENTRY_LOW_TIER;
+            }
+            if (!keep) {
+                entry.flags  &= ~AUDIO_ENTRY_LOW_TIER;
+                entry.handoff = nullptr;
+                changed = true;
+            }
+        }
+    }
+
+    plan.numLowTier = 0;
+    for (unsigned i = 0; i < plan.numEntries; i++) {
+        AudioPlanEntry& entry = plan.entries[i];
+        if (entry.flags & AUDIO_ENTRY_LOW_TIER) {
+            plan.numLowTier++;
+            continue;
+        }
+        for (AudioFanout* f = entry.fanoutBegin; f != entry.fanoutEnd; ++f) {
+            const AudioPlanEntry& dst = plan.entries[f->dstEntry];
+            if (!(dst.flags & AUDIO_ENTRY_LOW_TIER) || !dst.handoff) { continue; }
+            f->flags  |= AUDIO_FANOUT_HANDOFF;
+            f->handoff = dst.handoff + (f->queue - dst.inputs);
+        }
+    }
+}
+
+void AudioGraph::transmit(const AudioPlanEntry* entry, audio_block_float32_t* block, unsigned char index)
+{
+    for (const AudioFanout* f = entry->fanoutBegin; f != entry->fanoutEnd; ++f) {
+        if (f->srcIndex != index) { continue; }
+        if (f->flags & AUDIO_FANOUT_HANDOFF) {
+            pushHandoff(*f->handoff, block);
+        } else if (*f->queue == nullptr) {
+            *f->queue = block;
+            audioBlockAddRef(block);
+        }
+    }
+}
+
+void AudioGraph::updateNode(AudioStream* p)
+{
+    if (!p->isActive()) { return; }
+    uint32_t cycles = SysTimer::cycleCnt32();
+    streamAccess->update(p);
+    recordCycles(p, SysTimer::cycleCnt32() - cycles);
+    releaseUnconsumed(p);
+}
+
+unsigned AudioGraph::releaseUnconsumed(AudioStream* p)
+{
+    if (!m_releaseUnconsumed) { return 0; }
+
+    audio_block_float32_t** inputs = streamAccess->inputQueue(p);
+    unsigned numInputs = streamAccess->numInputs(p);
+    unsigned count = 0;
+    for (unsigned i = 0; i < numInputs; i++) {
+        audio_block_float32_t* block = inputs[i];
+        if (!block) { continue; }
+        inputs[i] = nullptr;
+        streamAccess->release(block);
+        count++;
+    }
+    if (count) {
+        m_leakedBlocks += count;
+        if (m_current && (m_current->stream == p) && m_current->stats) { m_current->stats->leakedBlocks += count; }
+    }
+    return count;
+}
+
+void AudioGraph::recordCycles(AudioStream* p, uint32_t cycles)
+{
+    uint32_t scaled = cycles >> 6;
+    if (scaled > UINT16_MAX) { scaled = UINT16_MAX; }
+    p->cpu_cycles = scaled;
+    if (scaled > p->cpu_cycles_max) p->cpu_cycles_max = scaled;
+
+    if (m_current && (m_current->stream == p) && m_current->stats) {
+        m_current->stats->cycles.record(cycles);
+    }
+}
+
+void AudioGraph::recordTotalCycles(uint32_t cycles)
+{
+    uint32_t scaled = cycles >> 6;
+    if (scaled > UINT16_MAX) { scaled = UINT16_MAX; }
+    AudioStream::cpu_cycles_total = scaled;
+    if (scaled > AudioStream::cpu_cycles_total_max) AudioStream::cpu_cycles_total_max = scaled;
+    m_totalCycles.record(cycles);
+}
+
+const CycleHistogram* AudioGraph::cycleHistogram(const AudioStream& stream)
+{
+    NodeRecord* record = findRecord(&stream);
+    return record ? &record->stats->cycles : nullptr;
+}
+
+const AudioNodeStats* AudioGraph::nodeStats(const AudioStream& stream)
+{
+    NodeRecord* record = findRecord(&stream);
+    return record ? record->stats : nullptr;
+}
+
+void AudioGraph::resetCycleHistograms()
+{
+    for (unsigned i = 0; i < numNodeRecords; i++) {
+        nodeRecords[i].stats->cycles.reset();
+        nodeRecords[i].stats->leakedBlocks = 0;
+    }
+    m_leakedBlocks = 0;
+    m_totalCycles.reset();
+    m_triggerLatency.reset();
+    m_triggerJitter.reset();
+    m_lastTrigger = 0;
+}
+
+void AudioGraph::printCycleReport()
+{
+    const AudioPlan* plan = AudioGraph::plan();
+    if (!plan) {
+        sysLogger.printf("AudioGraph::printCycleReport(): no compiled plan\n");
+        return;
+    }
+
+    sysLogger.printf("AudioGraph cycles:  entry     id       p50       p99     p99.9       max      ewma     count    leaks\n");
+    for (unsigned i = 0; i < plan->numEntries; i++) {
+        const AudioNodeStats* stats = plan->entries[i].stats;
+        if (!stats) { continue; }
+        const CycleHistogram& h = stats->cycles;
+        sysLogger.printf("AudioGraph cycles: %6u %6d %9lu %9lu %9lu %9lu %9lu %9lu %8lu\n", i, plan->entries[i].stream->getId(),
+            (unsigned long)h.p50(), (unsigned long)h.p99(), (unsigned long)h.p999(), (unsigned long)h.max(),
+            (unsigned long)h.ewma(), (unsigned long)h.count(), (unsigned long)stats->leakedBlocks);
+    }
+    const CycleHistogram& t = m_totalCycles;
+    sysLogger.printf("AudioGraph cycles:  total        %9lu %9lu %9lu %9lu %9lu %9lu %8lu\n",
+        (unsigned long)t.p50(), (unsigned long)t.p99(), (unsigned long)t.p999(), (unsigned long)t.max(),
+        (unsigned long)t.ewma(), (unsigned long)t.count(), (unsigned long)m_leakedBlocks);
+}
+
+bool AudioGraph::process()
+{
+    if (!m_valid.load(std::memory_order_acquire)) { return false; }
+    AudioPlan* plan = m_published.load(std::memory_order_acquire);
+    if (!plan) { return false; }
+
+    // the block update may have preempted the low tier
+    AudioPlanEntry* preempted = m_current;
+    m_inProcess = true;
+    AudioPlanEntry* end = plan->entries + plan->numEntries;
+    for (AudioPlanEntry* entry = plan->entries; entry != end; ++entry) {
+        if (entry->flags & AUDIO_ENTRY_LOW_TIER) { continue; }
+        m_current = entry;
+        if (shouldBypass(entry)) { bypassNode(entry); }
+        else if (!sleepIfSilent(entry)) { updateNode(entry->stream); }
+    }
+    m_current   = preempted;
+    m_inProcess = false;
+
+    if (plan->numLowTier) {
+        __atomic_add_fetch(&m_lowTierPending, 1, __ATOMIC_RELEASE);
+        if (++m_lowTierCount >= m_lowTierDivisor) {
+            m_lowTierCount = 0;
+            audioLowTierTrigger();
+        }
+    }
+    return true;
+}
+
+void AudioGraph::processLowTier()
+{
+    AudioPlan* plan = m_valid.load(std::memory_order_acquire) ? m_published.load(std::memory_order_acquire) : nullptr;
+    unsigned runs = __atomic_exchange_n(&m_lowTierPending, 0U, __ATOMIC_ACQUIRE);
+    if (!plan || !plan->numLowTier) { return; }
+    // the queues cannot hold more, anything older has been dropped
+    if (runs > AudioHandoff::DEPTH) { runs = AudioHandoff::DEPTH; }
+    while (runs--) { runLowTier(plan); }
+}
+
+void AudioGraph::runLowTier(AudioPlan* plan)
+{
+    AudioPlanEntry* end = plan->entries + plan->numEntries;
+    for (AudioPlanEntry* entry = plan->entries; entry != end; ++entry) {
+        if (!(entry->flags & AUDIO_ENTRY_LOW_TIER)) { continue; }
+        for (unsigned i = 0; entry->handoff && (i < entry->numInputs); i++) {
+            audio_block_float32_t* block = popHandoff(entry->handoff[i]);
+            if (!block) { continue; }
+            if (entry->inputs[i]) { streamAccess->release(entry->inputs[i]); }
+            entry->inputs[i] = block;
+        }
+        // Shedding is not applied, the low tier does not load the block update
+        m_current = entry;
+        if (!sleepIfSilent(entry)) { updateNode(entry->stream); }
+    }
+    m_current = nullptr;
+}
+
+bool AudioGraph::setTier(AudioStream& stream, AudioTier tier)
+{
+    NodeRecord* record = recordFor(&stream);
+    if (!record) { return false; }
+    unsigned numInputs = streamAccess ? streamAccess->numInputs(&stream) : 0;
+    if (tier == AudioTier::LOW) {
+        if (!record->handoff && numInputs) {
+            // all-zero is an empty queue, aligned so the indices keep their own cache lines
+            record->handoff = (AudioHandoff*)aligned_alloc(alignof(AudioHandoff), numInputs * sizeof(AudioHandoff));
+            if (!record->handoff) { return false; }
+            memset((void*)record->handoff, 0, numInputs * sizeof(AudioHandoff));
+            record->numHandoffs = numInputs;
+        }
+        record->entryFlags |= AUDIO_ENTRY_LOW_TIER;
+    } else {
+        record->entryFlags &= ~AUDIO_ENTRY_LOW_TIER;
+    }
+    AudioHandoff* handoff = record->handoff; // compile() may move the record
+    compile();
+
+    if ((tier == AudioTier::HIGH) && handoff && (AudioGraph::tier(stream) == AudioTier::HIGH)) {
+        // drop what the low tier did not get to
+        SysAudioLock audioLock;
+        for (unsigned i = 0; i < numInputs; i++) {
+            while (audio_block_float32_t* block = popHandoff(handoff[i])) { streamAccess->release(block); }
+        }
+    }
+    return true;
+}
+
+AudioTier AudioGraph::tier(const AudioStream& stream)
+{
+    const AudioPlan* plan = AudioGraph::plan();
+    if (!plan) { return AudioTier::HIGH; }
+    for (unsigned i = 0; i < plan->numEntries; i++) {
+        if (plan->entries[i].stream == &stream) {
+            return (plan->entries[i].flags & AUDIO_ENTRY_LOW_TIER) ? AudioTier::LOW : AudioTier::HIGH;
+        }
+    }
+    return AudioTier::HIGH;
+}
+
+bool AudioGraph::isLowTier(const AudioStream* stream)
+{
+    const AudioPlan* plan = m_published.load(std::memory_order_acquire);
+    if (!plan || !plan->numLowTier) { return false; }
+    for (unsigned i = 0; i < plan->numEntries; i++) {
+        if (plan->entries[i].stream == stream) { return plan->entries[i].flags & AUDIO_ENTRY_LOW_TIER; }
+    }
+    return false;
+}
+
+void AudioGraph::setLowTierDivisor(unsigned divisor)
+{
+    if (divisor < 1) { divisor = 1; }
+    if (divisor > AudioHandoff::DEPTH / 2) { divisor = AudioHandoff::DEPTH / 2; }
+    m_lowTierDivisor = divisor;
+}
+
+uint32_t AudioGraph::lowTierDropped()
+{
+    uint32_t dropped = 0;
+    for (unsigned i = 0; i < numNodeRecords; i++) {
+        if (!nodeRecords[i].handoff) { continue; }
+        for (unsigned j = 0; j < nodeRecords[i].numHandoffs; j++) { dropped += nodeRecords[i].handoff[j].dropped; }
+    }
+    return dropped;
+}
+
+void AudioGraph::markInPlace(AudioPlan& plan)
+{
+    for (unsigned i = 0; i < plan.numFanout; i++) {
+        plan.entries[plan.fanout[i].dstEntry].flags |= AUDIO_ENTRY_IN_PLACE;
+    }
+    for (unsigned i = 0; i < plan.numEntries; i++) {
+        const AudioPlanEntry& entry = plan.entries[i];
+        for (const AudioFanout* f = entry.fanoutBegin; f != entry.fanoutEnd; ++f) {
+            if (!isLastReader(entry, *f)) { plan.entries[f->dstEntry].flags &= ~AUDIO_ENTRY_IN_PLACE; }
+        }
+    }
+}
+
+bool AudioGraph::canProcessInPlace(const AudioStream& stream)
+{
+    const AudioPlan* plan = AudioGraph::plan();
+    if (!plan) { return false; }
+    for (unsigned i = 0; i < plan->numEntries; i++) {
+        if (plan->entries[i].stream == &stream) { return plan->entries[i].flags & AUDIO_ENTRY_IN_PLACE; }
+    }
+    return false;
+}
+
+bool AudioGraph::analyzeMemory(AudioMemoryReport& report, unsigned ioReserveBlocks)
+{
+    const AudioPlan* plan = AudioGraph::plan();
+    if (!plan) { return false; }
+
+    unsigned numEntries = plan->numEntries;
+    // change in live block count at each plan index
+    int* delta = (int*)calloc(numEntries + 1, sizeof(int));
+    if (!delta) { return false; }
+
+    report = AudioMemoryReport();
+    for (unsigned i = 0; i < numEntries; i++) {
+        const AudioPlanEntry& entry = plan->entries[i];
+        if (entry.flags & AUDIO_ENTRY_IN_PLACE) { report.inPlaceNodes++; }
+
+        for (const AudioFanout* f = entry.fanoutBegin; f != entry.fanoutEnd; ++f) {
+            if (!isLastReader(entry, *f)) { report.copyingEdges++; continue; }
+
+            // one block per output, its lifetime ends at its last reader
+            if (f->flags & AUDIO_FANOUT_FEEDBACK) {
+                delta[i]++;
+                delta[numEntries]--;
+                delta[0]++;
+                delta[f->dstEntry + 1]--;
+            } else {
+                delta[i]++;
+                delta[f->dstEntry + 1]--;
+            }
+        }
+    }
+
+    int live = 0;
+    for (unsigned i = 0; i < numEntries; i++) {
+        live += delta[i];
+        if (live > (int)report.peakLiveBlocks) {
+            report.peakLiveBlocks = live;
+            report.peakEntry      = i;
+        }
+    }
+    free(delta);
+
+    report.recommendedBlocks = report.peakLiveBlocks + ioReserveBlocks;
+    report.floatPoolBlocks   = AudioPools::floatStats().numBlocks;
+    report.int16PoolBlocks   = AudioPools::int16Stats().numBlocks;
+    report.poolBlocks        = report.floatPoolBlocks + report.int16PoolBlocks;
+    return true;
+}
+
+void AudioGraph::printMemoryReport(unsigned ioReserveBlocks)
+{
+    AudioMemoryReport report;
+    if (!analyzeMemory(report, ioReserveBlocks)) {
+        sysLogger.printf("AudioGraph::printMemoryReport(): no compiled plan\n");
+        return;
+    }
+
+    constexpr unsigned FLOAT_BLOCK_BYTES = sizeof(audio_block_float32_t) + AUDIO_BLOCK_SAMPLES * sizeof(float);
+    constexpr unsigned INT16_BLOCK_BYTES = sizeof(audio_block_t) + AUDIO_BLOCK_SAMPLES * sizeof(int16_t);
+    AudioPoolStats floatStats = AudioPools::floatStats();
+    AudioPoolStats int16Stats = AudioPools::int16Stats();
+    sysLogger.printf("AudioGraph memory: peak %u live blocks at entry %u, %u in-place nodes, %u copying edges\n",
+        report.peakLiveBlocks, report.peakEntry, report.inPlaceNodes, report.copyingEdges);
+    sysLogger.printf("AudioGraph memory: recommended %u blocks (%u bytes as float32, %u as int16)\n",
+        report.recommendedBlocks, report.recommendedBlocks * FLOAT_BLOCK_BYTES, report.recommendedBlocks * INT16_BLOCK_BYTES);
+    sysLogger.printf("AudioGraph memory: float32 pool %u blocks (%u bytes), max used %u\n",
+        report.floatPoolBlocks, report.floatPoolBlocks * FLOAT_BLOCK_BYTES, floatStats.usedMax);
+    sysLogger.printf("AudioGraph memory: int16 pool %u blocks (%u bytes), max used %u, %lu fell back to float32\n",
+        report.int16PoolBlocks, report.int16PoolBlocks * INT16_BLOCK_BYTES, int16Stats.usedMax,
+        (unsigned long)AudioPools::int16Fallbacks());
+    if (report.poolBlocks < report.recommendedBlocks) {
+        sysLogger.printf("AudioGraph memory: WARNING: pools are %u blocks short\n", report.recommendedBlocks - report.poolBlocks);
+    } else if (report.poolBlocks > report.recommendedBlocks) {
+        // spare blocks can come out of either pool, as far as it has them
+        unsigned spare      = report.poolBlocks - report.recommendedBlocks;
+        unsigned spareFloat = (spare < report.floatPoolBlocks) ? spare : report.floatPoolBlocks;
+        unsigned spareInt16 = (spare < report.int16PoolBlocks) ? spare : report.int16PoolBlocks;
+        sysLogger.printf("AudioGraph memory: %u spare blocks, up to %u bytes in the float32 pool or %u in the int16 pool\n",
+            spare, spareFloat * FLOAT_BLOCK_BYTES, spareInt16 * INT16_BLOCK_BYTES);
+    }
+}
+
+void AudioGraph::setSheddable(AudioStream& stream, bool sheddable)
+{
+    NodeRecord* record = recordFor(&stream);
+    if (!record) { return; }
+    if (sheddable) { record->entryFlags |= AUDIO_ENTRY_SHEDDABLE; }
+    else { record->entryFlags &= ~AUDIO_ENTRY_SHEDDABLE; }
+    compile();
+}
+
+bool AudioGraph::isSheddable(const AudioStream& stream)
+{
+    NodeRecord* record = findRecord(&stream);
+    return record && (record->entryFlags & AUDIO_ENTRY_SHEDDABLE);
+}
+
+void AudioGraph::bypassNode(AudioPlanEntry* entry)
+{
+    for (unsigned i = 0; i < entry->numInputs; i++) {
+        audio_block_float32_t* block = entry->inputs[i];
+        if (!block) { continue; }
+        entry->inputs[i] = nullptr;
+        if (i == 0) { transmit(entry, block, 0); }
+        streamAccess->release(block);
+    }
+}
+
+void AudioGraph::setDeadlineSamples(unsigned samples)
+{
+    if (samples >= AUDIO_BLOCK_SAMPLES) { samples = 0; }
+    m_deadlineSamples = samples;
+    m_deadline.setPeriod(0);
+}
+
+void AudioGraph::beginUpdate(uint32_t now)
+{
+    advanceFade();
+    if (!m_deadline.period()) {
+        unsigned samples = m_deadlineSamples ? m_deadlineSamples : AUDIO_BLOCK_SAMPLES;
+        m_deadline.setPeriod(audioPeriodCycles(SysCpuTelemetry::getCpuFreqHz(), samples, AudioClock::nominalSampleRate()));
+    }
+    m_deadline.beginUpdate(now);
+
+    if (m_triggerPending) {
+        m_triggerPending = false;
+        uint32_t trigger = m_triggerCycles;
+        m_triggerLatency.record(now - trigger);
+        // the clock has just counted this block, its period is current
+        AudioClockSnapshot clock;
+        AudioClock::snapshot(clock);
+        if (m_lastTrigger && (clock.cyclesPerSample > 0.0f)) {
+            int32_t error = (int32_t)(trigger - m_lastTrigger) - (int32_t)(clock.cyclesPerSample * AUDIO_BLOCK_SAMPLES + 0.5f);
+            m_triggerJitter.record((error < 0) ? -error : error);
+        }
+        m_lastTrigger = trigger ? trigger : 1;
+    }
+}
+
+void AudioGraph::endUpdate(uint32_t now)
+{
+    m_deadline.endUpdate(now);
+}
+
+void AudioGraph::printDeadlineReport()
+{
+    const AudioDeadlineStats& stats = m_deadline.stats();
+    sysLogger.printf("AudioGraph deadline: period %lu cycles, last %lu (%u%%), worst %lu\n",
+        (unsigned long)m_deadline.period(), (unsigned long)stats.lastCycles, m_deadline.lastLoadPercent(),
+        (unsigned long)stats.worstCycles);
+    sysLogger.printf("AudioGraph deadline: %lu updates, %lu overruns, %lu late starts, %lu shed events%s\n",
+        (unsigned long)stats.updates, (unsigned long)stats.overruns, (unsigned long)stats.lateStarts,
+        (unsigned long)stats.shedEvents, m_deadline.isShedding() ? ", shedding" : "");
+}
+
+void AudioGraph::printTriggerReport()
+{
+    const CycleHistogram* histograms[] = {&m_triggerLatency, &m_triggerJitter};
+    const char* names[] = {"latency", "jitter "};
+    sysLogger.printf("AudioGraph trigger:            p50       p99     p99.9       max     count\n");
+    for (unsigned i = 0; i < 2; i++) {
+        const CycleHistogram& h = *histograms[i];
+        sysLogger.printf("AudioGraph trigger:  %s %9lu %9lu %9lu %9lu %9lu\n", names[i],
+            (unsigned long)h.p50(), (unsigned long)h.p99(), (unsigned long)h.p999(), (unsigned long)h.max(),
+            (unsigned long)h.count());
+    }
+}
+
+void AudioGraph::setSleepWhenSilent(AudioStream& stream, bool enable, uint32_t tailSamples)
+{
+    NodeRecord* record = recordFor(&stream);
+    if (!record) { return; }
+    record->stats->tailSamples   = tailSamples;
+    record->stats->silentSamples = 0;
+    if (enable) { record->entryFlags |= AUDIO_ENTRY_SLEEPS; }
+    else { record->entryFlags &= ~AUDIO_ENTRY_SLEEPS; }
+    compile();
+}
+
+bool AudioGraph::isAsleep(const AudioStream& stream)
+{
+    NodeRecord* record = findRecord(&stream);
+    return record && (record->entryFlags & AUDIO_ENTRY_SLEEPS) && (record->stats->silentSamples >= record->stats->tailSamples) &&
+        inputsSilent(stream);
+}
+
+bool AudioGraph::inputsSilent(const AudioStream& stream)
+{
+    if (!streamAccess) { return true; }
+    audio_block_float32_t** inputs = streamAccess->inputQueue(&stream);
+    unsigned numInputs = streamAccess->numInputs(&stream);
+    for (unsigned i = 0; i < numInputs; i++) {
+        if (!isAudioBlockSilent(inputs[i])) { return false; }
+    }
+    return true;
+}
+
+bool AudioGraph::sleepIfSilent(AudioPlanEntry* entry)
+{
+    if (!(entry->flags & AUDIO_ENTRY_SLEEPS) || !entry->stats) { return false; }
+    AudioStream*    p     = entry->stream;
+    AudioNodeStats* stats = entry->stats;
+    if (!p->isActive() || (entry->numInputs == 0) || !inputsSilent(*p)) {
+        stats->silentSamples = 0;
+        return false;
+    }
+    if (stats->silentSamples < stats->tailSamples) {
+        // still ringing out
+        stats->silentSamples += AUDIO_BLOCK_SAMPLES;
+        return false;
+    }
+
+    for (unsigned i = 0; i < entry->numInputs; i++) {
+        if (entry->inputs[i]) {
+            streamAccess->release(entry->inputs[i]);
+            entry->inputs[i] = nullptr;
+        }
+    }
+    audio_block_float32_t* zero = audioZeroBlockFloat();
+    for (const AudioFanout* f = entry->fanoutBegin; f != entry->fanoutEnd; ++f) {
+        if (f->flags & AUDIO_FANOUT_HANDOFF) { pushHandoff(*f->handoff, zero); }
+        else if (*f->queue == nullptr) { *f->queue = zero; }
+    }
+    p->cpu_cycles = 0;
+    stats->skippedUpdates++;
+    return true;
+}
+
+void AudioGraph::beginTransaction()
+{
+    SysAudioLock audioLock;
+    m_transactionDepth++;
+}
+
+bool AudioGraph::commitTransaction(unsigned fadeBlocks)
+{
+    {
+        SysAudioLock audioLock;
+        if (m_transactionDepth == 0) { return false; }
+        if (m_transactionDepth > 1) {
+            m_transactionDepth--;
+            return true;  // an outer transaction commits
+        }
+    }
+
+    // The transaction stays open until the ISR has taken the new plan, so a
+    // compile() from another context cannot rebuild the idle plan while it is
+    // pending. Such a compile is deferred and runs once the swap is done.
+    m_recompile = false;
+    AudioPlan* published = m_published.load(std::memory_order_acquire);
+    AudioPlan& plan = (published == &m_plans[0]) ? m_plans[1] : m_plans[0];
+    bool built = build(plan);
+
+    if (!built) {
+        // nothing was handed over, fall back until a compile succeeds
+        m_valid.store(false, std::memory_order_release);
+    } else if (!streamAccess->updateScheduled() || !m_valid.load(std::memory_order_acquire)) {
+        // the audio update is not running, or already falling back, swap now
+        m_published.store(&plan, std::memory_order_release);
+        m_valid.store(true, std::memory_order_release);
+    } else {
+        // Hand the plan to the audio ISR, which swaps it in at the start of an
+        // update once the output has faded out.
+        {
+            SysAudioLock audioLock;
+            m_fadeDelta = fadeBlocks ? 1.0f / fadeBlocks : 0.0f;
+            m_pending.store(&plan, std::memory_order_release);
+            m_fadeState = fadeBlocks ? FADE_OUT : FADE_SWAP;
+        }
+
+        // wait for the swap, giving up if the audio update has stopped
+        uint32_t timeoutMs = SWAP_TIMEOUT_MS + fadeBlocks * (AUDIO_BLOCK_SAMPLES * 1000U / (unsigned)AudioClock::nominalSampleRate() + 1U);
+        uint32_t start = SysTimer::millis();
+        while (m_pending.load(std::memory_order_acquire) && (SysTimer::millis() - start < timeoutMs)) {
+            SysCpuControl::yield();
+        }
+        SysAudioLock audioLock;
+        if (m_pending.load(std::memory_order_acquire)) {
+            m_pending.store(nullptr, std::memory_order_relaxed);
+            m_published.store(&plan, std::memory_order_release);
+            m_valid.store(true, std::memory_order_release);
+            m_fadeState = FADE_IDLE;
+            m_fadeGain  = 1.0f;
+            m_fadeStart = 1.0f;
+        }
+    }
+
+    if (built) {
+        // Streams left without connections stop only now, the old plan needed
+        // them until the swap
+        for (AudioStream* s = streamAccess->firstUpdate(); s; s = streamAccess->nextUpdate(s)) {
+            if (streamAccess->numConnections(s) == 0) { streamAccess->setActive(s, false); }
+        }
+    }
+
+    unsigned depth;
+    {
+        SysAudioLock audioLock;
+        depth = --m_transactionDepth;
+    }
+    if (!depth && m_recompile) { compile(); }
+    return built;
+}
+
+bool AudioGraph::outputFade(float& gainStart, float& gainEnd)
+{
+    gainStart = m_fadeStart;
+    gainEnd   = m_fadeGain;
+    return (gainStart < 1.0f) || (gainEnd < 1.0f);
+}
+
+// Runs at the start of every audio update, so the plan swap always happens on
+// a block boundary and costs a single pointer store.
+void AudioGraph::advanceFade()
+{
+    switch (m_fadeState) {
+    case FADE_OUT :
+        m_fadeStart = m_fadeGain;
+        m_fadeGain -= m_fadeDelta;
+        if (m_fadeGain <= 0.0f) {
+            m_fadeGain  = 0.0f;
+            m_fadeState = FADE_SWAP;
+        }
+        break;
+    case FADE_SWAP :
+        m_published.store(m_pending.load(std::memory_order_acquire), std::memory_order_release);
+        m_valid.store(true, std::memory_order_release);
+        m_pending.store(nullptr, std::memory_order_release);
+        m_fadeStart = m_fadeGain;
+        if (m_fadeDelta > 0.0f) {
+            m_fadeGain += m_fadeDelta;
+            if (m_fadeGain >= 1.0f) { m_fadeGain = 1.0f; }
+            m_fadeState = FADE_IN;
+        } else {
+            m_fadeState = FADE_IDLE;
+        }
+        break;
+    case FADE_IN :
+        m_fadeStart = m_fadeGain;
+        m_fadeGain += m_fadeDelta;
+        if (m_fadeGain >= 1.0f) {
+            m_fadeGain  = 1.0f;
+            m_fadeState = FADE_IDLE;
+        }
+        break;
+    case FADE_IDLE :
+    default :
+        m_fadeStart = 1.0f;
+        m_fadeGain  = 1.0f;
+        break;
+    }
+}
+
+bool AudioGraph::reserveConnections(unsigned extra)
+{
+    return prevLinks.reserve(prevLinks.size() + extra) && inputOwners.reserve(inputOwners.size() + extra);
+}
+
+bool AudioGraph::linkConnection(AudioConnection** link, AudioConnection* c)
+{
+    // record the link first, so running out of memory leaves the lists intact
+    if (!prevLinks.insert(c, link)) { return false; }
+    AudioConnection** next = streamAccess->nextDest(c);
+    *next = *link;
+    if (*next) {
+        AudioConnection*** nextLink = prevLinks.find(*next);
+        if (nextLink) { *nextLink = next; }
+    }
+    *link = c;
+    return true;
+}
+
+void AudioGraph::unlinkConnection(AudioConnection* c)
+{
+    AudioConnection*** link = prevLinks.find(c);
+    if (!link || !*link) { return; }
+    AudioConnection** next = streamAccess->nextDest(c);
+    **link = *next;
+    if (*next) {
+        AudioConnection*** nextLink = prevLinks.find(*next);
+        if (nextLink) { *nextLink = *link; }
+    }
+    *link = nullptr; // keep the slot so relinking does not allocate
+    *next = nullptr;
+}
+
+bool AudioGraph::isLinked(AudioConnection* c)
+{
+    AudioConnection*** link = prevLinks.find(c);
+    return link && *link;
+}
+
+void AudioGraph::forgetConnection(AudioConnection* c)
+{
+    prevLinks.erase(c);
+}
+
+AudioConnection* AudioGraph::inputOwner(AudioStream* dst, unsigned index)
+{
+    AudioConnection** owner = inputOwners.find(streamAccess->inputQueue(dst) + index);
+    return owner ? *owner : nullptr;
+}
+
+void AudioGraph::setInputOwner(AudioStream* dst, unsigned index, AudioConnection* c)
+{
+    if (c) { inputOwners.insert(streamAccess->inputQueue(dst) + index, c); }
+    else { inputOwners.erase(streamAccess->inputQueue(dst) + index); }
+}
@@ -0,0 +1,450 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "sysPlatform/AudioStream.h"
+#include "CycleHistogram.h"
+#include "AudioDeadline.h"
+#include "SysRingBuffer.h"
+
+/// AudioFanout flags
+constexpr uint8_t AUDIO_FANOUT_FEEDBACK = 0x1; ///< edge closes a cycle, the block is consumed one block later
+constexpr uint8_t AUDIO_FANOUT_HANDOFF  = 0x2; ///< edge crosses from the high to the low tier through an AudioHandoff
+
+/// AudioPlanEntry flags
+constexpr uint8_t AUDIO_ENTRY_IN_PLACE   = 0x1; ///< node is the last reader of every input, receiveWritable() never copies
+constexpr uint8_t AUDIO_ENTRY_SHEDDABLE = 0x2; ///< node may be bypassed when the audio update runs out of time
+constexpr uint8_t AUDIO_ENTRY_SLEEPS    = 0x4; ///< node is skipped once its inputs have been silent for its tail length
+constexpr uint8_t AUDIO_ENTRY_LOW_TIER  = 0x8; ///< node runs in the low priority tier instead of the block update
+
+/// Processing tier of a node
+enum class AudioTier : uint8_t {
+    HIGH, ///< updated in the block update interrupt, every block
+    LOW   ///< updated in the lower priority tier interrupt, see AudioGraph::setTier()
+};
+
+/// Queue of blocks handed from the block update to one input of a low tier
+/// node. The block update is the only producer, the low tier the only
+/// consumer. Each queued block holds a reference.
+struct AudioHandoff {
+    static constexpr unsigned DEPTH = 16; ///< power of two, must cover the low tier divisor plus slack
+
+    SysPlatform::SysSpscRing<audio_block_float32_t*, DEPTH> queue;
+    uint32_t dropped; ///< blocks dropped because the queue was full
+};
+
+/// One destination of a node output, resolved to the input queue slot it feeds
+struct AudioFanout {
+    audio_block_float32_t** queue;    ///< address of the destination's inputQueue[dest_index]
+    uint8_t                 srcIndex; ///< output index on the source node
+    uint8_t                 flags;
+    uint16_t                dstEntry; ///< plan index of the destination node
+    AudioHandoff*           handoff;  ///< queue of the destination input for AUDIO_FANOUT_HANDOFF edges, else nullptr
+};
+
+/// Telemetry and silence state of one node, kept across compiles
+struct AudioNodeStats {
+    SysPlatform::CycleHistogram cycles;             ///< update cycles
+    uint32_t                    leakedBlocks   = 0; ///< input blocks left unconsumed by update() and released by the sweep
+    uint32_t                    skippedUpdates = 0; ///< updates skipped because the node was asleep
+    uint32_t                    tailSamples    = 0; ///< samples to keep updating after the inputs go silent
+    uint32_t                    silentSamples  = 0; ///< samples the inputs have been silent for, up to tailSamples
+};
+
+/// One node update in execution order
+struct AudioPlanEntry {
+    AudioStream* stream;
+    audio_block_float32_t** inputs; ///< the node's inputQueue
+    uint8_t      numInputs;
+    AudioFanout* fanoutBegin; ///< first AudioFanout of this node
+    AudioFanout* fanoutEnd;   ///< one past the last AudioFanout of this node
+    AudioNodeStats* stats;    ///< telemetry of the node, nullptr if it could not be allocated
+    AudioHandoff* handoff;    ///< one queue per input for low tier nodes, else nullptr
+    uint8_t      flags;
+};
+
+/// Result of the buffer lifetime analysis of a compiled plan
+struct AudioMemoryReport {
+    unsigned peakLiveBlocks    = 0; ///< most pool blocks alive at once while the plan runs
+    unsigned peakEntry         = 0; ///< plan index of the node where the peak occurs
+    unsigned inPlaceNodes      = 0; ///< nodes that are the last reader of all their inputs
+    unsigned copyingEdges      = 0; ///< edges whose reader is not the last, receiveWritable() copies there
+    unsigned recommendedBlocks = 0; ///< peakLiveBlocks plus the I/O reserve
+    unsigned poolBlocks        = 0; ///< blocks currently in both pools
+    unsigned floatPoolBlocks   = 0; ///< blocks in the float32 pool
+    unsigned int16PoolBlocks   = 0; ///< blocks in the int16 pool, which int16 allocations try first
+};
+
+/// A compiled execution plan. All arrays are flat and owned by the plan.
+struct AudioPlan {
+    AudioPlanEntry*  entries        = nullptr;
+    unsigned         numEntries     = 0;
+    unsigned         entryCapacity  = 0;
+    AudioFanout*     fanout         = nullptr;
+    unsigned         numFanout      = 0;
+    unsigned         fanoutCapacity = 0;
+    AudioPlanEntry** orderedEntries = nullptr; ///< entry for each AudioStream::ordered_update_array slot
+    unsigned         numOrdered     = 0;
+    AudioPlanEntry*  stepEntry      = nullptr; ///< entry of AudioStream::step_update_object
+    unsigned         numFeedback    = 0;       ///< number of fan-out edges marked AUDIO_FANOUT_FEEDBACK
+    unsigned         numLowTier     = 0;       ///< number of entries marked AUDIO_ENTRY_LOW_TIER
+};
+
+/// The AudioStream and AudioConnection internals AudioGraph works on.
+/// AudioGraph is not a friend of either class. The AudioConnection
+/// constructor fills this table with lambdas, which share its access to the
+/// private members, and binds it before the first connection is linked.
+struct AudioStreamAccess {
+    AudioStream*            (*firstUpdate)();
+    AudioStream*            (*nextUpdate)(const AudioStream* s);
+    AudioConnection*        (*destinationList)(const AudioStream* s);
+    audio_block_float32_t** (*inputQueue)(const AudioStream* s);
+    unsigned                (*numInputs)(const AudioStream* s);
+    unsigned                (*numConnections)(const AudioStream* s);
+    void                    (*setActive)(AudioStream* s, bool active);
+    void                    (*update)(AudioStream* s);
+    void                    (*release)(audio_block_float32_t* block);
+    bool                    (*updateScheduled)();
+    bool                    (*useOrderedUpdate)();
+    AudioStream*            (*stepUpdateObject)();
+    AudioStream**           (*orderedUpdateArray)(); ///< nullptr terminated, or nullptr
+    AudioConnection**       (*nextDest)(AudioConnection* c);
+    AudioStream*            (*destination)(const AudioConnection* c);
+    unsigned                (*sourceIndex)(const AudioConnection* c);
+    unsigned                (*destinationIndex)(const AudioConnection* c);
+};
+
+/// Compiles the AudioStream/AudioConnection linked lists into a flat execution
+/// plan after the topology changes. The audio ISR then iterates the plan
+/// array and transmit() writes straight into the precomputed input queue slots
+/// instead of walking first_update/next_update and each destination_list.
+///
+/// Entries are placed in topological order so every node runs after the nodes
+/// feeding it, regardless of construction order. Ties keep construction order.
+/// When the connections form a cycle, the cycle edge into the node where the
+/// signal path enters the loop is marked AUDIO_FANOUT_FEEDBACK. That edge
+/// delivers its block to a node that has already run, so it is consumed on the
+/// next update, an explicit one-block delay.
+///
+/// Two plans are kept. A new plan is built into the idle one from thread context
+/// and published with a single pointer store, so the ISR always sees a complete
+/// plan. While the topology is being edited the plan is invalidated and the ISR
+/// falls back to the original linked-list traversal.
+class AudioGraph {
+public:
+    /// Give AudioGraph the accessors of the stream internals. Called by every
+    /// AudioConnection constructor, until then there is nothing to compile.
+    static void bindStreamAccess(const AudioStreamAccess* access);
+
+    /// Mark the current plan stale. Called with IRQs disabled while the
+    /// connection lists are being modified.
+    static void invalidate();
+
+    /// Mark the plan for a rebuild after a connect() or disconnect(). The
+    /// rebuild runs from the next yield(), so a batch of connections made in
+    /// one pass of loop() is compiled once. Inside a transaction the commit
+    /// compiles instead. Until then the ISR uses the linked-list traversal.
+    static void topologyChanged();
+
+    /// Compile now if topologyChanged() left the plan stale, e.g. to have it
+    /// ready before the next yield(). Thread context only.
+    static void compileIfStale();
+
+    /// Start editing the topology without disturbing the running audio. Until
+    /// the matching commitTransaction(), connect() and disconnect() only edit
+    /// the connection lists. The ISR keeps running the current plan, and
+    /// streams that lose their last connection stay active. Transactions nest.
+    static void beginTransaction();
+
+    /// Compile the edited topology and swap it in at the start of an audio
+    /// update. With fadeBlocks, the I2S output fades out over that many blocks,
+    /// the plan is swapped, and the output fades back in. Blocks until the swap
+    /// has happened, so call it from thread context. The transaction stays
+    /// open until then, so connect(), disconnect() and the recompiling setters
+    /// called meanwhile from other contexts cannot touch the plan being handed
+    /// over. All streams in the old topology must stay alive until it returns.
+    /// @param fadeBlocks length of each fade, 0 swaps on the next update
+    /// @returns false if there was no open transaction or the plan could not be built
+    static bool commitTransaction(unsigned fadeBlocks = 0);
+
+    /// @returns true while a transaction is open
+    static bool inTransaction() { return m_transactionDepth != 0; }
+
+    /// Connection list bookkeeping for AudioConnection. The lists stay singly
+    /// linked through next_dest for the ISR, the link pointing at each
+    /// connection and the connection owning each input are kept in side tables
+    /// so connect() and disconnect() do not scan. All of these are hash table
+    /// lookups and do not allocate once reserveConnections() has succeeded, so
+    /// they may run with IRQs disabled.
+    /// @{
+    /// Make room for extra connections and input owners
+    /// @returns false if out of memory
+    static bool reserveConnections(unsigned extra);
+    /// Insert c at the list position link points to, e.g. &AudioStream::unused
+    /// @returns false if out of memory, c is then not linked
+    static bool linkConnection(AudioConnection** link, AudioConnection* c);
+    /// Remove c from whatever list it is on
+    static void unlinkConnection(AudioConnection* c);
+    /// @returns true if c is on a list
+    static bool isLinked(AudioConnection* c);
+    /// Drop all bookkeeping of a connection being destroyed. Unlink it first.
+    static void forgetConnection(AudioConnection* c);
+    /// @returns the connection feeding an input, or nullptr if it is free
+    static AudioConnection* inputOwner(AudioStream* dst, unsigned index);
+    /// Set or clear (with nullptr) the connection feeding an input
+    static void setInputOwner(AudioStream* dst, unsigned index, AudioConnection* c);
+    /// @}
+
+    /// Gain ramp the outputs must apply to the current update because of a
+    /// plan swap fade
+    /// @param gainStart gain at the first sample of the block
+    /// @param gainEnd gain at the last sample of the block
+    /// @returns false if both are unity and nothing needs to be applied
+    static bool outputFade(float& gainStart, float& gainEnd);
+
+    /// Build and publish a new plan from the current connection lists. Inside
+    /// a transaction nothing is built and the old plan keeps running. The
+    /// request is remembered and compiled when the outermost transaction has
+    /// been committed, after its plan has been swapped in.
+    /// @returns true if a valid plan was published, false inside a transaction
+    static bool compile();
+
+    /// @returns the published plan, or nullptr if it is stale or missing
+    static const AudioPlan* plan();
+
+    /// Run every node in the published plan. Called from software_isr().
+    /// @returns false if there is no valid plan and the caller must use the
+    /// linked-list traversal instead
+    static bool process();
+
+    /// Select the entry whose fan-out table transmit() should use. Used by the
+    /// ordered update mode in software_isr().
+    static void setCurrent(AudioPlanEntry* entry) { m_current = entry; }
+
+    /// @returns the plan entry of the node currently being updated, or nullptr
+    static AudioPlanEntry* current() { return m_current; }
+
+    /// Deliver a block to the fan-out of the current entry
+    static void transmit(const AudioPlanEntry* entry, audio_block_float32_t* block, unsigned char index);
+
+    /// Update a single node and record its CPU cycles
+    static void updateNode(AudioStream* p);
+
+    /// Record the cycles of one node update. Sets cpu_cycles/cpu_cycles_max in
+    /// units of 64 cycles, saturated to 16 bits, and adds the full 32-bit count
+    /// to the node's histogram when p is the current entry.
+    static void recordCycles(AudioStream* p, uint32_t cycles);
+
+    /// Record the cycles of a whole audio update into cpu_cycles_total and the
+    /// total histogram
+    static void recordTotalCycles(uint32_t cycles);
+
+    /// @returns the update cycle histogram of a node, or nullptr if the node
+    /// has not been part of a compiled plan
+    static const SysPlatform::CycleHistogram* cycleHistogram(const AudioStream& stream);
+
+    /// @returns the telemetry of a node, or nullptr if the node has not been
+    /// part of a compiled plan
+    static const AudioNodeStats* nodeStats(const AudioStream& stream);
+
+    /// Release the input blocks a node left in its input queue after update().
+    /// Leftover blocks would otherwise hold their pool reference until the
+    /// node's next update and block newer data on that input. Leaks are
+    /// counted on the node when p is the current entry, and in leakedBlocks().
+    /// Does nothing while disabled with setReleaseUnconsumed(false).
+    /// @returns the number of blocks released
+    static unsigned releaseUnconsumed(AudioStream* p);
+
+    /// Enable or disable the end-of-update input sweep, enabled by default
+    static void setReleaseUnconsumed(bool enable) { m_releaseUnconsumed = enable; }
+
+    /// @returns the total number of blocks released by the input sweep
+    static uint32_t leakedBlocks() { return m_leakedBlocks; }
+
+    /// @returns the histogram of the cycles of whole audio updates
+    static const SysPlatform::CycleHistogram& totalCycleHistogram() { return m_totalCycles; }
+
+    /// Clear the histograms and leak counts of all nodes, the total and the
+    /// trigger histograms
+    static void resetCycleHistograms();
+
+    /// Log p50/p99/p99.9, max and average update cycles of every node in plan
+    /// order, followed by the total
+    static void printCycleReport();
+
+    /// Allow a node to be bypassed while the deadline monitor sheds load. A
+    /// bypassed node passes input 0 straight to output 0 and drops its other
+    /// inputs. Recompiles the plan, so call it from thread context.
+    static void setSheddable(AudioStream& stream, bool sheddable);
+
+    /// @returns true if the node was marked with setSheddable()
+    static bool isSheddable(const AudioStream& stream);
+
+    /// @returns the deadline monitor of the audio update, e.g. to set its policy
+    static SysPlatform::AudioDeadlineMonitor& deadline() { return m_deadline; }
+
+    /// Set the samples an audio update has to finish in, for I/O that needs
+    /// the next block sooner than one block period after it triggers the
+    /// update. The deadline period is recomputed on the next update.
+    /// @param samples the budget, 0 or AUDIO_BLOCK_SAMPLES for a whole block
+    static void setDeadlineSamples(unsigned samples);
+
+    /// Start deadline accounting for one audio update. Called from software_isr().
+    /// @param now cycle counter at the start of the update
+    static void beginUpdate(uint32_t now);
+
+    /// Finish deadline accounting for one audio update. Called from software_isr().
+    /// @param now cycle counter at the end of the update
+    static void endUpdate(uint32_t now);
+
+    /// @returns true if the entry must be bypassed instead of updated
+    static bool shouldBypass(const AudioPlanEntry* entry) {
+        return entry && (entry->flags & AUDIO_ENTRY_SHEDDABLE) && m_deadline.isShedding();
+    }
+
+    /// Pass input 0 of the entry's node to output 0 and release its other inputs
+    static void bypassNode(AudioPlanEntry* entry);
+
+    /// Log the deadline counters
+    static void printDeadlineReport();
+
+    /// Timestamp a request for an audio update. Called from
+    /// AudioStream::update_all(), normally by the I2S DMA interrupt.
+    /// @param now cycle counter when the update was requested
+    static void recordTrigger(uint32_t now) { m_triggerCycles = now; m_triggerPending = true; }
+
+    /// @returns the histogram of the cycles from update_all() to the start of
+    /// the audio update it requested, the software interrupt latency
+    static const SysPlatform::CycleHistogram& triggerLatencyHistogram() { return m_triggerLatency; }
+
+    /// @returns the histogram of how many cycles the interval between two
+    /// update_all() calls strays from one block period, as measured by
+    /// AudioClock. It shows the jitter of the DMA interrupt itself.
+    static const SysPlatform::CycleHistogram& triggerJitterHistogram() { return m_triggerJitter; }
+
+    /// Log p50/p99/p99.9 and max of the trigger latency and jitter
+    static void printTriggerReport();
+
+    /// Let a node sleep while its inputs are silent. Once every input has been
+    /// missing or flagged SILENT_MASK for tailSamples, update() is no longer
+    /// called, the inputs are released and every output receives the shared
+    /// zero block. The first non-silent input wakes the node. Use the tail of
+    /// effects that ring out, e.g. the delay length or the reverb decay time.
+    /// Nodes without inputs never sleep. Recompiles the plan, so call it from
+    /// thread context.
+    static void setSleepWhenSilent(AudioStream& stream, bool enable, uint32_t tailSamples = 0);
+
+    /// @returns true if the node skipped its most recent update
+    static bool isAsleep(const AudioStream& stream);
+
+    /// @returns true if every input of the node is missing or flagged silent.
+    /// Nodes can use this in update() to short-circuit on their own.
+    static bool inputsSilent(const AudioStream& stream);
+
+    /// Skip the update of an entry marked AUDIO_ENTRY_SLEEPS when its tail has
+    /// run out on silent inputs
+    /// @returns true if the node was skipped
+    static bool sleepIfSilent(AudioPlanEntry* entry);
+
+    /// Move a node between processing tiers. Low tier nodes are updated by a
+    /// second software interrupt at AUDIO_LOW_TIER_ISR_PRIORITY, after the
+    /// block update and preempted by it, so heavy analysis such as a tuner,
+    /// metering or an FFT cannot make the block update miss its deadline.
+    /// Blocks sent from the high tier to a low tier node are queued in an
+    /// AudioHandoff per input, and every low tier run consumes one block per
+    /// input, so the node still sees every block, only later. A low tier node
+    /// whose output feeds a high tier node is kept in the high tier, low tier
+    /// output can only feed other low tier nodes. Tiers are ignored in the
+    /// ordered update mode. Recompiles the plan, so call it from thread context.
+    /// @returns false if the handoff queues could not be allocated
+    static bool setTier(AudioStream& stream, AudioTier tier);
+
+    /// @returns the tier the node runs in with the published plan
+    static AudioTier tier(const AudioStream& stream);
+
+    /// @returns true if the node is in the low tier of the last published
+    /// plan, even while that plan is invalidated. A low tier run may still be
+    /// in progress on it, so the linked-list fallback in software_isr() and
+    /// transmit() must neither update such a node nor write its input queue.
+    /// The node resumes with the next valid plan.
+    static bool isLowTier(const AudioStream* stream);
+
+    /// Run the low tier once every divisor block updates, catching up on all
+    /// the blocks queued since its last run. Larger divisors save interrupt
+    /// overhead and let a long analysis spread over several block periods.
+    /// @param divisor 1 to AudioHandoff::DEPTH / 2
+    static void setLowTierDivisor(unsigned divisor);
+
+    /// Update the low tier nodes for every block queued since the last run.
+    /// Called from the low tier interrupt.
+    static void processLowTier();
+
+    /// @returns the number of blocks dropped because a handoff queue was full
+    static uint32_t lowTierDropped();
+
+    /// Compute block lifetimes over the published plan. A block lives from the
+    /// update of the node that transmits it until the update of its last
+    /// reader, or into the next cycle for feedback edges. The peak of
+    /// overlapping lifetimes is the smallest pool that can run the graph.
+    /// @param report receives the analysis
+    /// @param ioReserveBlocks blocks held outside the graph, e.g. by the I2S DMA
+    /// double buffers (two for input, up to four queued for output)
+    /// @returns false if there is no valid plan
+    static bool analyzeMemory(AudioMemoryReport& report, unsigned ioReserveBlocks = DEFAULT_IO_RESERVE_BLOCKS);
+
+    /// Log the memory analysis and warn when the pools are too small or
+    /// oversized. The analysis does not know the sample type of each block, so
+    /// the float32 and int16 pools are listed separately, each priced at its
+    /// own block size.
+    static void printMemoryReport(unsigned ioReserveBlocks = DEFAULT_IO_RESERVE_BLOCKS);
+
+    /// @returns true if the node reads every input as the last reader, so
+    /// receiveWritable() can hand over the block without a copy
+    static bool canProcessInPlace(const AudioStream& stream);
+
+    static constexpr unsigned DEFAULT_IO_RESERVE_BLOCKS = 6;
+
+    static constexpr unsigned SWAP_TIMEOUT_MS = 50; ///< extra wait for the ISR to take a committed plan
+
+private:
+    enum FadeState : uint8_t { FADE_IDLE, FADE_OUT, FADE_SWAP, FADE_IN };
+
+    static bool build(AudioPlan& plan);
+    static void advanceFade();
+    static void addEntry(AudioPlan& plan, unsigned node);
+    static bool reserve(AudioPlan& plan, unsigned numEntries, unsigned numFanout);
+    static bool gatherEdges(unsigned numStreams, unsigned numEdges);
+    static void sortTopological(unsigned numStreams);
+    static void breakCycle(unsigned numStreams, unsigned start);
+    static void compileOrdered(AudioPlan& plan);
+    static void markInPlace(AudioPlan& plan);
+    static void resolveTiers(AudioPlan& plan);
+    static void runLowTier(AudioPlan* plan);
+
+    static AudioPlan                m_plans[2];
+    static std::atomic<AudioPlan*>  m_published;
+    static std::atomic<bool>        m_valid;
+    static volatile bool            m_inProcess;
+    static AudioPlanEntry*          m_current;
+    static SysPlatform::CycleHistogram m_totalCycles;
+    static SysPlatform::AudioDeadlineMonitor m_deadline;
+    static unsigned                 m_deadlineSamples; ///< update budget in samples, 0 for a block
+    static SysPlatform::CycleHistogram m_triggerLatency;
+    static SysPlatform::CycleHistogram m_triggerJitter;
+    static volatile uint32_t        m_triggerCycles;  ///< cycle counter at the last update_all()
+    static volatile bool            m_triggerPending; ///< update_all() was called since the last update started
+    static uint32_t                 m_lastTrigger;    ///< trigger of the previous update, 0 after a reset
+    static bool                     m_releaseUnconsumed;
+    static volatile unsigned        m_transactionDepth;
+    static volatile bool            m_recompile; ///< compile() was called inside a transaction after its build
+    static volatile bool            m_stale;     ///< topologyChanged() since the last build
+    static std::atomic<AudioPlan*>  m_pending;   ///< plan committed but not yet swapped in by the ISR
+    static volatile uint8_t         m_fadeState;
+    static float                    m_fadeDelta; ///< gain change per block
+    static float                    m_fadeGain;  ///< gain at the end of the current update
+    static float                    m_fadeStart; ///< gain at the start of the current update
+    static uint32_t                 m_leakedBlocks;
+    static unsigned                 m_lowTierDivisor;
+    static unsigned                 m_lowTierCount;   ///< block updates since the low tier was last triggered
+    static volatile unsigned        m_lowTierPending; ///< block updates the low tier has not caught up with
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+namespace SysPlatform {
+
+/// Stimulus played by AudioLatencyProbe
+enum class AudioProbeStimulus : uint8_t {
+    IMPULSE, ///< one pulse per period, the capture is its own correlation
+    MLS,     ///< maximum length sequence, spreads the energy over the period so it survives noise
+};
+
+constexpr unsigned AUDIO_PROBE_MLS_ORDER      = 12;
+constexpr unsigned AUDIO_PROBE_PERIOD         = (1U << AUDIO_PROBE_MLS_ORDER) - 1U; ///< samples, ~93 ms at 44.1 kHz
+constexpr unsigned AUDIO_PROBE_PEAK_EXCLUDE   = 16;   ///< samples either side of the peak the codec filters smear it over
+constexpr float    AUDIO_PROBE_MIN_PEAK_RATIO = 2.0f;
+constexpr unsigned AUDIO_PROBE_MLS_WORDS      = (AUDIO_PROBE_PERIOD + 31U) / 32U;
+
+/// Result of one AudioLatencyProbe measurement
+struct AudioLatencyResult {
+    bool     valid          = false; ///< the correlation peak stood out by at least AUDIO_PROBE_MIN_PEAK_RATIO
+    uint32_t latencySamples = 0;     ///< round trip from the probe output back to its input
+    float    latencyMicros  = 0.0f;  ///< the same at the sample rate measured by AudioClock
+    float    peakRatio      = 0.0f;  ///< correlation peak over the largest value outside its neighbourhood
+    bool     inverted       = false; ///< the loop inverts the polarity
+};
+
+/// @returns true if sample index of the MLS is +level, false for -level
+inline bool audioProbeMlsBit(const uint32_t* mls, unsigned index)
+{
+    return (mls[index / 32U] >> (index % 32U)) & 1U;
+}
+
+/// Generate one period of the MLS, one bit per sample. A Fibonacci LFSR for
+/// the primitive polynomial x^12 + x^6 + x^4 + x + 1, shifting right with the
+/// feedback entering at the top.
+/// @param mls AUDIO_PROBE_MLS_WORDS words
+inline void audioProbeMls(uint32_t* mls)
+{
+    constexpr uint32_t TAPS = (1U << 6) | (1U << 4) | (1U << 1) | (1U << 0);
+    uint32_t lfsr = 1;
+    for (unsigned i = 0; i < AUDIO_PROBE_PERIOD; i++) {
+        if (i % 32U == 0) { mls[i / 32U] = 0; }
+        mls[i / 32U] |= (lfsr & 1U) << (i % 32U);
+        uint32_t feedback = __builtin_parity(lfsr & TAPS);
+        lfsr = (lfsr >> 1) | (feedback << (AUDIO_PROBE_MLS_ORDER - 1U));
+    }
+}
+
+/// Circular cross-correlation of a capture with the stimulus. The capture is
+/// indexed by the stimulus sample sent with it, so a loop latency of L
+/// samples puts the response to stimulus sample k at capture index k + L.
+/// @param result receives the lag of the peak and how far it stands out
+/// @param capture AUDIO_PROBE_PERIOD samples
+/// @param mls the sequence from audioProbeMls(), unused for IMPULSE
+/// @param r AUDIO_PROBE_PERIOD samples of scratch, receives the correlation
+/// @param sampleRate converts the lag to latencyMicros
+inline void audioProbeCorrelate(AudioLatencyResult& result, AudioProbeStimulus stimulus, const float* capture,
+    const uint32_t* mls, float* r, float sampleRate)
+{
+    constexpr unsigned PERIOD = AUDIO_PROBE_PERIOD;
+    unsigned peakLag = 0;
+    for (unsigned lag = 0; lag < PERIOD; lag++) {
+        if (stimulus == AudioProbeStimulus::IMPULSE) {
+            r[lag] = capture[lag];
+        } else {
+            float sum = 0.0f;
+            unsigned n = lag;
+            for (unsigned k = 0; k < PERIOD; k++) {
+                sum += audioProbeMlsBit(mls, k) ? capture[n] : -capture[n];
+                if (++n == PERIOD) { n = 0; }
+            }
+            r[lag] = sum;
+        }
+        if (std::fabs(r[lag]) > std::fabs(r[peakLag])) { peakLag = lag; }
+    }
+
+    // the largest value outside the smear of the peak, the lags wrap around
+    float second = 0.0f;
+    for (unsigned lag = 0; lag < PERIOD; lag++) {
+        unsigned distance = (lag > peakLag) ? lag - peakLag : peakLag - lag;
+        if (distance > PERIOD / 2) { distance = PERIOD - distance; }
+        if ((distance > AUDIO_PROBE_PEAK_EXCLUDE) && (std::fabs(r[lag]) > second)) { second = std::fabs(r[lag]); }
+    }
+
+    float peak = std::fabs(r[peakLag]);
+    result.latencySamples = peakLag;
+    result.latencyMicros  = (sampleRate > 0.0f) ? (float)peakLag * 1e6f / sampleRate : 0.0f;
+    result.peakRatio      = (second > 0.0f) ? peak / second : ((peak > 0.0f) ? INFINITY : 0.0f);
+    result.inverted       = r[peakLag] < 0.0f;
+    result.valid          = result.peakRatio >= AUDIO_PROBE_MIN_PEAK_RATIO;
+}
+
+}
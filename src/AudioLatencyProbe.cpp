@@ -0,0 +1,117 @@
+#include <cmath>
+#include <cstdlib>
+#include "sysPlatform/SysTypes.h"
+#include "sysPlatform/SysTimer.h"
+#include "sysPlatform/SysCpuControl.h"
+#include "sysPlatform/SysLogger.h"
+#include "AudioBlockPool.h"
+#include "AudioClock.h"
+#include "AudioGraph.h"
+#include "AudioLatencyProbe.h"
+
+namespace SysPlatform {
+
+AudioLatencyProbe::AudioLatencyProbe()
+: AudioStream(1, m_inputQueueArray)
+{
+    audioProbeMls(m_mls);
+}
+
+int16_t AudioLatencyProbe::stimulusSample(unsigned index) const
+{
+    if (m_stimulus == AudioProbeStimulus::IMPULSE) { return (index == 0) ? m_level : 0; }
+    return audioProbeMlsBit(m_mls, index) ? m_level : (int16_t)-m_level;
+}
+
+void AudioLatencyProbe::update(void)
+{
+    audio_block_t *in = receiveReadOnly(0);
+    uint8_t state = m_state;
+    if ((state != PRIMING) && (state != CAPTURING)) {
+        release(in);
+        return;
+    }
+
+    audio_block_t *out = allocateAudioBlock<int16_t>();
+    if (!out || ((state == CAPTURING) && !in)) {
+        // a gap in the stimulus or the capture corrupts the correlation
+        release(out);
+        release(in);
+        m_state = FAILED;
+        return;
+    }
+
+    unsigned position = m_position;
+    for (unsigned i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+        out->data[i] = stimulusSample(position);
+        if (state == CAPTURING) {
+            // index the capture by the stimulus sample transmitted with it
+            m_capture[position] = (in->flags & FLOAT_MASK) ? ((audio_block_float32_t *)in)->data[i]
+                                                           : (float)in->data[i] * (1.0f / 32768.0f);
+        }
+        if (++position == PERIOD) { position = 0; }
+    }
+    m_position = position;
+    transmit(out, 0);
+    release(out);
+    release(in);
+
+    // one period primes the loop, the next is captured
+    m_count += AUDIO_BLOCK_SAMPLES;
+    if (m_count >= PERIOD) {
+        m_count = 0;
+        m_state = (state == PRIMING) ? CAPTURING : DONE;
+    }
+}
+
+bool AudioLatencyProbe::measure(AudioLatencyResult& result, AudioProbeStimulus stimulus, float level, unsigned timeoutMs)
+{
+    result = AudioLatencyResult();
+    // the capture, then the correlation
+    float *buffer = (float *)malloc(2 * PERIOD * sizeof(float));
+    if (!buffer) { return false; }
+    m_capture = buffer;
+    if (level > 1.0f) { level = 1.0f; }
+    if (level < 0.0f) { level = 0.0f; }
+
+    m_stimulus = stimulus;
+    m_level    = (int16_t)(level * 32767.0f);
+    m_position = 0;
+    m_count    = 0;
+    // capture samples only arrive for positions played while capturing
+    for (unsigned i = 0; i < PERIOD; i++) { m_capture[i] = 0.0f; }
+    m_state = PRIMING;
+
+    uint32_t start = SysTimer::millis();
+    while (((m_state == PRIMING) || (m_state == CAPTURING)) && (SysTimer::millis() - start < timeoutMs)) {
+        SysCpuControl::yield();
+    }
+    // the update runs in an interrupt, once it sees IDLE the buffer is free
+    bool done = (m_state == DONE);
+    m_state = IDLE;
+
+    if (done) {
+        float rate = AudioClock::measuredSampleRate();
+        if (rate <= 0.0f) { rate = AudioClock::nominalSampleRate(); }
+        audioProbeCorrelate(result, m_stimulus, m_capture, m_mls, buffer + PERIOD, rate);
+    }
+    m_capture = nullptr;
+    free(buffer);
+    return done;
+}
+
+void printAudioLatency(AudioLatencyProbe& probe, AudioProbeStimulus stimulus)
+{
+    AudioLatencyResult result;
+    const char *name = (stimulus == AudioProbeStimulus::MLS) ? "MLS" : "impulse";
+    if (!probe.measure(result, stimulus)) {
+        sysLogger.printf("AudioLatencyProbe: %s capture failed\n", name);
+    } else {
+        sysLogger.printf("AudioLatencyProbe: %s round trip %lu samples (%.1f us), peak ratio %.1f%s%s\n",
+            name, (unsigned long)result.latencySamples, result.latencyMicros, result.peakRatio,
+            result.inverted ? ", inverted" : "", result.valid ? "" : ", NOT VALID");
+    }
+    AudioGraph::printTriggerReport();
+}
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include "sysPlatform/AudioStream.h"
+#include "AudioLatencyCorrelation.h"
+
+namespace SysPlatform {
+
+/// Round-trip latency measurement node.
+///
+/// Connect output 0 to a codec output and input 0 to the matching codec
+/// input, and loop the two back with a cable. measure() plays a periodic
+/// stimulus of PERIOD samples, lets one period pass so the loop is in steady
+/// state, then captures one period indexed by the stimulus sample that was
+/// transmitted at the same time. The lag of the circular cross-correlation
+/// peak is the latency the graph sees: output DMA, DAC, the analog loop, ADC
+/// and input DMA. It must be shorter than PERIOD. Outside measure() the probe
+/// transmits nothing and drops its input.
+///
+/// The stimulus is sent as int16 blocks, which every I2S word length accepts.
+class AudioLatencyProbe : public AudioStream {
+public:
+    static constexpr unsigned MLS_ORDER      = AUDIO_PROBE_MLS_ORDER;
+    static constexpr unsigned PERIOD         = AUDIO_PROBE_PERIOD;
+    static constexpr unsigned PEAK_EXCLUDE   = AUDIO_PROBE_PEAK_EXCLUDE;
+    static constexpr float    MIN_PEAK_RATIO = AUDIO_PROBE_MIN_PEAK_RATIO;
+
+    AudioLatencyProbe();
+    virtual ~AudioLatencyProbe() = default;
+
+    /// Play the stimulus, capture it and correlate. Thread context only, it
+    /// blocks for two periods plus the correlation, about 17M additions for
+    /// MLS, and allocates the capture and correlation buffers from the heap
+    /// for the duration.
+    /// @param result receives the measurement
+    /// @param stimulus IMPULSE or MLS
+    /// @param level stimulus amplitude as a fraction of full scale
+    /// @param timeoutMs give up if the audio update stops
+    /// @returns false if the capture did not complete, e.g. the pool ran dry
+    /// or an input block was missing
+    bool measure(AudioLatencyResult& result, AudioProbeStimulus stimulus = AudioProbeStimulus::MLS,
+        float level = 0.25f, unsigned timeoutMs = 1000);
+
+    virtual void update(void) override;
+
+private:
+    enum State : uint8_t { IDLE, PRIMING, CAPTURING, DONE, FAILED };
+
+    int16_t stimulusSample(unsigned index) const;
+
+    audio_block_t     *m_inputQueueArray[1];
+    uint32_t           m_mls[AUDIO_PROBE_MLS_WORDS]; ///< one bit per sample, set for +level
+    volatile uint8_t   m_state    = IDLE;
+    AudioProbeStimulus m_stimulus = AudioProbeStimulus::MLS;
+    int16_t            m_level    = 0;
+    unsigned           m_position = 0; ///< stimulus sample at the start of the next block
+    unsigned           m_count    = 0; ///< samples played in the current state
+    float             *m_capture  = nullptr;
+};
+
+/// Measure the round-trip latency with probe and log it, followed by the
+/// AudioGraph trigger latency and jitter histograms
+void printAudioLatency(AudioLatencyProbe& probe, AudioProbeStimulus stimulus = AudioProbeStimulus::MLS);
+
+}
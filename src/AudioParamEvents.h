@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+#include "sysPlatform/AudioStream.h"
+#include "SysRingBuffer.h"
+#include "AudioClock.h"
+
+namespace SysPlatform {
+
+/// A parameter change scheduled at a sample position
+struct AudioParamEvent {
+    uint32_t offset; ///< samples from the start of the next block the node processes
+    uint16_t param;  ///< parameter ID, defined by the node
+    float    value;
+};
+
+/// Per-node queue of timestamped parameter changes.
+///
+/// Control threads, MIDI handlers and other interrupts post() events
+/// lock-free. The node drains them in update() with renderBlock(), which splits
+/// the block at the event offsets. Parameters then change exactly at their
+/// sample instead of whenever a UI thread happens to write a member, and a node
+/// only has to smooth a parameter after an event instead of every sample.
+///
+/// Events may be scheduled beyond the current block. They are held back and
+/// delivered in the block they fall into. Events with the same offset are
+/// delivered in the order they were posted by one producer.
+/// @tparam Capacity queued plus held back events, a power of two
+template <unsigned Capacity = 32>
+class AudioParamEventQueue {
+public:
+    AudioParamEventQueue() = default;
+
+    /// Schedule a parameter change. Any context.
+    /// @param offset samples after the start of the next block, 0 applies it
+    /// at the start of the next block
+    /// @returns false if the queue is full and the event was dropped
+    bool post(uint16_t param, float value, uint32_t offset = 0) {
+        AudioParamEvent event = {offset, param, value};
+        if (m_ring.push(event)) { return true; }
+        __atomic_add_fetch(&m_dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    /// Schedule a parameter change at an AudioClock sample time. Threads and
+    /// interrupts other than the audio update, which posts with an offset into
+    /// the block instead. From an interrupt preempting the audio update before
+    /// the node ran, the event lands one block early.
+    /// Events whose sample has passed apply at the start of the next block
+    /// and are counted by late().
+    /// @returns false if the queue is full or the sample is more than 2^32
+    /// samples ahead, and the event was dropped
+    bool postAt(uint64_t sample, uint16_t param, float value) {
+        uint64_t nextBlock = AudioClock::isRunning() ? AudioClock::blockSample() + AUDIO_BLOCK_SAMPLES : 0;
+        return postAt(sample, param, value, nextBlock);
+    }
+
+    /// Schedule a parameter change at a sample time, given the sample time of
+    /// the start of the next block the node processes
+    bool postAt(uint64_t sample, uint16_t param, float value, uint64_t nextBlock) {
+        if (sample < nextBlock) {
+            __atomic_add_fetch(&m_late, 1, __ATOMIC_RELAXED);
+            return post(param, value, 0);
+        }
+        if ((sample - nextBlock) > UINT32_MAX) {
+            __atomic_add_fetch(&m_dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+        return post(param, value, static_cast<uint32_t>(sample - nextBlock));
+    }
+
+    /// Render one block split at the events falling into it. Audio ISR only,
+    /// call it once per update().
+    /// @param apply called as apply(const AudioParamEvent&) for each event at its offset
+    /// @param render called as render(unsigned start, unsigned end) for each
+    /// run of samples between events, end exclusive. Runs are never empty and
+    /// together cover the whole block.
+    template <typename Apply, typename Render>
+    void renderBlock(Apply apply, Render render) {
+        collect();
+
+        unsigned start = 0;
+        unsigned kept  = 0;
+        for (unsigned i = 0; i < m_numHeld; i++) {
+            AudioParamEvent& event = m_held[i];
+            if (event.offset >= AUDIO_BLOCK_SAMPLES) {
+                // a later block, keep it relative to the next one
+                event.offset -= AUDIO_BLOCK_SAMPLES;
+                m_held[kept++] = event;
+                continue;
+            }
+            if (event.offset > start) {
+                render(start, event.offset);
+                start = event.offset;
+            }
+            apply(event);
+        }
+        m_numHeld = kept;
+        if (start < AUDIO_BLOCK_SAMPLES) { render(start, AUDIO_BLOCK_SAMPLES); }
+    }
+
+    /// Deliver every due event at the start of the block, for nodes that do
+    /// not need sample accuracy. Audio ISR only.
+    template <typename Apply>
+    void applyBlock(Apply apply) {
+        renderBlock(apply, [](unsigned, unsigned) {});
+    }
+
+    /// @returns true if events are queued or held back
+    bool pending() const { return m_numHeld || !m_ring.empty(); }
+
+    /// @returns the number of events dropped because the queue was full
+    uint32_t dropped() const { return __atomic_load_n(&m_dropped, __ATOMIC_RELAXED); }
+
+    /// @returns the number of events posted with postAt() after their sample
+    uint32_t late() const { return __atomic_load_n(&m_late, __ATOMIC_RELAXED); }
+
+private:
+    // Move the posted events into the held list and keep it sorted by offset.
+    // Insertion sort is stable and the list is short.
+    void collect() {
+        AudioParamEvent event;
+        while ((m_numHeld < Capacity) && m_ring.pop(event)) {
+            unsigned i = m_numHeld++;
+            while ((i > 0) && (m_held[i - 1].offset > event.offset)) {
+                m_held[i] = m_held[i - 1];
+                i--;
+            }
+            m_held[i] = event;
+        }
+    }
+
+    SysMpscRing<AudioParamEvent, Capacity> m_ring;
+    AudioParamEvent m_held[Capacity];  ///< events taken from the ring, sorted by offset
+    unsigned        m_numHeld = 0;
+    uint32_t        m_dropped = 0;
+    uint32_t        m_late    = 0;
+};
+
+/// Linear parameter ramp driven by events.
+///
+/// A parameter event calls rampTo(). Until the ramp ends, apply() multiplies
+/// by the interpolated value. Once settled it multiplies by a constant, so
+/// nodes only pay for smoothing while a parameter is actually moving.
+class AudioParamRamp {
+public:
+    explicit AudioParamRamp(float value = 0.0f) : m_value(value), m_target(value) {}
+
+    /// Jump to a value, ending any ramp
+    void set(float value) {
+        m_value     = value;
+        m_target    = value;
+        m_remaining = 0;
+    }
+
+    /// Ramp linearly from the current value to target over a number of samples
+    void rampTo(float target, unsigned samples) {
+        if (samples == 0) {
+            set(target);
+            return;
+        }
+        m_target    = target;
+        m_step      = (target - m_value) / samples;
+        m_remaining = samples;
+    }
+
+    bool  isRamping() const { return m_remaining != 0; }
+    float value() const { return m_value; }
+    float target() const { return m_target; }
+
+    /// Multiply samples[0..count) by the ramp and advance it by count samples
+    void apply(float* samples, unsigned count) {
+        unsigned ramped = (count < m_remaining) ? count : m_remaining;
+        for (unsigned i = 0; i < ramped; i++) {
+            m_value += m_step;
+            samples[i] *= m_value;
+        }
+        m_remaining -= ramped;
+        if (ramped && !m_remaining) { m_value = m_target; } // no rounding drift at the end
+        for (unsigned i = ramped; i < count; i++) { samples[i] *= m_value; }
+    }
+
+    /// Advance the ramp by count samples without processing audio
+    void advance(unsigned count) {
+        unsigned ramped = (count < m_remaining) ? count : m_remaining;
+        m_value     += m_step * ramped;
+        m_remaining -= ramped;
+        if (!m_remaining) { m_value = m_target; }
+    }
+
+private:
+    float    m_value;
+    float    m_target;
+    float    m_step      = 0.0f;
+    unsigned m_remaining = 0;
+};
+
+}
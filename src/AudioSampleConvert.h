@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+
+namespace SysPlatform {
+
+/// Scale of a left-justified 32-bit codec word, Q31 full scale
+constexpr float AUDIO_Q31_SCALE     = 2147483648.0f;
+constexpr float AUDIO_Q31_SCALE_INV = 1.0f / AUDIO_Q31_SCALE;
+
+/// Convert one Q31 word to float in [-1.0, 1.0)
+inline float audioQ31ToFloat(int32_t word)
+{
+    return static_cast<float>(word) * AUDIO_Q31_SCALE_INV;
+}
+
+/// Convert one float sample to a Q31 word, saturating outside [-1.0, 1.0)
+inline int32_t audioFloatToQ31(float sample)
+{
+    float scaled = sample * AUDIO_Q31_SCALE;
+    // 2^31 is not representable as int32, the next float below it is
+    if (scaled >= AUDIO_Q31_SCALE) { return INT32_MAX; }
+    if (scaled < -AUDIO_Q31_SCALE) { return INT32_MIN; }
+    return static_cast<int32_t>(scaled);
+}
+
+/// Convert Q31 words read every stride words to float samples. With a
+/// stride of one, dst may alias src for an in-place conversion of a block
+/// the DMA filled with words.
+///
+/// The Cortex-M7 FPU has no SIMD, so the kernels are unrolled by four to
+/// keep the VCVT/VMUL pipeline busy and amortize the loop overhead. All
+/// loads of a group are issued before the stores, which keeps them correct
+/// in place. count must be a multiple of four.
+inline void audioQ31ToFloat(float* dst, const int32_t* src, unsigned count, unsigned stride = 1)
+{
+    for (unsigned i = 0; i < count; i += 4) {
+        int32_t w0 = src[0], w1 = src[stride], w2 = src[2 * stride], w3 = src[3 * stride];
+        dst[i]     = audioQ31ToFloat(w0);
+        dst[i + 1] = audioQ31ToFloat(w1);
+        dst[i + 2] = audioQ31ToFloat(w2);
+        dst[i + 3] = audioQ31ToFloat(w3);
+        src += 4 * stride;
+    }
+}
+
+/// Convert float samples to Q31 words written every stride words, e.g. one
+/// channel of an interleaved frame buffer. count must be a multiple of four.
+inline void audioFloatToQ31(int32_t* dst, const float* src, unsigned count, unsigned stride = 1)
+{
+    for (unsigned i = 0; i < count; i += 4) {
+        float s0 = src[i], s1 = src[i + 1], s2 = src[i + 2], s3 = src[i + 3];
+        dst[0]          = audioFloatToQ31(s0);
+        dst[stride]     = audioFloatToQ31(s1);
+        dst[2 * stride] = audioFloatToQ31(s2);
+        dst[3 * stride] = audioFloatToQ31(s3);
+        dst += 4 * stride;
+    }
+}
+
+/// Widen int16 samples to Q31 words written every stride words.
+/// count must be a multiple of four.
+inline void audioInt16ToQ31(int32_t* dst, const int16_t* src, unsigned count, unsigned stride = 1)
+{
+    for (unsigned i = 0; i < count; i += 4) {
+        dst[0]          = static_cast<int32_t>(src[i]) << 16;
+        dst[stride]     = static_cast<int32_t>(src[i + 1]) << 16;
+        dst[2 * stride] = static_cast<int32_t>(src[i + 2]) << 16;
+        dst[3 * stride] = static_cast<int32_t>(src[i + 3]) << 16;
+        dst += 4 * stride;
+    }
+}
+
+/// Interleave int16 left and right samples into frames of two int16 words,
+/// the length-parameterized counterpart of memcpy_tointerleaveLR(), which
+/// always moves half an audio block. A null channel is written as silence.
+/// Two frames are packed per iteration so the stores are whole words. The
+/// words are moved with memcpy, which compiles to single LDR/STR, so the
+/// int16 buffers are not accessed through another type.
+/// frames must be even and all pointers 32-bit aligned.
+inline void audioInterleaveInt16(int16_t* dst, const int16_t* left, const int16_t* right, unsigned frames)
+{
+    for (unsigned i = 0; i < frames; i += 2) {
+        uint32_t l = 0, r = 0;
+        if (left)  { __builtin_memcpy(&l, left + i, sizeof(l)); }
+        if (right) { __builtin_memcpy(&r, right + i, sizeof(r)); }
+        uint32_t frame0 = (l & 0xFFFFU) | (r << 16);     // PKHBT
+        uint32_t frame1 = (l >> 16) | (r & 0xFFFF0000U); // PKHTB
+        __builtin_memcpy(dst + 2 * i, &frame0, sizeof(frame0));
+        __builtin_memcpy(dst + 2 * i + 2, &frame1, sizeof(frame1));
+    }
+}
+
+/// Interleave CHANNELS int16 channels into frames of CHANNELS int16 words,
+/// e.g. the slots of a TDM frame. Each channel pair of two frames is packed
+/// from one word of each channel, the SIMD halfword packing of
+/// memcpy_tointerleaveQuad() for any even channel count. A null channel is
+/// written as silence. frames must be even and all pointers 32-bit aligned.
+template <unsigned CHANNELS>
+inline void audioInterleaveInt16(int16_t* dst, const int16_t* const* src, unsigned frames)
+{
+    static_assert((CHANNELS >= 2) && (CHANNELS % 2 == 0), "CHANNELS must be even");
+    for (unsigned i = 0; i < frames; i += 2) {
+        for (unsigned c = 0; c < CHANNELS; c += 2) {
+            uint32_t a = 0, b = 0;
+            if (src[c])     { __builtin_memcpy(&a, src[c] + i, sizeof(a)); }
+            if (src[c + 1]) { __builtin_memcpy(&b, src[c + 1] + i, sizeof(b)); }
+            uint32_t frame0 = (a & 0xFFFFU) | (b << 16);     // PKHBT
+            uint32_t frame1 = (a >> 16) | (b & 0xFFFF0000U); // PKHTB
+            __builtin_memcpy(dst + c, &frame0, sizeof(frame0));
+            __builtin_memcpy(dst + CHANNELS + c, &frame1, sizeof(frame1));
+        }
+        dst += 2 * CHANNELS;
+    }
+}
+
+/// Split frames of CHANNELS int16 words into CHANNELS int16 channels, the
+/// inverse of audioInterleaveInt16<CHANNELS>(). A null channel is skipped.
+/// frames must be even and all pointers 32-bit aligned.
+template <unsigned CHANNELS>
+inline void audioDeinterleaveInt16(int16_t* const* dst, const int16_t* src, unsigned frames)
+{
+    static_assert((CHANNELS >= 2) && (CHANNELS % 2 == 0), "CHANNELS must be even");
+    for (unsigned i = 0; i < frames; i += 2) {
+        for (unsigned c = 0; c < CHANNELS; c += 2) {
+            uint32_t frame0, frame1;
+            __builtin_memcpy(&frame0, src + c, sizeof(frame0));
+            __builtin_memcpy(&frame1, src + CHANNELS + c, sizeof(frame1));
+            uint32_t a = (frame0 & 0xFFFFU) | (frame1 << 16);     // PKHBT
+            uint32_t b = (frame0 >> 16) | (frame1 & 0xFFFF0000U); // PKHTB
+            if (dst[c])     { __builtin_memcpy(dst[c] + i, &a, sizeof(a)); }
+            if (dst[c + 1]) { __builtin_memcpy(dst[c + 1] + i, &b, sizeof(b)); }
+        }
+        src += 2 * CHANNELS;
+    }
+}
+
+/// Write count zero words every stride words
+inline void audioZeroStrided(int32_t* dst, unsigned count, unsigned stride = 1)
+{
+    for (unsigned i = 0; i < count; i++) { dst[i * stride] = 0; }
+}
+
+}
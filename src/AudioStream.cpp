@@ -36,6 +36,11 @@
 #include "sysPlatform/SysCrashReport.h"
 #include "sysPlatform/SysLogger.h"
 #include "AudioStream.h"
+#include "AudioBlockPool.h"
+#include "AudioGraph.h"
+#include "AudioClock.h"
+#include "SysCriticalSection.h"
+#include "SysAudioInterrupts.h"
 
 using namespace SysPlatform;
 
@@ -45,9 +50,12 @@ using namespace SysPlatform;
   #define MAX_AUDIO_MEMORY 229376
 #endif
 
-#define NUM_MASKS  (((MAX_AUDIO_MEMORY / AUDIO_BLOCK_SAMPLES / 2) + 31) / 32)
+#define MAX_AUDIO_BLOCKS (MAX_AUDIO_MEMORY / AUDIO_BLOCK_SAMPLES / sizeof(float))
+#define MAX_AUDIO_BLOCKS_INT16 (MAX_AUDIO_MEMORY / AUDIO_BLOCK_SAMPLES / sizeof(int16_t))
 
 extern const unsigned AUDIO_SAMPLES_PER_BLOCK = AUDIO_BLOCK_SAMPLES;
+// the compile time rate, audioSetSampleRate() can change the running one,
+// read it with audioSampleRate() or AudioClock::nominalSampleRate()
 extern const float    AUDIO_SAMPLE_RATE_HZ    = AUDIO_SAMPLE_RATE_EXACT;
 extern const float    AUDIO_SAMPLE_PERIOD_SEC = AUDIO_SAMPLE_PERIOD_SEC_F;
 
@@ -55,8 +63,31 @@ std::atomic<bool> audioIsrInProgress(false);
 volatile int8_t audio_traversal_array[MAX_TRAVERSAL_BYTES];
 
 audio_block_float32_t * AudioStream::memory_pool;
-uint32_t AudioStream::memory_pool_available_mask[NUM_MASKS];
-uint16_t AudioStream::memory_pool_first_mask;
+
+// The pool free lists replace the original PJRC availability bitmap. Each block
+// has a link entry indexed by its memory_pool_index. int16 blocks have their own
+// half-size pool, release() finds the owning pool from the block address.
+static AudioBlockPool<audio_block_float32_t> floatPool;
+static uint16_t floatPoolLinks[MAX_AUDIO_BLOCKS];
+static AudioBlockPool<audio_block_t> int16Pool;
+static uint16_t int16PoolLinks[MAX_AUDIO_BLOCKS_INT16];
+static uint32_t int16FallbackCount = 0;
+
+// The shared zero block. The samples are sized for float so the same block
+// also reads as an int16 block of zeros.
+static __attribute__((aligned(32))) float zeroBlockSamples[AUDIO_BLOCK_SAMPLES];
+audio_block_float32_t SysPlatform::audioZeroBlockStorage;
+
+audio_block_float32_t* SysPlatform::audioZeroBlockFloat()
+{
+	if (!audioZeroBlockStorage.data) {
+		audioZeroBlockStorage.ref_count = 1;
+		audioZeroBlockStorage.flags = SILENT_MASK;
+		audioZeroBlockStorage.memory_pool_index = 0xFFFF;
+		audioZeroBlockStorage.data = zeroBlockSamples;
+	}
+	return &audioZeroBlockStorage;
+}
 
 uint16_t AudioStream::cpu_cycles_total = 0;
 uint16_t AudioStream::cpu_cycles_total_max = 0;
@@ -70,34 +101,19 @@ AudioStream* AudioStream::step_update_object = nullptr;
 AudioStream** AudioStream::ordered_update_array = nullptr;
 
 void software_isr(void);
+void software_isr_low(void);
 
 
 // Set up the pool of audio data blocks
 // placing them all onto the free list
 FLASHMEM void AudioStream::initialize_memory(audio_block_float32_t *data, unsigned int num, float *dataBuffers)
 {
-	unsigned int i;
-	unsigned int maxnum = MAX_AUDIO_MEMORY / AUDIO_BLOCK_SAMPLES / sizeof(float);
-
 	//Serial.println("AudioStream initialize_memory");
 	//delay(10);
-	if (num > maxnum) num = maxnum;
-	num_buffers = num;
 	SysCpuControl::disableIrqs();
 	memory_pool = data;
-	memory_pool_first_mask = 0;
-	for (i=0; i < NUM_MASKS; i++) {
-		memory_pool_available_mask[i] = 0;
-	}
-	for (i=0; i < num; i++) {
-		memory_pool_available_mask[i >> 5] |= (1 << (i & 0x1F));
-	}
-	for (i=0; i < num; i++) {
-		data[i].memory_pool_index = i;
-		if (dataBuffers) {
-			data[i].data = dataBuffers + i*AUDIO_BLOCK_SAMPLES;
-		}
-	}
+	num_buffers = floatPool.initialize(data, num, dataBuffers, floatPoolLinks, MAX_AUDIO_BLOCKS);
+	memory_used = int16Pool.stats().used;
 
 	AudioMemoryUsageMaxReset();
 #if 0 // disable timer support. For STRIDE, we will always use i2sIn interrupt timing.
@@ -106,7 +122,7 @@ FLASHMEM void AudioStream::initialize_memory(audio_block_float32_t *data, unsign
 		// start a timer which will call update_all() at the correct rate
 		SysIntervalTimer *timer = new SysIntervalTimer();
 		if (timer) {
-			float usec = 1e6 * AUDIO_BLOCK_SAMPLES / AUDIO_SAMPLE_RATE_EXACT;
+			float usec = 1e6 * AUDIO_BLOCK_SAMPLES / AudioClock::nominalSampleRate();
 			timer->begin(update_all, usec);
 			update_setup();
 		}
@@ -116,60 +132,57 @@ FLASHMEM void AudioStream::initialize_memory(audio_block_float32_t *data, unsign
 	SysCpuControl::enableIrqs();
 }
 
-// Allocate 1 audio data block.  If successful
-// the caller is the only owner of this new block
-audio_block_t * AudioStream::allocate(void)
+static audio_block_float32_t* allocateFloatBlock()
 {
-	audio_block_t* block = (audio_block_t*)allocateFloat();
-	block->flags = 0;
+	audio_block_float32_t *block;
+	uint16_t used;
+
+	// Pop the free list head. This is lock-free so it is safe from any
+	// interrupt priority and does not mask the I2S DMA or USB interrupts.
+	block = floatPool.allocate();
+	if (!block) {
+		SYS_DEBUG_PRINT(sysLogger.printf("AudioStream::allocateFloat(): FAILURE!!! num_buffers=%d  memory_used=%d\n",
+		    AudioStream::num_buffers, AudioStream::memory_used));
+		return NULL;
+	}
+	used = __atomic_add_fetch(&AudioStream::memory_used, 1, __ATOMIC_RELAXED);
+	if (used > AudioStream::memory_used_max) AudioStream::memory_used_max = used;
+	//Serial.print("alloc:");
+	//Serial.println((uint32_t)block, HEX);
+	block->flags = FLOAT_MASK;
 	return block;
 }
 
-audio_block_float32_t * AudioStream::allocateFloat(void)
+static audio_block_t* allocateInt16Block()
 {
-	uint32_t n, index, avail;
-	uint32_t *p, *end;
-	audio_block_float32_t *block;
-	uint32_t used;
-
-	p = memory_pool_available_mask;
-	end = p + NUM_MASKS;
-	SysCpuControl::disableIrqs();
-	index = memory_pool_first_mask;
-	p += index;
-	// calculate the number of free masks
-	while (1) {
-		if (p >= end) {
-			SysCpuControl::enableIrqs();
-			SYS_DEBUG_PRINT(sysLogger.printf("AudioStream::allocateFloat(): FAILURE!!! NUM_MASKS=%d  memory_pool_first_mask=%d  index=%d\n",
-			    NUM_MASKS, memory_pool_first_mask, index));
-			return NULL;
+	audio_block_t* block = int16Pool.allocate();
+	if (!block) {
+		// no int16 pool, or it is exhausted
+		block = (audio_block_t*)allocateFloatBlock();
+		if (block) {
+			if (int16Pool.stats().numBlocks) __atomic_add_fetch(&int16FallbackCount, 1, __ATOMIC_RELAXED);
+			block->flags = 0;
 		}
-		avail = *p;
-		if (avail) break;
-		index++;
-		p++;
+		return block;
 	}
-	n = __builtin_clz(avail);
-	avail &= ~(0x80000000 >> n);
-	*p = avail;
-	if (!avail) index++;
-	memory_pool_first_mask = index;
-	used = memory_used + 1;
-	memory_used = used;
-	SysCpuControl::enableIrqs();
-	index = p - memory_pool_available_mask;
-	//audio_block_float32_t* blockInit = memory_pool + ((index << 5) + (31 - n));
-	//block = (audio_block_t*)blockInit;.
-	block = memory_pool + ((index << 5) + (31 - n));
-	block->ref_count = 1;
-	if (used > memory_used_max) memory_used_max = used;
-	//Serial.print("alloc:");
-	//Serial.println((uint32_t)block, HEX);
-	block->flags = FLOAT_MASK;
+	uint16_t used = __atomic_add_fetch(&AudioStream::memory_used, 1, __ATOMIC_RELAXED);
+	if (used > AudioStream::memory_used_max) AudioStream::memory_used_max = used;
+	block->flags = 0;
 	return block;
 }
 
+// Allocate 1 audio data block.  If successful
+// the caller is the only owner of this new block
+audio_block_t * AudioStream::allocate(void)
+{
+	return allocateInt16Block();
+}
+
+audio_block_float32_t * AudioStream::allocateFloat(void)
+{
+	return allocateFloatBlock();
+}
+
 // Release ownership of a data block.  If no
 // other streams have ownership, the block is
 // returned to the free pool
@@ -186,24 +199,22 @@ void AudioStream::release(audio_block_t** block)
 void AudioStream::release(audio_block_float32_t *block)
 {
 	if (block == nullptr) return;
-	uint32_t mask = (0x80000000 >> (31 - (block->memory_pool_index & 0x1F)));
-	uint32_t index = block->memory_pool_index >> 5;
 
-	SysCpuControl::disableIrqs();
-	if (block->ref_count > 1) {
-		block->ref_count--;
-	} else if (block->ref_count == 1) {
+	unsigned count = audioBlockDropRef(block);
+	if (count == 1) {
 		//Serial.print("reles:");
 		//Serial.println((uint32_t)block, HEX);
-		memory_pool_available_mask[index] |= mask;
-		if (index < memory_pool_first_mask) memory_pool_first_mask = index;
-		if (memory_used == 0) {
+		if (int16Pool.owns(block)) {
+			int16Pool.free((audio_block_t*)block);
+		} else {
+			floatPool.free(block);
+		}
+		if (__atomic_load_n(&memory_used, __ATOMIC_RELAXED) == 0) {
 			SYS_DEBUG_PRINT(sysLogger.printf("AudioStream::release(): WARNING: release() called when memory_used:%d\n", memory_used));
 		} else {
-			memory_used--;
+			__atomic_sub_fetch(&memory_used, 1, __ATOMIC_RELAXED);
 		}
 	}
-	SysCpuControl::enableIrqs();
 }
 
 void AudioStream::release(audio_block_float32_t** block)
@@ -214,20 +225,61 @@ void AudioStream::release(audio_block_float32_t** block)
 
 void AudioStream::releaseAll()
 {
-	memory_pool_first_mask = 0;
-	for (unsigned i=0; i < NUM_MASKS; i++) {
-		memory_pool_available_mask[i] = 0;
-	}
-	for (unsigned i=0; i < num_buffers; i++) {
-		memory_pool_available_mask[i >> 5] |= (1 << (i & 0x1F));
-	}
-	for (unsigned i=0; i < num_buffers; i++) {
-		memory_pool[i].ref_count = 0;
-		memory_pool[i].flags = 0;
-	};
+	floatPool.releaseAll();
+	int16Pool.releaseAll();
 	memory_used = 0;
 }
 
+void AudioPools::initializeInt16(audio_block_t* data, unsigned num, int16_t* dataBuffers)
+{
+	SysCpuControl::disableIrqs();
+	int16Pool.initialize(data, num, dataBuffers, int16PoolLinks, MAX_AUDIO_BLOCKS_INT16);
+	int16FallbackCount = 0;
+	AudioStream::memory_used = floatPool.stats().used;
+	AudioStream::memory_used_max = AudioStream::memory_used;
+	SysCpuControl::enableIrqs();
+}
+
+void AudioPools::initializeInt16(AudioBlockSlot<audio_block_t>* slots, unsigned num)
+{
+	SysCpuControl::disableIrqs();
+	int16Pool.initialize(slots, num, int16PoolLinks, MAX_AUDIO_BLOCKS_INT16);
+	int16FallbackCount = 0;
+	AudioStream::memory_used = floatPool.stats().used;
+	AudioStream::memory_used_max = AudioStream::memory_used;
+	SysCpuControl::enableIrqs();
+}
+
+FLASHMEM void AudioPools::initializeFloat(AudioBlockSlot<audio_block_float32_t>* slots, unsigned num)
+{
+	SysCpuControl::disableIrqs();
+	AudioStream::num_buffers = floatPool.initialize(slots, num, floatPoolLinks, MAX_AUDIO_BLOCKS);
+	AudioStream::memory_used = int16Pool.stats().used;
+	AudioMemoryUsageMaxReset();
+	std::memset((void*)audio_traversal_array, 255, MAX_TRAVERSAL_BYTES);  // initialize to -1
+	SysCpuControl::enableIrqs();
+}
+
+bool AudioPools::isContiguous()
+{
+	bool floatOk = floatPool.isContiguous() || !floatPool.stats().numBlocks;
+	bool int16Ok = int16Pool.isContiguous() || !int16Pool.stats().numBlocks;
+	return floatOk && int16Ok && (floatPool.stats().numBlocks || int16Pool.stats().numBlocks);
+}
+
+audio_block_t* AudioPools::allocateInt16() { return allocateInt16Block(); }
+audio_block_float32_t* AudioPools::allocateFloat() { return allocateFloatBlock(); }
+AudioPoolStats AudioPools::int16Stats() { return int16Pool.stats(); }
+AudioPoolStats AudioPools::floatStats() { return floatPool.stats(); }
+uint32_t AudioPools::int16Fallbacks() { return int16FallbackCount; }
+
+void AudioPools::resetMax()
+{
+	int16Pool.resetMax();
+	floatPool.resetMax();
+	AudioStream::memory_used_max = AudioStream::memory_used;
+}
+
 // Transmit an audio data block
 // to all streams that connect to an output.  The block
 // becomes owned by all the recepients, but also is still
@@ -242,11 +294,19 @@ void AudioStream::transmit(audio_block_t *block, unsigned char index)
 
 void AudioStream::transmit(audio_block_float32_t *block, unsigned char index)
 {
+	// use the compiled fan-out table when called from the node being updated
+	AudioPlanEntry* entry = AudioGraph::current();
+	if (entry && entry->stream == this) {
+		AudioGraph::transmit(entry, block, index);
+		return;
+	}
+
+	// the low tier owns the input queues of its nodes
 	for (AudioConnection *c = destination_list; c != NULL; c = c->next_dest) {
-		if (c->src_index == index) {
+		if (c->src_index == index && !AudioGraph::isLowTier(c->dst)) {
 			if (c->dst->inputQueue[c->dest_index] == NULL) {
 				c->dst->inputQueue[c->dest_index] = block;
-				block->ref_count++;
+				audioBlockAddRef(block);
 			}
 		}
 	}
@@ -278,11 +338,16 @@ audio_block_t * AudioStream::receiveWritable(unsigned int index)
 	if (index >= num_inputs) return NULL;
 	in = inputQueue[index];
 	inputQueue[index] = NULL;
-	if (in && in->ref_count > 1) {
-		p = (audio_block_float32_t*)allocate();
-		if (p) memcpy(p->data, in->data, sizeof(int16_t) * AUDIO_BLOCK_SAMPLES);
-		in->ref_count--;
+	if (in && (in->ref_count > 1 || isAudioZeroBlock(in))) {
+		p = (audio_block_float32_t*)allocate();  // int16 pool, falls back to the float pool
+		if (p) {
+			if (in->flags & SILENT_MASK) memset(p->data, 0, sizeof(int16_t) * AUDIO_BLOCK_SAMPLES);
+			else memcpy(p->data, in->data, sizeof(int16_t) * AUDIO_BLOCK_SAMPLES);
+		}
+		release(in);
 		in = p;
+	} else if (in) {
+		in->flags &= ~SILENT_MASK;
 	}
 	return (audio_block_t*)in;
 }
@@ -294,11 +359,16 @@ audio_block_float32_t * AudioStream::receiveWritableFloat(unsigned int index)
 	if (index >= num_inputs) return NULL;
 	in = inputQueue[index];
 	inputQueue[index] = NULL;
-	if (in && in->ref_count > 1) {
+	if (in && (in->ref_count > 1 || isAudioZeroBlock(in))) {
 		p = (audio_block_float32_t*)allocateFloat();
-		if (p) memcpy(p->data, in->data, sizeof(float) * AUDIO_BLOCK_SAMPLES);
-		in->ref_count--;
+		if (p) {
+			if (in->flags & SILENT_MASK) memset(p->data, 0, sizeof(float) * AUDIO_BLOCK_SAMPLES);
+			else memcpy(p->data, in->data, sizeof(float) * AUDIO_BLOCK_SAMPLES);
+		}
+		release(in);
 		in = p;
+	} else if (in) {
+		in->flags &= ~SILENT_MASK;
 	}
 	return in;
 }
@@ -308,10 +378,33 @@ audio_block_float32_t * AudioStream::receiveWritableFloat(unsigned int index)
 AudioConnection::AudioConnection(AudioStream &source, unsigned char sourceOutput,
 		AudioStream &destination, unsigned char destinationInput)
 {
+	// AudioGraph is not a friend of AudioStream. These lambdas share the
+	// access of this constructor and are its only way to the stream internals.
+	static const AudioStreamAccess access = {
+		[]() { return AudioStream::first_update; },
+		[](const AudioStream *s) { return s->next_update; },
+		[](const AudioStream *s) { return s->destination_list; },
+		[](const AudioStream *s) { return s->inputQueue; },
+		[](const AudioStream *s) { return (unsigned)s->num_inputs; },
+		[](const AudioStream *s) { return (unsigned)s->numConnections; },
+		[](AudioStream *s, bool active) { s->active = active; },
+		[](AudioStream *s) { s->update(); },
+		[](audio_block_float32_t *block) { AudioStream::release(block); },
+		[]() { return AudioStream::update_scheduled; },
+		[]() { return AudioStream::use_ordered_update; },
+		[]() { return AudioStream::step_update_object; },
+		[]() { return AudioStream::ordered_update_array; },
+		[](AudioConnection *c) { return &c->next_dest; },
+		[](const AudioConnection *c) { return c->dst; },
+		[](const AudioConnection *c) { return (unsigned)c->src_index; },
+		[](const AudioConnection *c) { return (unsigned)c->dest_index; },
+	};
+	AudioGraph::bindStreamAccess(&access);
+
 	// we are effectively unused right now, so
-	// link ourselves at the start of the unused list
-	next_dest = AudioStream::unused;
-	AudioStream::unused = this;
+	// link ourselves at the start of the unused list.
+	// Out of memory connect() retries once it has reserved room.
+	AudioGraph::linkConnection(&AudioStream::unused, this);
 
 	isConnected = false;
 	connect(source,sourceOutput,destination,destinationInput);
@@ -319,35 +412,24 @@ AudioConnection::AudioConnection(AudioStream &source, unsigned char sourceOutput
 
 // Simplified constructor assuming channel 0 at both ends
 AudioConnection::AudioConnection(AudioStream &source, AudioStream &destination)
+	: AudioConnection(source, 0, destination, 0)
 {
-	next_dest = AudioStream::unused;
-	AudioStream::unused = this;
-
-	isConnected = false;
-	connect(source, 0, destination,0);
 }
 
 // Destructor
 AudioConnection::~AudioConnection()
 {
-	AudioConnection** pp;
-
 	disconnect(); // disconnect ourselves: puts us on the unused list
 	// Remove ourselves from the unused list
-	pp = &AudioStream::unused;
-	while (*pp && *pp != this)
-		pp = &((*pp)->next_dest);
-	if (*pp) // found ourselves
-		*pp = next_dest; // remove ourselves from the unused list
+	SysAudioLock audioLock;
+	AudioGraph::unlinkConnection(this);
+	AudioGraph::forgetConnection(this);
 }
 
 /**************************************************************************************/
 int AudioConnection::connect(void)
 {
 	int result = 1;
-	AudioConnection *p;
-	AudioConnection **pp;
-	AudioStream* s;
 
 	do
 	{
@@ -368,63 +450,37 @@ int AudioConnection::connect(void)
 			break;
 		}
 
-		SysCpuControl::disableIrqs();
-
-		// First check the destination's input isn't already in use
-		s = AudioStream::first_update; // first AudioStream in the stream list
-		while (s) // go through all AudioStream objects
+		// grow the side tables now so nothing allocates with IRQs off
+		if (!AudioGraph::reserveConnections(1))
 		{
-			p = s->destination_list;	// first patchCord in this stream's list
-			while (p)
-			{
-				if (p->dst == dst && p->dest_index == dest_index) // same destination - it's in use!
-				{
-					SysCpuControl::enableIrqs();
-					return 4;
-				}
-				p = p->next_dest;
-			}
-			s = s->next_update;
+			result = 7;
+			break;
 		}
 
-		// Check we're on the unused list
-		pp = &AudioStream::unused;
-		while (*pp && *pp != this)
-		{
-			pp = &((*pp)->next_dest);
-		}
-		if (!*pp) // never found ourselves - fail
+		// The lists are only walked by the audio update, so masking the
+		// audio interrupt is enough, USB and DMA interrupts keep running.
+		SysAudioLock audioLock;
+
+		// First check the destination's input isn't already in use. This also
+		// rejects a duplicate of an existing connection (formerly result 6).
+		if (AudioGraph::inputOwner(dst, dest_index))
 		{
-			result = 5;
+			result = 4;
 			break;
 		}
 
-		// Now try to add this connection to the source's destination list
-		p = src->destination_list; // first AudioConnection
-		if (p == NULL)
-		{
-			src->destination_list = this;
-		}
-		else
+		// Check we're on the unused list. The constructor leaves us off it
+		// when it ran out of memory, the reserve above has made room since.
+		if (!AudioGraph::isLinked(this) && !AudioGraph::linkConnection(&AudioStream::unused, this))
 		{
-			while (p->next_dest)  // scan source Stream's connection list for duplicates
-			{
-
-				if (&p->src == &this->src && &p->dst == &this->dst
-					&& p->src_index == this->src_index && p->dest_index == this->dest_index)
-				{
-					//Source and destination already connected through another connection, abort
-					SysCpuControl::enableIrqs();
-					return 6;
-				}
-				p = p->next_dest;
-			}
-
-			p->next_dest = this; // end of list, can link ourselves in
+			result = 5;
+			break;
 		}
 
-		*pp = next_dest;  // remove ourselves from the unused list
-		next_dest = NULL; // we're last in the source's destination list
+		// Move from the unused list to the head of the source's destination list
+		AudioGraph::unlinkConnection(this);
+		AudioGraph::linkConnection(&src->destination_list, this);
+		AudioGraph::setInputOwner(dst, dest_index, this);
 
 		src->numConnections++;
 		src->active = true;
@@ -433,12 +489,12 @@ int AudioConnection::connect(void)
 		dst->active = true;
 
 		isConnected = true;
+		AudioGraph::invalidate();
 
 		result = 0;
 	} while (0);
 
-	SysCpuControl::enableIrqs();
-
+	if (result == 0) { AudioGraph::topologyChanged(); }
 	return result;
 }
 
@@ -462,62 +518,43 @@ int AudioConnection::connect(AudioStream &source, unsigned char sourceOutput,
 
 int AudioConnection::disconnect(void)
 {
-	AudioConnection *p;
-
 	if (!isConnected) return 1;
 	if (dest_index >= dst->num_inputs) return 2; // should never happen!
-	SysCpuControl::disableIrqs();
+	{
+		SysAudioLock audioLock;
 
-	// Remove destination from source list
-	p = src->destination_list;
-	if (p == NULL) {
-//>>> PAH re-enable the IRQ
-		SysCpuControl::enableIrqs();
-		return 3;
-	} else if (p == this) {
-		if (p->next_dest) {
-			src->destination_list = next_dest;
-		} else {
-			src->destination_list = NULL;
+		// Remove destination from source list
+		if (!AudioGraph::isLinked(this)) {
+			return 3;
 		}
-	} else {
-		while (p)
-		{
-			if (p->next_dest == this) // found the parent of the disconnecting object
-			{
-				p-> next_dest = this->next_dest; // skip parent's link past us
-				break;
-			}
-			else
-				p = p->next_dest; // carry on down the list
-		}
-	}
+		AudioGraph::unlinkConnection(this);
+		AudioGraph::setInputOwner(dst, dest_index, nullptr);
 //>>> PAH release the audio buffer properly
-	//Remove possible pending src block from destination
-	if(dst->inputQueue[dest_index] != NULL) {
-		AudioStream::release((audio_block_t*)dst->inputQueue[dest_index]);
-		// release() re-enables the IRQ. Need it to be disabled a little longer
-		SysCpuControl::disableIrqs();
-		dst->inputQueue[dest_index] = NULL;
-	}
-
-	//Check if the disconnected AudioStream objects should still be active
-	src->numConnections--;
-	if (src->numConnections == 0) {
-		src->active = false;
-	}
+		//Remove possible pending src block from destination
+		if(dst->inputQueue[dest_index] != NULL) {
+			AudioStream::release((audio_block_t*)dst->inputQueue[dest_index]);
+			dst->inputQueue[dest_index] = NULL;
+		}
 
-	dst->numConnections--;
-	if (dst->numConnections == 0) {
-		dst->active = false;
-	}
+		//Check if the disconnected AudioStream objects should still be active.
+		//Inside a transaction the running plan still needs them, the commit
+		//deactivates them after the swap.
+		src->numConnections--;
+		if (src->numConnections == 0 && !AudioGraph::inTransaction()) {
+			src->active = false;
+		}
 
-	isConnected = false;
-	next_dest = dst->unused;
-	dst->unused = this;
+		dst->numConnections--;
+		if (dst->numConnections == 0 && !AudioGraph::inTransaction()) {
+			dst->active = false;
+		}
 
-	SysCpuControl::enableIrqs();
+		isConnected = false;
+		AudioGraph::linkConnection(&AudioStream::unused, this);
+		AudioGraph::invalidate();
+	}
 
+	AudioGraph::topologyChanged();
 	return 0;
 }
 
@@ -533,8 +570,10 @@ bool AudioStream::update_setup(void)
 {
 	if (update_scheduled) return false;
 	SysCpuControl::AudioAttachInterruptVector(software_isr);
-	SysCpuControl::AudioSetInterruptPriority(208); // 255 = lowest priority
+	SysCpuControl::AudioSetInterruptPriority(AUDIO_SOFTWARE_ISR_PRIORITY); // 255 = lowest priority
 	SysCpuControl::AudioInterrupts();
+	audioLowTierAttach(software_isr_low, AUDIO_LOW_TIER_ISR_PRIORITY);
+	audioLowTierEnable();
 	update_scheduled = true;
 	return true;
 }
@@ -542,10 +581,12 @@ bool AudioStream::update_setup(void)
 void AudioStream::update_stop(void)
 {
 	SysCpuControl::AudioNoInterrupts();
+	audioLowTierDisable();
 	update_scheduled = false;
 }
 
 void AudioStream::update_all(void) {
+	AudioGraph::recordTrigger(SysTimer::cycleCnt32());
 	SysCpuControl::AudioTriggerInterrupt();
 }
 
@@ -559,35 +600,30 @@ void AudioStream::setOrderedUpdate(bool orderedUpdate) {
 	AudioStream *p = AudioStream::first_update;
 	for (p = AudioStream::first_update; p; p = p->next_update) { num_objects++; }  // get the number of objects
 
-	ordered_update_array = (AudioStream**)malloc(num_objects * sizeof(AudioStream*));
+	// one extra slot for the terminator
+	ordered_update_array = (AudioStream**)calloc(num_objects + 1, sizeof(AudioStream*));
 	if (!ordered_update_array) {
 		//if (Serial) { Serial.printf("AudioStream::setOrderedUpdate(): unable to allocate array\n"); Serial.flush(); }
 		return;
 	}
 
-	// populate the ordered list
+	// populate the ordered list in a single pass, indexing directly by ID
 	step_update_object = nullptr;
-	unsigned objects_remaining = num_objects;
-	unsigned loopLimit = 100;
-	while ((objects_remaining > 0) && (loopLimit-- > 0)) {
-		for (p = AudioStream::first_update; p; p = p->next_update) {
-			//if (Serial) { Serial.printf("setOrderedUpdate(): scanning object %d, looking for %d, objects remaining: %d\n", p->id, idx, objects_remaining); Serial.flush(); }
-			if ((p->id == UPDATE_STEP_OBJECT_ID) && (!step_update_object)) {
-				step_update_object = p;
-				objects_remaining--;
-			} else if (p->id == idx) {
-				ordered_update_array[idx] = p;
-				idx++;
-				objects_remaining--;
-			}
+	for (p = AudioStream::first_update; p; p = p->next_update) {
+		if ((p->id == UPDATE_STEP_OBJECT_ID) && (!step_update_object)) {
+			step_update_object = p;
+		} else if ((p->id >= 0) && (p->id < num_objects) && !ordered_update_array[p->id]) {
+			ordered_update_array[p->id] = p;
 		}
 	}
-	if ((!step_update_object) || (loopLimit == 0)) {
+	while ((idx < num_objects) && ordered_update_array[idx]) { idx++; }  // IDs must be contiguous from 0
+	if ((!step_update_object) || (idx + 1 != num_objects)) {
 		//if (Serial && !step_update_object) { Serial.printf("ERROR: step_update_object is not valid\n"); }
-		//if (Serial && (loopLimit == 0)) { Serial.printf("ERROR: step_update_object is not valid\n"); }
+		//if (Serial && (idx + 1 != num_objects)) { Serial.printf("ERROR: object IDs are not contiguous\n"); }
 		orderedUpdate = false;
 	}
 	ordered_update_array[idx] = nullptr; // terminate the list
+	AudioGraph::compile(); // map the ordered IDs onto the compiled plan
 
 	// if (Serial) {
 	// 	Serial.printf("\n*** AUDIOSTREAM ARRAY\n");
@@ -607,6 +643,9 @@ void software_isr(void) // AudioStream::update_all()
 	AudioStream *p;
 
 	uint32_t totalcycles = SysTimer::cycleCnt32();
+	SysTimer::cycleCnt64();  // keeps the 64-bit cycle counter extension current
+	AudioClock::beginBlock(totalcycles);
+	AudioGraph::beginUpdate(totalcycles);
 	//digitalWriteFast(2, HIGH);
 
     if (AudioStream::use_ordered_update) {
@@ -619,7 +658,8 @@ void software_isr(void) // AudioStream::update_all()
 		// If both numbers are negative, we are done.
 		//if (!AudioStream::step_update_object) { AudioStream::use_ordered_update = false; return; }
 		unsigned idx = 0;
-		unsigned loopLimit = 50;
+		unsigned loopLimit = MAX_TRAVERSAL_BYTES / 2;
+		const AudioPlan* plan = AudioGraph::plan();
 
         //if (Serial) { Serial.printf("-\n"); }
 		audioIsrInProgress = true;
@@ -633,12 +673,11 @@ void software_isr(void) // AudioStream::update_all()
 			if ( ((stepIndex) >= 0) && AudioStream::step_update_object) {  // run the update step object first
 			    p = AudioStream::step_update_object;
 				//Serial.printf("Step:%d id:%d addr:%08X\n", stepIndex, objectId, p);
+				AudioGraph::setCurrent(plan ? plan->stepEntry : nullptr);
 				if (p->active) {
 					uint32_t cycles = SysTimer::cycleCnt32();
 					p->updateIndex(stepIndex);
-					cycles = (SysTimer::cycleCnt32() - cycles) >> 6;
-					p->cpu_cycles = cycles;
-					if (cycles > p->cpu_cycles_max) p->cpu_cycles_max = cycles;
+					AudioGraph::recordCycles(p, SysTimer::cycleCnt32() - cycles);
 				}
 			} else {  // run the update on the AudioStream ID object
 				if (objectId >= 0) {
@@ -648,13 +687,18 @@ void software_isr(void) // AudioStream::update_all()
 						//if (Serial) { Serial.printf("software_isr(): null AudioStream object encountered\n"); }
 						continue;
 					}
-					if (p->active) {
+					AudioPlanEntry* entry = (plan && ((unsigned)objectId < plan->numOrdered)) ? plan->orderedEntries[objectId] : nullptr;
+					AudioGraph::setCurrent(entry);
+					if (AudioGraph::shouldBypass(entry)) {
+						AudioGraph::bypassNode(entry);
+					} else if (entry && AudioGraph::sleepIfSilent(entry)) {
+						continue;
+					} else if (p->active) {
 						sysCrashReport.setBreadcrumb(SysCrashReport::AUDIO_EFFECT_UPDATE_ID, SysCrashReport::START_MASK, (uint32_t)(p->getId()));
 						uint32_t cycles = SysTimer::cycleCnt32();
 						p->update();
-						cycles = (SysTimer::cycleCnt32() - cycles) >> 6;
-						p->cpu_cycles = cycles;
-						if (cycles > p->cpu_cycles_max) p->cpu_cycles_max = cycles;
+						AudioGraph::recordCycles(p, SysTimer::cycleCnt32() - cycles);
+						AudioGraph::releaseUnconsumed(p);
 						sysCrashReport.setBreadcrumb(SysCrashReport::AUDIO_EFFECT_UPDATE_ID, SysCrashReport::DONE_MASK, (uint32_t)(p->getId()));
 					}
 				}
@@ -664,28 +708,29 @@ void software_isr(void) // AudioStream::update_all()
 		//Serial.printf("Loop limit %d\n", loopLimit);
 
 		// reset and release step_update input buffers
+		AudioGraph::setCurrent(plan ? plan->stepEntry : nullptr);
 		if (AudioStream::step_update_object) { AudioStream::step_update_object->updateIndex(-1); }
+		AudioGraph::setCurrent(nullptr);
 		audioIsrInProgress = false;
 
-	} else {  // original processing by PJRC
+	} else if (!AudioGraph::process()) {
+		// no compiled plan yet, or the topology is being edited.
+		// Fall back to the original processing by PJRC. Low tier nodes
+		// wait for the next plan, a preempted low tier run may be using them.
 		for (p = AudioStream::first_update; p; p = p->next_update) {
 			//Serial.printf("addr:%08X\n", p);
-			if (p->active) {
+			if (p->active && !AudioGraph::isLowTier(p)) {
 				uint32_t cycles = SysTimer::cycleCnt32();
 				p->update();
-				// TODO: traverse inputQueueArray and release
-				// any input blocks that weren't consumed?
-				cycles = (SysTimer::cycleCnt32() - cycles) >> 6;
-				p->cpu_cycles = cycles;
-				if (cycles > p->cpu_cycles_max) p->cpu_cycles_max = cycles;
+				AudioGraph::recordCycles(p, SysTimer::cycleCnt32() - cycles);
+				AudioGraph::releaseUnconsumed(p);
 			}
 		}
 	}
 
-	totalcycles = (SysTimer::cycleCnt32() - totalcycles) >> 6;
-	AudioStream::cpu_cycles_total = totalcycles;
-	if (totalcycles > AudioStream::cpu_cycles_total_max)
-		AudioStream::cpu_cycles_total_max = totalcycles;
+	uint32_t endcycles = SysTimer::cycleCnt32();
+	AudioGraph::recordTotalCycles(endcycles - totalcycles);
+	AudioGraph::endUpdate(endcycles);
 
 	SysCpuControl::SysDataSyncBarrier();
 
@@ -696,3 +741,11 @@ void software_isr(void) // AudioStream::update_all()
 	asm("DSB");
 }
 
+// Low priority audio tier, triggered by the block update every
+// AudioGraph::setLowTierDivisor() blocks
+void software_isr_low(void)
+{
+	AudioGraph::processLowTier();
+	asm("DSB");
+}
+
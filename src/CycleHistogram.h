@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+
+namespace SysPlatform {
+
+/// Log-scaled histogram of CPU cycle counts.
+///
+/// Each power of two is split into SUB_BUCKETS linear buckets, so any 32-bit
+/// cycle count is binned with a relative error below 1/SUB_BUCKETS using 124
+/// 16-bit counters. record() is a CLZ, a shift and an increment, cheap enough
+/// to run after every node update in the audio ISR. When a counter would
+/// overflow, all counters are halved, so the histogram slowly forgets old
+/// history instead of saturating. The maximum and an EWMA are tracked exactly.
+///
+/// record() is meant for a single writer, the audio ISR. The queries may run
+/// in thread context while it is being updated. They then see a histogram that
+/// is off by at most the update in flight.
+class CycleHistogram {
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 2;
+    static constexpr unsigned SUB_BUCKETS     = 1U << SUB_BUCKET_BITS;
+    static constexpr unsigned NUM_BUCKETS     = (32U - SUB_BUCKET_BITS + 1U) * SUB_BUCKETS;
+    static constexpr unsigned EWMA_SHIFT      = 4; ///< EWMA weight of a new sample is 1/16
+
+    constexpr CycleHistogram() = default;
+
+    /// Add one measurement
+    void record(uint32_t cycles) {
+        unsigned bucket = bucketIndex(cycles);
+        if (m_buckets[bucket] == UINT16_MAX) {
+            for (unsigned i = 0; i < NUM_BUCKETS; i++) { m_buckets[i] >>= 1; }
+        }
+        m_buckets[bucket]++;
+        m_last = cycles;
+        if (cycles > m_max) { m_max = cycles; }
+        if (m_count == 0) { m_ewma = cycles; }
+        else {
+            // the difference of two counts can exceed the int32 range
+            int64_t diff = static_cast<int64_t>(cycles) - static_cast<int64_t>(m_ewma);
+            m_ewma = static_cast<uint32_t>(static_cast<int64_t>(m_ewma) + (diff >> EWMA_SHIFT));
+        }
+        m_count++;
+    }
+
+    /// Clear all counters
+    void reset() {
+        for (unsigned i = 0; i < NUM_BUCKETS; i++) { m_buckets[i] = 0; }
+        m_count = 0;
+        m_last  = 0;
+        m_max   = 0;
+        m_ewma  = 0;
+    }
+
+    /// @param fraction quantile between 0 and 1, e.g. 0.99f for p99
+    /// @returns the upper bound of the bucket holding the quantile, in cycles,
+    /// or zero if nothing has been recorded
+    uint32_t percentile(float fraction) const {
+        uint32_t total = 0;
+        for (unsigned i = 0; i < NUM_BUCKETS; i++) { total += m_buckets[i]; }
+        if (total == 0) { return 0; }
+
+        uint32_t rank = static_cast<uint32_t>(fraction * total);
+        if (rank >= total) { rank = total - 1; }
+        uint32_t seen = 0;
+        for (unsigned i = 0; i < NUM_BUCKETS; i++) {
+            seen += m_buckets[i];
+            if (seen > rank) { return (bucketUpper(i) < m_max) ? bucketUpper(i) : m_max; }
+        }
+        return m_max;
+    }
+
+    uint32_t p50() const  { return percentile(0.5f); }
+    uint32_t p99() const  { return percentile(0.99f); }
+    uint32_t p999() const { return percentile(0.999f); }
+
+    uint32_t ewma() const  { return m_ewma; }  ///< exponentially weighted average in cycles
+    uint32_t max() const   { return m_max; }   ///< largest measurement since reset()
+    uint32_t last() const  { return m_last; }  ///< most recent measurement
+    uint32_t count() const { return m_count; } ///< measurements since reset(), not affected by halving
+
+    /// @returns the bucket a cycle count is binned into
+    static unsigned bucketIndex(uint32_t cycles) {
+        if (cycles < SUB_BUCKETS) { return cycles; }
+        unsigned msb = 31U - __builtin_clz(cycles);
+        unsigned sub = (cycles >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1U);
+        return (msb - SUB_BUCKET_BITS + 1U) * SUB_BUCKETS + sub;
+    }
+
+    /// @returns the largest cycle count binned into a bucket
+    static uint32_t bucketUpper(unsigned bucket) {
+        if (bucket < SUB_BUCKETS) { return bucket; }
+        unsigned msb   = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1U;
+        unsigned sub   = bucket % SUB_BUCKETS;
+        uint32_t lower = (SUB_BUCKETS + sub) << (msb - SUB_BUCKET_BITS);
+        return lower + ((1U << (msb - SUB_BUCKET_BITS)) - 1U);
+    }
+
+    /// @returns the raw counter of a bucket
+    uint16_t bucketCount(unsigned bucket) const { return m_buckets[bucket]; }
+
+private:
+    uint16_t m_buckets[NUM_BUCKETS] = {};
+    uint32_t m_count = 0;
+    uint32_t m_last  = 0;
+    uint32_t m_max   = 0;
+    uint32_t m_ewma  = 0;
+};
+
+}
@@ -2,11 +2,18 @@
 #include "Arduino.h"
 #include <Wire.h>
 #include "DMAChannel.h"
-#include "memcpy_audio.h"
 #include "sysPlatform/SysCpuControl.h"
 #include "sysPlatform/AudioStream.h"
 #include "sysPlatform/SysDebugPrint.h"
 #include "sysPlatform/SysAudio.h"
+#include "AudioBlockPool.h"
+#include "AudioSampleConvert.h"
+#include "AudioGraph.h"
+#include "AudioClock.h"
+#include "SysAudioSampleRate.h"
+#include "SysAudioTdm.h"
+#include "SysCriticalSection.h"
+#include "utility/imxrt_hw.h"
 
 #ifdef round
 #undef round
@@ -17,23 +24,186 @@
 constexpr float REMOVE_DC_SLEW_ALPHA = 0.85f;
 constexpr float REMOVE_DC_SLEW_MINUS_ALPHA = 1.0f - REMOVE_DC_SLEW_ALPHA;
 
+// When both I2S input and output run, service both from the transmit ISR
+#ifndef SYS_AUDIO_I2S_DUPLEX
+#define SYS_AUDIO_I2S_DUPLEX 1
+#endif
+
+// Codec word length. 16 moves int16 blocks. 24 and 32 transfer the whole
+// 32-bit I2S slot and convert straight to and from float blocks.
+#ifndef SYS_AUDIO_I2S_BITS
+#define SYS_AUDIO_I2S_BITS 16
+#endif
+#if (SYS_AUDIO_I2S_BITS != 16) && (SYS_AUDIO_I2S_BITS != 24) && (SYS_AUDIO_I2S_BITS != 32)
+#error "SYS_AUDIO_I2S_BITS must be 16, 24 or 32"
+#endif
+
+// Samples per transmit DMA period and periods in the transmit ring. The
+// output buffering is SYS_AUDIO_I2S_PERIODS - 1 to SYS_AUDIO_I2S_PERIODS
+// periods, independent of AUDIO_BLOCK_SAMPLES, e.g. 4 periods of 16 samples.
+// The price is compute time. The transmit ISR starts the update on the last
+// period of a block and needs the next block one period later, so the graph
+// has one DMA period, not one block period, to compute a block. In duplex
+// mode it has the periods from the collecting period to the block boundary.
+// The deadline monitor measures against that budget. Shorter periods lower
+// the latency but leave less of each block period for processing.
+#ifndef SYS_AUDIO_I2S_PERIOD
+#define SYS_AUDIO_I2S_PERIOD (AUDIO_BLOCK_SAMPLES / 2)
+#endif
+#ifndef SYS_AUDIO_I2S_PERIODS
+#define SYS_AUDIO_I2S_PERIODS 2
+#endif
+
 namespace SysPlatform {
 
+#if SYS_AUDIO_I2S_BITS > 16
+using I2sSample = int32_t;  // left-justified codec word
+using I2sBlock  = audio_block_float32_t;
+using I2sDcSum  = int64_t;
+#else
+using I2sSample = int16_t;
+using I2sBlock  = audio_block_t;
+using I2sDcSum  = int;
+#endif
+using I2sBlockSample = std::remove_pointer<decltype(I2sBlock::data)>::type;
+
+// log2 of the DMA transfer size of one codec word
+constexpr unsigned I2S_DMA_SIZE = (sizeof(I2sSample) == 4) ? 2 : 1;
+// 16-bit words are read from the upper half of the 32-bit SAI data register
+constexpr uint32_t I2S_DATA_REG_OFFSET = 4 - sizeof(I2sSample);
+
+constexpr unsigned I2S_PERIOD = SYS_AUDIO_I2S_PERIOD;
+constexpr unsigned I2S_PERIODS = SYS_AUDIO_I2S_PERIODS;
+constexpr unsigned I2S_PERIODS_PER_BLOCK = AUDIO_BLOCK_SAMPLES / I2S_PERIOD;
+static_assert((I2S_PERIOD >= 8) && (I2S_PERIOD % 8 == 0) && (AUDIO_BLOCK_SAMPLES % I2S_PERIOD == 0),
+	"SYS_AUDIO_I2S_PERIOD must be a multiple of 8 that divides AUDIO_BLOCK_SAMPLES");
+static_assert(I2S_PERIODS >= 2, "SYS_AUDIO_I2S_PERIODS must be at least 2");
+
+// In duplex mode the transmit ISR collects the receive block at a fixed
+// period after the block boundary. The transmit DMA runs ahead of the frame
+// by up to the FIFO depth, the receive DMA completes a little after it. The
+// collecting period is the first one that ends safely after the receive
+// block completed, and it must end safely before the next one completes.
+constexpr unsigned I2S_TX_LEAD_FRAMES = 16;
+constexpr unsigned I2S_RX_LAG_FRAMES = 2;
+constexpr unsigned I2S_POLL_MARGIN_FRAMES = 8;
+constexpr unsigned I2S_DUPLEX_POLL_PERIOD =
+	(I2S_TX_LEAD_FRAMES + I2S_RX_LAG_FRAMES + I2S_POLL_MARGIN_FRAMES + I2S_PERIOD - 1) / I2S_PERIOD - 1;
+constexpr bool I2S_DUPLEX_FITS = (I2S_DUPLEX_POLL_PERIOD < I2S_PERIODS_PER_BLOCK) &&
+	((I2S_DUPLEX_POLL_PERIOD + 1) * I2S_PERIOD + I2S_POLL_MARGIN_FRAMES <= AUDIO_BLOCK_SAMPLES + I2S_TX_LEAD_FRAMES + I2S_RX_LAG_FRAMES);
+
+// The codec words of a received block, before they are converted
+static inline I2sSample *i2sWords(I2sBlock *block) { return (I2sSample *)block->data; }
+
+// Subtract the DC offset from a codec word, 32-bit words saturate instead of wrapping
+static inline I2sSample i2sRemoveDc(I2sSample word, int offset)
+{
+#if SYS_AUDIO_I2S_BITS > 16
+	int64_t value = (int64_t)word - offset;
+	if (value > INT32_MAX) { return INT32_MAX; }
+	if (value < INT32_MIN) { return INT32_MIN; }
+	return (I2sSample)value;
+#else
+	return word - offset;
+#endif
+}
+
+static_assert(SYS_AUDIO_TEENSY_MCLK || (SYS_AUDIO_CODEC_MCLK_HZ == 11289600) || (SYS_AUDIO_CODEC_MCLK_HZ == 12288000),
+	"SYS_AUDIO_CODEC_MCLK_HZ must be 11289600 or 12288000");
+
+// A selectable sample rate. The codec runs in normal mode from an MCLK of
+// 256 times the base rate of the family, its sampling register picks the rate.
+struct I2sRateConfig {
+	uint32_t hz;
+	uint32_t mclkHz;
+	uint8_t  codecSampling; // WM8731 sampling control register
+};
+
+static const I2sRateConfig i2s_rates[] = {
+	{32000, 12288000, 0x18},
+	{44100, 11289600, 0x20}, // 256*Fs, 44.1 kHz, MCLK/1
+	{48000, 12288000, 0x00},
+	{88200, 11289600, 0x3C},
+	{96000, 12288000, 0x1C},
+};
+
+static const I2sRateConfig *i2s_rate = nullptr;
+
+// @returns the rate if the clock configuration can generate it, else nullptr
+static const I2sRateConfig *i2sFindRate(uint32_t hz)
+{
+	for (const I2sRateConfig &rate : i2s_rates) {
+		if (rate.hz != hz) { continue; }
+		if (SYS_AUDIO_TEENSY_MCLK || (rate.mclkHz == SYS_AUDIO_CODEC_MCLK_HZ)) { return &rate; }
+	}
+	return nullptr;
+}
+
+// The configured rate, initially the supported one closest to AUDIO_SAMPLE_RATE_EXACT
+static const I2sRateConfig *i2sRate(void)
+{
+	if (i2s_rate) { return i2s_rate; }
+	float best = 0.0f;
+	for (const I2sRateConfig &rate : i2s_rates) {
+		if (!i2sFindRate(rate.hz)) { continue; }
+		float error = std::fabs((float)rate.hz - AUDIO_SAMPLE_RATE_EXACT);
+		if (!i2s_rate || (error < best)) {
+			i2s_rate = &rate;
+			best = error;
+		}
+	}
+	return i2s_rate;
+}
+
+#if SYS_AUDIO_TEENSY_MCLK
+// Generate MCLK on pin 23 from PLL4 through the SAI1 clock dividers.
+// PLL4 must run between 648 and 1296 MHz.
+static void i2sSetMclk(uint32_t mclkHz)
+{
+	constexpr int n1 = 4; // SAI1 prescaler
+	int n2 = 1 + (24000000 * 27) / (mclkHz * n1);
+	double C = ((double)mclkHz * n1 * n2) / 24000000;
+	int c0 = C;
+	int c2 = 10000;
+	int c1 = C * c2 - (c0 * c2);
+	set_audioClock(c0, c1, c2, true);
+
+	CCM_CSCMR1 = (CCM_CSCMR1 & ~(CCM_CSCMR1_SAI1_CLK_SEL_MASK))
+		| CCM_CSCMR1_SAI1_CLK_SEL(2); // 0,1,2: PLL3PFD0, PLL5, PLL4
+	CCM_CS1CDR = (CCM_CS1CDR & ~(CCM_CS1CDR_SAI1_CLK_PRED_MASK | CCM_CS1CDR_SAI1_CLK_PODF_MASK))
+		| CCM_CS1CDR_SAI1_CLK_PRED(n1 - 1)
+		| CCM_CS1CDR_SAI1_CLK_PODF(n2 - 1);
+	IOMUXC_GPR_GPR1 = (IOMUXC_GPR_GPR1 & ~(IOMUXC_GPR_GPR1_SAI1_MCLK1_SEL_MASK))
+		| (IOMUXC_GPR_GPR1_SAI1_MCLK_DIR | IOMUXC_GPR_GPR1_SAI1_MCLK1_SEL(0));
+	CORE_PIN23_CONFIG = 3;  // AD_B1_09  ALT3=SAI1_MCLK
+}
+#endif
+
 /////////////////////
 // SysAudioInputI2S
 /////////////////////
 struct SysAudioInputI2S::_impl {
 	static bool update_responsibility;
+	static bool running;
 
 	static DMAChannel dma;
+	static DMASetting tcd[2];  // ping-pong receive descriptors, each filling one block pair
+	static unsigned last_done; // descriptor collected last
 	static void isr(void);
-
-    static audio_block_t* block_left;
-	static audio_block_t* block_right;
-	static uint16_t       block_offset;
+	static void collect(void);
+	static void arm(unsigned index);
+	static void start(void);
+	static void stop(void);
+
+	// Block pair each descriptor writes, nullptr while it writes its scratch pair
+	static I2sBlock* dma_left[2];
+	static I2sBlock* dma_right[2];
+	// Last completed pair, waiting for update()
+	static I2sBlock* block_left;
+	static I2sBlock* block_right;
 
 	// DC removal for WM8731 codec
-	static int leftSum, rightSum;
+	static I2sDcSum leftSum, rightSum;
 	static int numBlocks;
 	static int numCalibrateBlocks;
 	static int leftDcOffset, rightDcOffset;
@@ -45,8 +215,13 @@ struct SysAudioOutputI2S::_impl {
 	static audio_block_t *block_left_1st;
 	static audio_block_t *block_right_1st;
 	static bool update_responsibility;
+	static bool running;
 	static DMAChannel dma;
+	static DMASetting tcd[I2S_PERIODS]; // transmit ring, one descriptor per period
+	static unsigned block_phase;        // period of the block the ring plays next
 	static void isr(void);
+	static void start(void);
+	static void stop(void);
 
 	static audio_block_t *block_left_2nd;
 	static audio_block_t *block_right_2nd;
@@ -54,14 +229,20 @@ struct SysAudioOutputI2S::_impl {
 	static uint16_t block_right_offset;
 };
 
-DMAMEM __attribute__((aligned(32))) static uint32_t i2s_rx_buffer[AUDIO_BLOCK_SAMPLES];
-audio_block_t * SysAudioInputI2S::_impl::block_left = NULL;
-audio_block_t * SysAudioInputI2S::_impl::block_right = NULL;
-uint16_t SysAudioInputI2S::_impl::block_offset = 0;
+// Left and right halves a descriptor writes when no suitable block pair
+// could be allocated. The ISR then copies them into blocks.
+DMAMEM __attribute__((aligned(32))) static I2sSample i2s_rx_scratch[2][2][AUDIO_BLOCK_SAMPLES];
+I2sBlock * SysAudioInputI2S::_impl::dma_left[2] = {NULL, NULL};
+I2sBlock * SysAudioInputI2S::_impl::dma_right[2] = {NULL, NULL};
+I2sBlock * SysAudioInputI2S::_impl::block_left = NULL;
+I2sBlock * SysAudioInputI2S::_impl::block_right = NULL;
 bool SysAudioInputI2S::_impl::update_responsibility = false;
+bool SysAudioInputI2S::_impl::running = false;
 DMAChannel SysAudioInputI2S::_impl::dma(false);
-int SysAudioInputI2S::_impl::leftSum = 0;
-int SysAudioInputI2S::_impl::rightSum = 0;
+DMASetting SysAudioInputI2S::_impl::tcd[2];
+unsigned SysAudioInputI2S::_impl::last_done = 1;
+I2sDcSum SysAudioInputI2S::_impl::leftSum = 0;
+I2sDcSum SysAudioInputI2S::_impl::rightSum = 0;
 int SysAudioInputI2S::_impl::numBlocks = 0;
 int SysAudioInputI2S::_impl::numCalibrateBlocks = 0;
 int SysAudioInputI2S::_impl::leftDcOffset = 0;
@@ -69,6 +250,42 @@ int SysAudioInputI2S::_impl::rightDcOffset = 0;
 int SysAudioInputI2S::_impl::leftDcOffsetSmoothed = 0;
 int SysAudioInputI2S::_impl::rightDcOffsetSmoothed = 0;
 
+// Set once both directions run and the transmit ISR services them
+static bool i2s_duplex = false;
+
+static void i2sQuiesce(void);
+static void i2sRestart(void);
+
+// The transmit ISR needs the next block in the period after the one that
+// triggers the update, so the update has to finish before that period.
+static void i2sSetDeadline(void)
+{
+	unsigned trigger = i2s_duplex ? I2S_DUPLEX_POLL_PERIOD : I2S_PERIODS_PER_BLOCK - 1;
+	AudioGraph::setDeadlineSamples((I2S_PERIODS_PER_BLOCK - trigger) * I2S_PERIOD);
+}
+
+// Switch to full-duplex once the second direction starts. The receiver and
+// transmitter share the SAI bit clock and frame sync, so their DMA stays
+// phase-locked and the transmit ISR can collect each receive block at a
+// fixed point. That drops the receive interrupt and orders capture,
+// processing and playback the same way every block.
+static void i2sEnableDuplex(void)
+{
+#if SYS_AUDIO_I2S_DUPLEX
+	if (!I2S_DUPLEX_FITS || i2s_duplex || !SysAudioInputI2S::_impl::running || !SysAudioOutputI2S::_impl::running) { return; }
+	{
+		SysIrqGuard guard;
+		SysAudioInputI2S::_impl::dma.detachInterrupt();
+		i2s_duplex = true;
+	}
+	i2sSetDeadline();
+	// The directions were started independently, so their block boundaries
+	// can be anywhere relative to each other. Restart both on the same frame.
+	i2sQuiesce();
+	i2sRestart();
+#endif
+}
+
 SysAudioInputI2S::SysAudioInputI2S(void)
 //: AudioStream(0, (audio_block_float32_t**)NULL), m_pimpl(std::make_unique<_impl>())
 : AudioStream(0, (audio_block_t**)NULL), m_pimpl(std::make_unique<_impl>())
@@ -88,9 +305,16 @@ void SysAudioInputI2S::enable()
 
 void SysAudioInputI2S::disable()
 {
-	release(m_pimpl->block_left);  m_pimpl->block_left  = nullptr;
-	release(m_pimpl->block_right); m_pimpl->block_right = nullptr;
-	m_pimpl->block_offset = 0;
+	I2sBlock *left, *right;
+	{
+		SysIrqGuard guard;
+		left = m_pimpl->block_left;
+		right = m_pimpl->block_right;
+		m_pimpl->block_left  = nullptr;
+		m_pimpl->block_right = nullptr;
+	}
+	release(left);
+	release(right);
 	m_enable = false;
 }
 
@@ -105,19 +329,22 @@ void SysAudioInputI2S::begin(void)
 	CORE_PIN8_CONFIG  = 3;  //1:RX_DATA0
 	IOMUXC_SAI1_RX_DATA0_SELECT_INPUT = 2;
 
-	m_pimpl->dma.TCD->SADDR = (void *)((uint32_t)&I2S1_RDR0 + 2);
-	m_pimpl->dma.TCD->SOFF = 0;
-	m_pimpl->dma.TCD->ATTR = DMA_TCD_ATTR_SSIZE(1) | DMA_TCD_ATTR_DSIZE(1);
-	m_pimpl->dma.TCD->NBYTES_MLNO = 2;
-	m_pimpl->dma.TCD->SLAST = 0;
-	m_pimpl->dma.TCD->DADDR = i2s_rx_buffer;
-	m_pimpl->dma.TCD->DOFF = 2;
-	m_pimpl->dma.TCD->CITER_ELINKNO = sizeof(i2s_rx_buffer) / 2;
-	m_pimpl->dma.TCD->DLASTSGA = -sizeof(i2s_rx_buffer);
-	m_pimpl->dma.TCD->BITER_ELINKNO = sizeof(i2s_rx_buffer) / 2;
-	m_pimpl->dma.TCD->CSR = DMA_TCD_CSR_INTHALF | DMA_TCD_CSR_INTMAJOR;
+	// Each descriptor receives one block: every minor loop writes the left
+	// sample, steps DOFF to the right sample, then the minor loop offset steps
+	// back to the next left sample. On completion the DMA loads the other
+	// descriptor (scatter-gather) and the ISR re-arms the finished one.
+	for (unsigned i = 0; i < 2; i++) {
+		m_pimpl->tcd[i].TCD->SADDR = (void *)((uint32_t)&I2S1_RDR0 + I2S_DATA_REG_OFFSET);
+		m_pimpl->tcd[i].TCD->SOFF = 0;
+		m_pimpl->tcd[i].TCD->ATTR = DMA_TCD_ATTR_SSIZE(I2S_DMA_SIZE) | DMA_TCD_ATTR_DSIZE(I2S_DMA_SIZE);
+		m_pimpl->tcd[i].TCD->SLAST = 0;
+		m_pimpl->tcd[i].TCD->CITER_ELINKNO = AUDIO_BLOCK_SAMPLES;
+		m_pimpl->tcd[i].TCD->BITER_ELINKNO = AUDIO_BLOCK_SAMPLES;
+		m_pimpl->tcd[i].TCD->DLASTSGA = (int32_t)(m_pimpl->tcd[1 - i].TCD);
+		m_pimpl->tcd[i].TCD->CSR = DMA_TCD_CSR_INTMAJOR | DMA_TCD_CSR_ESG;
+	}
 	m_pimpl->dma.triggerAtHardwareEvent(DMAMUX_SOURCE_SAI1_RX);
-	m_pimpl->dma.enable();
+	m_pimpl->start();
 
 	I2S1_RCSR = 0;
 	I2S1_RCSR = I2S_RCSR_RE | I2S_RCSR_BCE | I2S_RCSR_FRDE | I2S_RCSR_FR;
@@ -127,84 +354,157 @@ void SysAudioInputI2S::begin(void)
     m_pimpl->leftSum   = 0;
 	m_pimpl->rightSum  = 0;
 	m_pimpl->numBlocks = 0;
-	m_pimpl->numCalibrateBlocks = (2*AUDIO_SAMPLE_RATE_HZ)/AUDIO_SAMPLES_PER_BLOCK; // 2 seconds for DC filter
+	m_pimpl->numCalibrateBlocks = (2*audioSampleRate())/AUDIO_SAMPLES_PER_BLOCK; // 2 seconds for DC filter
 	m_pimpl->leftDcOffset  = 0;
 	m_pimpl->rightDcOffset = 0;
 	m_pimpl->leftDcOffsetSmoothed  = 0;
 	m_pimpl->rightDcOffsetSmoothed = 0;
+	m_pimpl->running = true;
+	i2sEnableDuplex();
 	enable();
 	m_isInitialized = true;
 }
 
-void SysAudioInputI2S::_impl::isr(void)
+// Arm both descriptors and start the receive DMA with the first
+void SysAudioInputI2S::_impl::start(void)
 {
-	uint32_t daddr, offset;
-	const int16_t *src, *end;
-	int16_t *dest_left, *dest_right;
-	audio_block_t *left, *right;
+	arm(0);
+	arm(1);
+	dma = tcd[0];
+	last_done = 1; // the running descriptor links to tcd[1] until tcd[0] completes
+	dma.enable();
+}
 
-	daddr = (uint32_t)(dma.TCD->DADDR);
+// Stop the receive DMA and release every block it holds
+void SysAudioInputI2S::_impl::stop(void)
+{
+	dma.disable();
 	dma.clearInterrupt();
-	//Serial.println("isr");
+	I2sBlock *left, *right;
+	{
+		SysIrqGuard guard;
+		left = block_left;
+		right = block_right;
+		block_left = nullptr;
+		block_right = nullptr;
+	}
+	AudioStream::release(left);
+	AudioStream::release(right);
+	for (unsigned i = 0; i < 2; i++) {
+		AudioStream::release(dma_left[i]);  dma_left[i] = nullptr;
+		AudioStream::release(dma_right[i]); dma_right[i] = nullptr;
+	}
+}
 
-	if (daddr < (uint32_t)i2s_rx_buffer + sizeof(i2s_rx_buffer) / 2) {
-		// DMA is receiving to the first half of the buffer
-		// need to remove data from the second half
-		src = (int16_t *)&i2s_rx_buffer[AUDIO_BLOCK_SAMPLES/2];
-		end = (int16_t *)&i2s_rx_buffer[AUDIO_BLOCK_SAMPLES];
-		if (update_responsibility) AudioStream::update_all();
+// A block pair can be the DMA destination if the right samples are in reach
+// of the 16-bit DOFF from the left samples, and both start on a cache line
+// so invalidating them cannot discard neighbouring data.
+static bool dmaPairFits(const I2sBlock *left, const I2sBlock *right)
+{
+	int32_t distance = (int32_t)((uint32_t)right->data - (uint32_t)left->data);
+	return (distance >= INT16_MIN) && (distance <= INT16_MAX) &&
+		!((uint32_t)left->data & 31) && !((uint32_t)right->data & 31);
+}
+
+// Point a receive descriptor at a fresh block pair, or at its scratch pair
+// when the pool is empty or the pair does not fit
+void SysAudioInputI2S::_impl::arm(unsigned index)
+{
+	I2sBlock *left = allocateAudioBlock<I2sBlockSample>();
+	I2sBlock *right = left ? allocateAudioBlock<I2sBlockSample>() : nullptr;
+	I2sSample *dest_left, *dest_right;
+	if (left && right && dmaPairFits(left, right)) {
+		// no dirty line may be written back over the DMA data
+		arm_dcache_delete(left->data, AUDIO_BLOCK_SAMPLES * sizeof(I2sSample));
+		arm_dcache_delete(right->data, AUDIO_BLOCK_SAMPLES * sizeof(I2sSample));
+		dest_left = i2sWords(left);
+		dest_right = i2sWords(right);
 	} else {
-		// DMA is receiving to the second half of the buffer
-		// need to remove data from the first half
-		src = (int16_t *)&i2s_rx_buffer[0];
-		end = (int16_t *)&i2s_rx_buffer[AUDIO_BLOCK_SAMPLES/2];
+		AudioStream::release(left);  left = nullptr;
+		AudioStream::release(right); right = nullptr;
+		dest_left = i2s_rx_scratch[index][0];
+		dest_right = i2s_rx_scratch[index][1];
 	}
-	left = block_left;
-	right = block_right;
-	if (left != NULL && right != NULL) {
-		offset = block_offset;
-		if (offset <= AUDIO_BLOCK_SAMPLES/2) {
-			dest_left = &(left->data[offset]);
-			dest_right = &(right->data[offset]);
-			block_offset = offset + AUDIO_BLOCK_SAMPLES/2;
-			arm_dcache_delete((void*)src, sizeof(i2s_rx_buffer) / 2);
-			do {
-				*dest_left++ = *src++;
-				*dest_right++ = *src++;
-			} while (src < end);
+	dma_left[index] = left;
+	dma_right[index] = right;
+
+	int32_t distance = (int32_t)((uint32_t)dest_right - (uint32_t)dest_left);
+	tcd[index].TCD->DADDR = dest_left;
+	tcd[index].TCD->DOFF = (int16_t)distance;
+	tcd[index].TCD->NBYTES_MLOFFYES = DMA_TCD_NBYTES_DMLOE |
+		DMA_TCD_NBYTES_MLOFFYES_MLOFF((int32_t)sizeof(I2sSample) - 2 * distance) |
+		DMA_TCD_NBYTES_MLOFFYES_NBYTES(2 * sizeof(I2sSample));
+}
+
+void SysAudioInputI2S::_impl::isr(void)
+{
+	dma.clearInterrupt();
+	collect();
+	if (update_responsibility) AudioStream::update_all();
+}
+
+// Hand the pair of the descriptor that completed last to update() and re-arm
+// it. Called by the receive ISR, or polled by the transmit ISR in duplex mode.
+void SysAudioInputI2S::_impl::collect(void)
+{
+	// The running descriptor links back to the one that just completed
+	uint32_t next = (uint32_t)(dma.TCD->DLASTSGA);
+	unsigned done = (next == (uint32_t)tcd[0].TCD) ? 0 : 1;
+	if (done == last_done) { return; } // nothing completed since the last call
+	last_done = done;
+	if (i2s_duplex) { dma.clearInterrupt(); }
+
+	I2sBlock *left = dma_left[done];
+	I2sBlock *right = dma_right[done];
+	if (left) {
+		arm_dcache_delete(left->data, AUDIO_BLOCK_SAMPLES * sizeof(I2sSample));
+		arm_dcache_delete(right->data, AUDIO_BLOCK_SAMPLES * sizeof(I2sSample));
+	} else {
+		// the descriptor wrote its scratch pair, fall back to copying
+		left = allocateAudioBlock<I2sBlockSample>();
+		right = left ? allocateAudioBlock<I2sBlockSample>() : nullptr;
+		if (left && right) {
+			arm_dcache_delete(i2s_rx_scratch[done], sizeof(i2s_rx_scratch[done]));
+			memcpy(left->data, i2s_rx_scratch[done][0], AUDIO_BLOCK_SAMPLES * sizeof(I2sSample));
+			memcpy(right->data, i2s_rx_scratch[done][1], AUDIO_BLOCK_SAMPLES * sizeof(I2sSample));
+		} else {
+			AudioStream::release(left);  left = nullptr;
+			AudioStream::release(right); right = nullptr;
 		}
 	}
+	arm(done);
+
+	// hand the pair to update(), dropping one it did not collect
+	I2sBlock *old_left = block_left;
+	I2sBlock *old_right = block_right;
+	block_left = left;
+	block_right = right;
+	AudioStream::release(old_left);
+	AudioStream::release(old_right);
 }
 
 void SysAudioInputI2S::update(void)
 {
 	if (!m_enable) { return; }
-	audio_block_t *new_left=NULL, *new_right=NULL, *out_left=NULL, *out_right=NULL;
-
-	// allocate 2 new blocks, but if one fails, allocate neither
-	new_left = allocate();
-	if (new_left != NULL) {
-		new_right = allocate();
-		if (new_right == NULL) {
-			release(new_left); new_left = NULL;
-		}
-	}
-	__disable_irq();
-	if (m_pimpl->block_offset >= AUDIO_BLOCK_SAMPLES) {
-		// the DMA filled 2 blocks, so grab them and get the
-		// 2 new blocks to the DMA, as quickly as possible
+	I2sBlock *out_left=NULL, *out_right=NULL;
+
+	// take the pair the DMA completed, the ISR already armed the next one
+	{
+		SysIrqGuard guard;
 		out_left = m_pimpl->block_left;
-		m_pimpl->block_left = new_left;
 		out_right = m_pimpl->block_right;
-		m_pimpl->block_right = new_right;
-		m_pimpl->block_offset = 0;
-		__enable_irq();
+		m_pimpl->block_left = NULL;
+		m_pimpl->block_right = NULL;
+	}
 
+	if (out_left && out_right) {
+		I2sSample *left_words = i2sWords(out_left);
+		I2sSample *right_words = i2sWords(out_right);
 #ifdef REMOVE_DC_OFFSET
         if (m_pimpl->numBlocks < m_pimpl->numCalibrateBlocks) {
 			for (unsigned i=0; i < AUDIO_SAMPLES_PER_BLOCK; i++) {
-				m_pimpl->leftSum  += out_left->data[i];
-				m_pimpl->rightSum += out_right->data[i];
+				m_pimpl->leftSum  += left_words[i];
+				m_pimpl->rightSum += right_words[i];
 			}
 			m_pimpl->numBlocks++;
 		}
@@ -217,17 +517,22 @@ void SysAudioInputI2S::update(void)
 				m_pimpl->leftDcOffsetSmoothed  = m_pimpl->leftDcOffsetSmoothed*REMOVE_DC_SLEW_ALPHA + m_pimpl->leftDcOffset*REMOVE_DC_SLEW_MINUS_ALPHA;
 				m_pimpl->rightDcOffsetSmoothed = m_pimpl->rightDcOffsetSmoothed*REMOVE_DC_SLEW_ALPHA + m_pimpl->rightDcOffset*REMOVE_DC_SLEW_MINUS_ALPHA;
 
-				out_left->data[i]  -= m_pimpl->leftDcOffsetSmoothed;
-				out_right->data[i] -= m_pimpl->rightDcOffsetSmoothed;
+				left_words[i]  = i2sRemoveDc(left_words[i], m_pimpl->leftDcOffsetSmoothed);
+				right_words[i] = i2sRemoveDc(right_words[i], m_pimpl->rightDcOffsetSmoothed);
 			}
 		}
 		else {
 			for (unsigned i=0; i < AUDIO_SAMPLES_PER_BLOCK; i++) {
-				out_left->data[i]  -= m_pimpl->leftDcOffsetSmoothed;
-				out_right->data[i] -= m_pimpl->rightDcOffsetSmoothed;
+				left_words[i]  = i2sRemoveDc(left_words[i], m_pimpl->leftDcOffsetSmoothed);
+				right_words[i] = i2sRemoveDc(right_words[i], m_pimpl->rightDcOffsetSmoothed);
 			}
 		}
 #endif
+#if SYS_AUDIO_I2S_BITS > 16
+		// convert the codec words in place, the blocks become float blocks
+		audioQ31ToFloat(out_left->data, left_words, AUDIO_BLOCK_SAMPLES);
+		audioQ31ToFloat(out_right->data, right_words, AUDIO_BLOCK_SAMPLES);
+#endif
 
 		// then transmit the DMA's former blocks
 		transmit(out_left, 0);
@@ -235,27 +540,9 @@ void SysAudioInputI2S::update(void)
 		transmit(out_right, 1);
 		release(out_right); out_right = nullptr;
 		//Serial.print(".");
-	} else if (new_left != NULL) {
-		// the DMA didn't fill blocks, but we allocated blocks
-		if (m_pimpl->block_left == NULL) {
-			// the DMA doesn't have any blocks to fill, so
-			// give it the ones we just allocated
-			m_pimpl->block_left = new_left;
-			m_pimpl->block_right = new_right;
-			m_pimpl->block_offset = 0;
-			__enable_irq();
-		} else {
-			// the DMA already has blocks, doesn't need these
-			__enable_irq();
-			release(new_left); new_left = nullptr;
-			release(new_right); new_right = nullptr;
-		}
-	} else {
-		// The DMA didn't fill blocks, and we could not allocate
-		// memory... the system is likely starving for memory!
-		// Sadly, there's nothing we can do.
-		__enable_irq();
 	}
+	// Otherwise the DMA has not completed a pair since the last update, or
+	// the pool was empty... the system is likely starving for memory!
 }
 
 //////////////////////
@@ -268,8 +555,12 @@ audio_block_t * SysAudioOutputI2S::_impl::block_right_2nd = NULL;
 uint16_t  SysAudioOutputI2S::_impl::block_left_offset = 0;
 uint16_t  SysAudioOutputI2S::_impl::block_right_offset = 0;
 bool SysAudioOutputI2S::_impl::update_responsibility = false;
+bool SysAudioOutputI2S::_impl::running = false;
 DMAChannel SysAudioOutputI2S::_impl::dma(false);
-DMAMEM __attribute__((aligned(32))) static uint32_t i2s_tx_buffer[AUDIO_BLOCK_SAMPLES];
+DMASetting SysAudioOutputI2S::_impl::tcd[I2S_PERIODS];
+unsigned SysAudioOutputI2S::_impl::block_phase = 0;
+// Interleaved left and right codec words of each transmit period
+DMAMEM __attribute__((aligned(32))) static I2sSample i2s_tx_buffer[I2S_PERIODS][I2S_PERIOD * 2];
 
 
 SysAudioOutputI2S::SysAudioOutputI2S(void)
@@ -310,30 +601,94 @@ void SysAudioOutputI2S::begin(void)
 	SysAudioOutputI2S::_impl::config_i2s();
 
 	CORE_PIN7_CONFIG  = 3;  //1:TX_DATA0
-	m_pimpl->dma.TCD->SADDR = i2s_tx_buffer;
-	m_pimpl->dma.TCD->SOFF = 2;
-	m_pimpl->dma.TCD->ATTR = DMA_TCD_ATTR_SSIZE(1) | DMA_TCD_ATTR_DSIZE(1);
-	m_pimpl->dma.TCD->NBYTES_MLNO = 2;
-	m_pimpl->dma.TCD->SLAST = -sizeof(i2s_tx_buffer);
-	m_pimpl->dma.TCD->DOFF = 0;
-	m_pimpl->dma.TCD->CITER_ELINKNO = sizeof(i2s_tx_buffer) / 2;
-	m_pimpl->dma.TCD->DLASTSGA = 0;
-	m_pimpl->dma.TCD->BITER_ELINKNO = sizeof(i2s_tx_buffer) / 2;
-	m_pimpl->dma.TCD->DADDR = (void *)((uint32_t)&I2S1_TDR0 + 2);
-	m_pimpl->dma.TCD->CSR = DMA_TCD_CSR_INTHALF | DMA_TCD_CSR_INTMAJOR;
+
+	// Each descriptor plays one period and links to the next (scatter-gather),
+	// the ISR refills the period that just completed.
+	for (unsigned i = 0; i < I2S_PERIODS; i++) {
+		m_pimpl->tcd[i].TCD->SADDR = i2s_tx_buffer[i];
+		m_pimpl->tcd[i].TCD->SOFF = sizeof(I2sSample);
+		m_pimpl->tcd[i].TCD->ATTR = DMA_TCD_ATTR_SSIZE(I2S_DMA_SIZE) | DMA_TCD_ATTR_DSIZE(I2S_DMA_SIZE);
+		m_pimpl->tcd[i].TCD->NBYTES_MLNO = sizeof(I2sSample);
+		m_pimpl->tcd[i].TCD->SLAST = 0;
+		m_pimpl->tcd[i].TCD->DOFF = 0;
+		m_pimpl->tcd[i].TCD->CITER_ELINKNO = sizeof(i2s_tx_buffer[i]) / sizeof(I2sSample);
+		m_pimpl->tcd[i].TCD->BITER_ELINKNO = sizeof(i2s_tx_buffer[i]) / sizeof(I2sSample);
+		m_pimpl->tcd[i].TCD->DLASTSGA = (int32_t)(m_pimpl->tcd[(i + 1) % I2S_PERIODS].TCD);
+		m_pimpl->tcd[i].TCD->DADDR = (void *)((uint32_t)&I2S1_TDR0 + I2S_DATA_REG_OFFSET);
+		m_pimpl->tcd[i].TCD->CSR = DMA_TCD_CSR_INTMAJOR | DMA_TCD_CSR_ESG;
+	}
 	m_pimpl->dma.triggerAtHardwareEvent(DMAMUX_SOURCE_SAI1_TX);
-	m_pimpl->dma.enable();
+	m_pimpl->start();
 
 	I2S1_RCSR |= I2S_RCSR_RE | I2S_RCSR_BCE;
 	I2S1_TCSR = I2S_TCSR_TE | I2S_TCSR_BCE | I2S_TCSR_FRDE;
 
 	m_pimpl->update_responsibility = update_setup();
+	if (m_pimpl->update_responsibility) { i2sSetDeadline(); }
 	m_pimpl->dma.attachInterrupt(SysAudioOutputI2S::_impl::isr);
+	m_pimpl->running = true;
+	i2sEnableDuplex();
 
     enable();
 	m_isInitialized = true;
 }
 
+// Start the transmit ring from the first (silent) period, at a block boundary
+void SysAudioOutputI2S::_impl::start(void)
+{
+	dma = tcd[0];
+	block_phase = 0;
+	dma.enable();
+}
+
+// Stop the transmit DMA, drop the queued blocks and silence the buffer
+void SysAudioOutputI2S::_impl::stop(void)
+{
+	dma.disable();
+	dma.clearInterrupt();
+	audio_block_t *queued[4];
+	{
+		SysIrqGuard guard;
+		queued[0] = block_left_1st;
+		queued[1] = block_left_2nd;
+		queued[2] = block_right_1st;
+		queued[3] = block_right_2nd;
+		block_left_1st = block_left_2nd = NULL;
+		block_right_1st = block_right_2nd = NULL;
+		block_left_offset = 0;
+		block_right_offset = 0;
+	}
+	for (audio_block_t *block : queued) { AudioStream::release(block); }
+	memset(i2s_tx_buffer, 0, sizeof(i2s_tx_buffer));
+	arm_dcache_flush_delete(i2s_tx_buffer, sizeof(i2s_tx_buffer));
+}
+
+// receiveWritable() copies a shared block into an int16 block, so a float
+// block must be taken with receiveWritableFloat() to keep its samples
+static bool isFloatBlock(const audio_block_t *block)
+{
+	return block && (block->flags & FLOAT_MASK);
+}
+
+// Apply a linear gain ramp, used while the audio graph swaps its plan
+static void applyGainRamp(audio_block_t *block, float gainStart, float gainEnd)
+{
+	float gain = gainStart;
+	float step = (gainEnd - gainStart) / AUDIO_BLOCK_SAMPLES;
+	if (block->flags & FLOAT_MASK) {
+		float *data = ((audio_block_float32_t *)block)->data;
+		for (unsigned i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+			gain += step;
+			data[i] *= gain;
+		}
+		return;
+	}
+	for (unsigned i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+		gain += step;
+		block->data[i] = (int16_t)(block->data[i] * gain);
+	}
+}
+
 void SysAudioOutputI2S::update(void)
 {
     // null audio device: discard all incoming data
@@ -343,64 +698,105 @@ void SysAudioOutputI2S::update(void)
 
 	if (!m_enable) { return; }
 
+	float gainStart, gainEnd;
+	bool fading = AudioGraph::outputFade(gainStart, gainEnd);
+
 	audio_block_t *block;
-	block = receiveReadOnly(0); // input 0 = left channel
+	// input 0 = left channel
+	if (!fading) { block = receiveReadOnly(0); }
+	else if (isFloatBlock(inputQueueArray[0])) { block = (audio_block_t *)receiveWritableFloat(0); }
+	else { block = receiveWritable(0); }
+	if (block && fading) { applyGainRamp(block, gainStart, gainEnd); }
 	if (block) {
-		__disable_irq();
-		if (m_pimpl->block_left_1st == NULL) {
-			m_pimpl->block_left_1st = block;
-			m_pimpl->block_left_offset = 0;
-			__enable_irq();
-		} else if (m_pimpl->block_left_2nd == NULL) {
-			m_pimpl->block_left_2nd = block;
-			__enable_irq();
-		} else {
-			audio_block_t *tmp = m_pimpl->block_left_1st;
-			m_pimpl->block_left_1st = m_pimpl->block_left_2nd;
-			m_pimpl->block_left_2nd = block;
-			m_pimpl->block_left_offset = 0;
-			__enable_irq();
-			release(tmp);
+		audio_block_t *tmp = NULL;
+		{
+			SysIrqGuard guard;
+			if (m_pimpl->block_left_1st == NULL) {
+				m_pimpl->block_left_1st = block;
+				m_pimpl->block_left_offset = 0;
+			} else if (m_pimpl->block_left_2nd == NULL) {
+				m_pimpl->block_left_2nd = block;
+			} else {
+				tmp = m_pimpl->block_left_1st;
+				m_pimpl->block_left_1st = m_pimpl->block_left_2nd;
+				m_pimpl->block_left_2nd = block;
+				m_pimpl->block_left_offset = 0;
+			}
 		}
+		release(tmp);
 	}
-	block = receiveReadOnly(1); // input 1 = right channel
+	// input 1 = right channel
+	if (!fading) { block = receiveReadOnly(1); }
+	else if (isFloatBlock(inputQueueArray[1])) { block = (audio_block_t *)receiveWritableFloat(1); }
+	else { block = receiveWritable(1); }
+	if (block && fading) { applyGainRamp(block, gainStart, gainEnd); }
 	if (block) {
-		__disable_irq();
-		if (m_pimpl->block_right_1st == NULL) {
-			m_pimpl->block_right_1st = block;
-			m_pimpl->block_right_offset = 0;
-			__enable_irq();
-		} else if (m_pimpl->block_right_2nd == NULL) {
-			m_pimpl->block_right_2nd = block;
-			__enable_irq();
-		} else {
-			audio_block_t *tmp = m_pimpl->block_right_1st;
-			m_pimpl->block_right_1st = m_pimpl->block_right_2nd;
-			m_pimpl->block_right_2nd = block;
-			m_pimpl->block_right_offset = 0;
-			__enable_irq();
-			release(tmp);
+		audio_block_t *tmp = NULL;
+		{
+			SysIrqGuard guard;
+			if (m_pimpl->block_right_1st == NULL) {
+				m_pimpl->block_right_1st = block;
+				m_pimpl->block_right_offset = 0;
+			} else if (m_pimpl->block_right_2nd == NULL) {
+				m_pimpl->block_right_2nd = block;
+			} else {
+				tmp = m_pimpl->block_right_1st;
+				m_pimpl->block_right_1st = m_pimpl->block_right_2nd;
+				m_pimpl->block_right_2nd = block;
+				m_pimpl->block_right_offset = 0;
+			}
 		}
+		release(tmp);
+	}
+}
+
+#if SYS_AUDIO_I2S_BITS > 16
+// Write one period of one channel to every stride words of dest. Float
+// graphs send float blocks, int16 blocks are widened.
+static void i2sFillChannel(I2sSample *dest, const audio_block_t *block, unsigned offset, unsigned stride = 2)
+{
+	if (!block) {
+		audioZeroStrided(dest, I2S_PERIOD, stride);
+	} else if (block->flags & FLOAT_MASK) {
+		audioFloatToQ31(dest, ((const audio_block_float32_t *)block)->data + offset, I2S_PERIOD, stride);
+	} else {
+		audioInt16ToQ31(dest, block->data + offset, I2S_PERIOD, stride);
 	}
 }
+#endif
 
 void SysAudioOutputI2S::_impl::isr(void)
 {
-	int16_t *dest;
+	I2sSample *dest;
 	audio_block_t *blockL, *blockR;
-	uint32_t saddr, offsetL, offsetR;
+	uint32_t offsetL, offsetR;
 
-	saddr = (uint32_t)(dma.TCD->SADDR);
+	// The running descriptor links to the one after it, so the one before it
+	// just completed. Refill that period, it plays after the others.
+	uint32_t next = (uint32_t)(dma.TCD->DLASTSGA);
 	dma.clearInterrupt();
-	if (saddr < (uint32_t)i2s_tx_buffer + sizeof(i2s_tx_buffer) / 2) {
-		// DMA is transmitting the first half of the buffer
-		// so we must fill the second half
-		dest = (int16_t *)&i2s_tx_buffer[AUDIO_BLOCK_SAMPLES/2];
-		if (SysAudioOutputI2S::_impl::update_responsibility) AudioStream::update_all();
-	} else {
-		// DMA is transmitting the second half of the buffer
-		// so we must fill the first half
-		dest = (int16_t *)i2s_tx_buffer;
+	unsigned done = 0;
+	for (unsigned i = 0; i < I2S_PERIODS; i++) {
+		if (next == (uint32_t)tcd[i].TCD) {
+			done = (i + I2S_PERIODS - 2) % I2S_PERIODS;
+			break;
+		}
+	}
+	dest = i2s_tx_buffer[done];
+
+	unsigned phase = block_phase;
+	block_phase = (phase + 1 < I2S_PERIODS_PER_BLOCK) ? phase + 1 : 0;
+	if (i2s_duplex) {
+		if (phase == I2S_DUPLEX_POLL_PERIOD) {
+			// the receive DMA has safely completed its block, collect it, then update
+			SysAudioInputI2S::_impl::collect();
+			if (update_responsibility || SysAudioInputI2S::_impl::update_responsibility) {
+				AudioStream::update_all();
+			}
+		}
+	} else if (phase == I2S_PERIODS_PER_BLOCK - 1) {
+		// the ring played through a block boundary
+		if (update_responsibility) AudioStream::update_all();
 	}
 
 	blockL = SysAudioOutputI2S::_impl::block_left_1st;
@@ -408,21 +804,17 @@ void SysAudioOutputI2S::_impl::isr(void)
 	offsetL = SysAudioOutputI2S::_impl::block_left_offset;
 	offsetR = SysAudioOutputI2S::_impl::block_right_offset;
 
-	if (blockL && blockR) {
-		memcpy_tointerleaveLR(dest, blockL->data + offsetL, blockR->data + offsetR);
-		offsetL += AUDIO_BLOCK_SAMPLES / 2;
-		offsetR += AUDIO_BLOCK_SAMPLES / 2;
-	} else if (blockL) {
-		memcpy_tointerleaveL(dest, blockL->data + offsetL);
-		offsetL += AUDIO_BLOCK_SAMPLES / 2;
-	} else if (blockR) {
-		memcpy_tointerleaveR(dest, blockR->data + offsetR);
-		offsetR += AUDIO_BLOCK_SAMPLES / 2;
-	} else {
-		memset(dest,0,AUDIO_BLOCK_SAMPLES * 2);
-	}
+#if SYS_AUDIO_I2S_BITS > 16
+	i2sFillChannel(dest, blockL, offsetL);
+	i2sFillChannel(dest + 1, blockR, offsetR);
+#else
+	audioInterleaveInt16(dest, blockL ? blockL->data + offsetL : nullptr,
+		blockR ? blockR->data + offsetR : nullptr, I2S_PERIOD);
+#endif
+	if (blockL) offsetL += I2S_PERIOD;
+	if (blockR) offsetR += I2S_PERIOD;
 
-	arm_dcache_flush_delete(dest, sizeof(i2s_tx_buffer) / 2 );
+	arm_dcache_flush_delete(dest, sizeof(i2s_tx_buffer[0]));
 
 	if (offsetL < AUDIO_BLOCK_SAMPLES) {
 		SysAudioOutputI2S::_impl::block_left_offset = offsetL;
@@ -452,6 +844,9 @@ void SysAudioOutputI2S::_impl::config_i2s(bool only_bclk)
 
 	// not using MCLK in slave mode - hope that's ok?
 	//CORE_PIN23_CONFIG = 3;  // AD_B1_09  ALT3=SAI1_MCLK
+#if SYS_AUDIO_TEENSY_MCLK
+	i2sSetMclk(i2sRate()->mclkHz);
+#endif
 	CORE_PIN21_CONFIG = 3;  // AD_B1_11  ALT3=SAI1_RX_BCLK
 	CORE_PIN20_CONFIG = 3;  // AD_B1_10  ALT3=SAI1_RX_SYNC
 	IOMUXC_SAI1_RX_BCLK_SELECT_INPUT = 1; // 1=GPIO_AD_B1_11_ALT3, page 868
@@ -476,6 +871,376 @@ void SysAudioOutputI2S::_impl::config_i2s(bool only_bclk)
 	I2S1_RCR5 = I2S_RCR5_WNW(31) | I2S_RCR5_W0W(31) | I2S_RCR5_FBT(31);
 }
 
+/////////////////////
+// SysAudioInputTDM
+/////////////////////
+struct SysAudioInputTDM::_impl {
+	static bool update_responsibility;
+	static bool running;
+	static DMAChannel dma;
+	static void isr(void);
+
+	// Last completed blocks, waiting for update()
+	static I2sBlock* block[AUDIO_TDM_CHANNELS];
+};
+
+struct SysAudioOutputTDM::_impl {
+	static bool update_responsibility;
+	static bool running;
+	static DMAChannel dma;
+	static DMASetting tcd[I2S_PERIODS]; // transmit ring, one descriptor per period
+	static void isr(void);
+
+	// Up to two sets of blocks queued by update(), one block per slot. A set
+	// is played out in periods from block_offset, then the second moves up.
+	static audio_block_t *block_1st[AUDIO_TDM_CHANNELS];
+	static audio_block_t *block_2nd[AUDIO_TDM_CHANNELS];
+	static unsigned queued;
+	static uint16_t block_offset;
+};
+
+// Program SAI1 for TDM frames of AUDIO_TDM_CHANNELS 32-bit slots, the codec
+// drives the bit clock and frame sync
+static void tdmConfigSai(void)
+{
+	CCM_CCGR5 |= CCM_CCGR5_SAI1(CCM_CCGR_ON);
+
+	// if either transmitter or receiver is enabled, do nothing
+	if (I2S1_TCSR & I2S_TCSR_TE) return;
+	if (I2S1_RCSR & I2S_RCSR_RE) return;
+
+#if SYS_AUDIO_TEENSY_MCLK
+	i2sSetMclk(i2sRate()->mclkHz);
+#endif
+	CORE_PIN21_CONFIG = 3;  // AD_B1_11  ALT3=SAI1_RX_BCLK
+	CORE_PIN20_CONFIG = 3;  // AD_B1_10  ALT3=SAI1_RX_SYNC
+	IOMUXC_SAI1_RX_BCLK_SELECT_INPUT = 1;
+	IOMUXC_SAI1_RX_SYNC_SELECT_INPUT = 1;
+
+	// configure transmitter, one bit clock wide frame sync one bit early
+	I2S1_TMR = 0;
+	I2S1_TCR1 = I2S_TCR1_RFW(1);  // watermark at half fifo size
+	I2S1_TCR2 = I2S_TCR2_SYNC(1) | I2S_TCR2_BCP;
+	I2S1_TCR3 = I2S_TCR3_TCE;
+	I2S1_TCR4 = I2S_TCR4_FRSZ(AUDIO_TDM_CHANNELS - 1) | I2S_TCR4_SYWD(0) | I2S_TCR4_MF
+		| I2S_TCR4_FSE;
+	I2S1_TCR5 = I2S_TCR5_WNW(31) | I2S_TCR5_W0W(31) | I2S_TCR5_FBT(31);
+
+	// configure receiver
+	I2S1_RMR = 0;
+	I2S1_RCR1 = I2S_RCR1_RFW(1);
+	I2S1_RCR2 = I2S_RCR2_SYNC(0) | I2S_TCR2_BCP;
+	I2S1_RCR3 = I2S_RCR3_RCE;
+	I2S1_RCR4 = I2S_RCR4_FRSZ(AUDIO_TDM_CHANNELS - 1) | I2S_RCR4_SYWD(0) | I2S_RCR4_MF
+		| I2S_RCR4_FSE;
+	I2S1_RCR5 = I2S_RCR5_WNW(31) | I2S_RCR5_W0W(31) | I2S_RCR5_FBT(31);
+}
+
+// Interleaved slots of two blocks of frames, the ISR splits the half the
+// DMA just filled while it fills the other
+DMAMEM __attribute__((aligned(32))) static I2sSample tdm_rx_buffer[2][AUDIO_BLOCK_SAMPLES * AUDIO_TDM_CHANNELS];
+bool SysAudioInputTDM::_impl::update_responsibility = false;
+bool SysAudioInputTDM::_impl::running = false;
+DMAChannel SysAudioInputTDM::_impl::dma(false);
+I2sBlock * SysAudioInputTDM::_impl::block[AUDIO_TDM_CHANNELS] = {};
+
+SysAudioInputTDM::SysAudioInputTDM(void)
+: AudioStream(0, (audio_block_t**)NULL), m_pimpl(std::make_unique<_impl>())
+{
+	begin();
+}
+
+SysAudioInputTDM::~SysAudioInputTDM()
+{
+
+}
+
+void SysAudioInputTDM::enable()
+{
+	m_enable = true;
+}
+
+void SysAudioInputTDM::disable()
+{
+	I2sBlock *blocks[AUDIO_TDM_CHANNELS];
+	{
+		SysIrqGuard guard;
+		for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+			blocks[i] = m_pimpl->block[i];
+			m_pimpl->block[i] = nullptr;
+		}
+	}
+	for (I2sBlock *block : blocks) { release(block); }
+	m_enable = false;
+}
+
+void SysAudioInputTDM::begin(void)
+{
+	if (m_isInitialized) { return; }
+
+	m_pimpl->dma.begin(true); // Allocate the DMA channel first
+
+	tdmConfigSai();
+
+	CORE_PIN8_CONFIG  = 3;  //1:RX_DATA0
+	IOMUXC_SAI1_RX_DATA0_SELECT_INPUT = 2;
+
+	m_pimpl->dma.TCD->SADDR = (void *)((uint32_t)&I2S1_RDR0 + I2S_DATA_REG_OFFSET);
+	m_pimpl->dma.TCD->SOFF = 0;
+	m_pimpl->dma.TCD->ATTR = DMA_TCD_ATTR_SSIZE(I2S_DMA_SIZE) | DMA_TCD_ATTR_DSIZE(I2S_DMA_SIZE);
+	m_pimpl->dma.TCD->NBYTES_MLNO = sizeof(I2sSample);
+	m_pimpl->dma.TCD->SLAST = 0;
+	m_pimpl->dma.TCD->DADDR = tdm_rx_buffer;
+	m_pimpl->dma.TCD->DOFF = sizeof(I2sSample);
+	m_pimpl->dma.TCD->CITER_ELINKNO = sizeof(tdm_rx_buffer) / sizeof(I2sSample);
+	m_pimpl->dma.TCD->DLASTSGA = -(int32_t)sizeof(tdm_rx_buffer);
+	m_pimpl->dma.TCD->BITER_ELINKNO = sizeof(tdm_rx_buffer) / sizeof(I2sSample);
+	m_pimpl->dma.TCD->CSR = DMA_TCD_CSR_INTHALF | DMA_TCD_CSR_INTMAJOR;
+	m_pimpl->dma.triggerAtHardwareEvent(DMAMUX_SOURCE_SAI1_RX);
+	m_pimpl->dma.enable();
+
+	I2S1_RCSR = 0;
+	I2S1_RCSR = I2S_RCSR_RE | I2S_RCSR_BCE | I2S_RCSR_FRDE | I2S_RCSR_FR;
+	m_pimpl->update_responsibility = update_setup();
+	m_pimpl->dma.attachInterrupt(SysAudioInputTDM::_impl::isr);
+	m_pimpl->running = true;
+	enable();
+	m_isInitialized = true;
+}
+
+void SysAudioInputTDM::_impl::isr(void)
+{
+	uint32_t daddr = (uint32_t)(dma.TCD->DADDR);
+	dma.clearInterrupt();
+
+	// the DMA is filling one half, split the other into a set of blocks
+	const I2sSample *src = (daddr < (uint32_t)tdm_rx_buffer[1]) ? tdm_rx_buffer[1] : tdm_rx_buffer[0];
+	arm_dcache_delete((void *)src, sizeof(tdm_rx_buffer[0]));
+
+	I2sBlock *blocks[AUDIO_TDM_CHANNELS];
+	bool complete = true;
+	for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+		blocks[i] = complete ? allocateAudioBlock<I2sBlockSample>() : nullptr;
+		complete = complete && blocks[i];
+	}
+	if (complete) {
+#if SYS_AUDIO_I2S_BITS > 16
+		for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+			audioQ31ToFloat(blocks[i]->data, src + i, AUDIO_BLOCK_SAMPLES, AUDIO_TDM_CHANNELS);
+		}
+#else
+		int16_t *dest[AUDIO_TDM_CHANNELS];
+		for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) { dest[i] = blocks[i]->data; }
+		audioDeinterleaveInt16<AUDIO_TDM_CHANNELS>(dest, src, AUDIO_BLOCK_SAMPLES);
+#endif
+	} else {
+		// the pool is empty, drop this block of frames
+		for (I2sBlock *&b : blocks) { AudioStream::release(b); b = nullptr; }
+	}
+
+	// hand the set to update(), dropping one it did not collect
+	for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+		AudioStream::release(block[i]);
+		block[i] = blocks[i];
+	}
+	if (update_responsibility) AudioStream::update_all();
+}
+
+void SysAudioInputTDM::update(void)
+{
+	if (!m_enable) { return; }
+	I2sBlock *out[AUDIO_TDM_CHANNELS];
+
+	{
+		SysIrqGuard guard;
+		for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+			out[i] = m_pimpl->block[i];
+			m_pimpl->block[i] = nullptr;
+		}
+	}
+
+	// the ISR hands over complete sets only
+	if (!out[0]) { return; }
+	for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+		transmit(out[i], i);
+		release(out[i]);
+	}
+}
+
+//////////////////////
+// SysAudioOutputTDM
+//////////////////////
+// Interleaved slots of each transmit period
+DMAMEM __attribute__((aligned(32))) static I2sSample tdm_tx_buffer[I2S_PERIODS][I2S_PERIOD * AUDIO_TDM_CHANNELS];
+bool SysAudioOutputTDM::_impl::update_responsibility = false;
+bool SysAudioOutputTDM::_impl::running = false;
+DMAChannel SysAudioOutputTDM::_impl::dma(false);
+DMASetting SysAudioOutputTDM::_impl::tcd[I2S_PERIODS];
+audio_block_t * SysAudioOutputTDM::_impl::block_1st[AUDIO_TDM_CHANNELS] = {};
+audio_block_t * SysAudioOutputTDM::_impl::block_2nd[AUDIO_TDM_CHANNELS] = {};
+unsigned SysAudioOutputTDM::_impl::queued = 0;
+uint16_t SysAudioOutputTDM::_impl::block_offset = 0;
+
+SysAudioOutputTDM::SysAudioOutputTDM(void)
+: AudioStream(AUDIO_TDM_CHANNELS, inputQueueArray), m_pimpl(std::make_unique<_impl>())
+{
+	begin();
+}
+
+SysAudioOutputTDM::~SysAudioOutputTDM()
+{
+
+}
+
+void SysAudioOutputTDM::enable()
+{
+	m_enable = true;
+}
+
+void SysAudioOutputTDM::disable()
+{
+	audio_block_t *blocks[2 * AUDIO_TDM_CHANNELS];
+	{
+		SysIrqGuard guard;
+		for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+			blocks[i] = m_pimpl->block_1st[i];
+			blocks[AUDIO_TDM_CHANNELS + i] = m_pimpl->block_2nd[i];
+			m_pimpl->block_1st[i] = nullptr;
+			m_pimpl->block_2nd[i] = nullptr;
+		}
+		m_pimpl->queued = 0;
+		m_pimpl->block_offset = 0;
+	}
+	for (audio_block_t *block : blocks) { release(block); }
+	m_enable = false;
+}
+
+void SysAudioOutputTDM::begin(void)
+{
+	if (m_isInitialized) { return; }
+	m_pimpl->dma.begin(true); // Allocate the DMA channel first
+
+	tdmConfigSai();
+
+	CORE_PIN7_CONFIG  = 3;  //1:TX_DATA0
+
+	// The same period ring as SysAudioOutputI2S, with a frame of slots per sample
+	for (unsigned i = 0; i < I2S_PERIODS; i++) {
+		m_pimpl->tcd[i].TCD->SADDR = tdm_tx_buffer[i];
+		m_pimpl->tcd[i].TCD->SOFF = sizeof(I2sSample);
+		m_pimpl->tcd[i].TCD->ATTR = DMA_TCD_ATTR_SSIZE(I2S_DMA_SIZE) | DMA_TCD_ATTR_DSIZE(I2S_DMA_SIZE);
+		m_pimpl->tcd[i].TCD->NBYTES_MLNO = sizeof(I2sSample);
+		m_pimpl->tcd[i].TCD->SLAST = 0;
+		m_pimpl->tcd[i].TCD->DOFF = 0;
+		m_pimpl->tcd[i].TCD->CITER_ELINKNO = sizeof(tdm_tx_buffer[i]) / sizeof(I2sSample);
+		m_pimpl->tcd[i].TCD->BITER_ELINKNO = sizeof(tdm_tx_buffer[i]) / sizeof(I2sSample);
+		m_pimpl->tcd[i].TCD->DLASTSGA = (int32_t)(m_pimpl->tcd[(i + 1) % I2S_PERIODS].TCD);
+		m_pimpl->tcd[i].TCD->DADDR = (void *)((uint32_t)&I2S1_TDR0 + I2S_DATA_REG_OFFSET);
+		m_pimpl->tcd[i].TCD->CSR = DMA_TCD_CSR_INTMAJOR | DMA_TCD_CSR_ESG;
+	}
+	m_pimpl->dma.triggerAtHardwareEvent(DMAMUX_SOURCE_SAI1_TX);
+	m_pimpl->dma = m_pimpl->tcd[0];
+	m_pimpl->dma.enable();
+
+	I2S1_RCSR |= I2S_RCSR_RE | I2S_RCSR_BCE;
+	I2S1_TCSR = I2S_TCSR_TE | I2S_TCSR_BCE | I2S_TCSR_FRDE;
+
+	m_pimpl->update_responsibility = update_setup();
+	m_pimpl->dma.attachInterrupt(SysAudioOutputTDM::_impl::isr);
+	m_pimpl->running = true;
+
+	enable();
+	m_isInitialized = true;
+}
+
+void SysAudioOutputTDM::update(void)
+{
+	if (!m_enable) { return; }
+
+	float gainStart, gainEnd;
+	bool fading = AudioGraph::outputFade(gainStart, gainEnd);
+
+	audio_block_t *blocks[AUDIO_TDM_CHANNELS];
+	for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+		if (!fading) { blocks[i] = receiveReadOnly(i); }
+		else if (isFloatBlock(inputQueueArray[i])) { blocks[i] = (audio_block_t *)receiveWritableFloat(i); }
+		else { blocks[i] = receiveWritable(i); }
+		if (blocks[i] && fading) { applyGainRamp(blocks[i], gainStart, gainEnd); }
+	}
+
+	// queue the set, replacing the older one if the ISR fell behind
+	audio_block_t *dropped[AUDIO_TDM_CHANNELS] = {};
+	{
+		SysIrqGuard guard;
+		if (m_pimpl->queued == 0) {
+			for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) { m_pimpl->block_1st[i] = blocks[i]; }
+			m_pimpl->block_offset = 0;
+			m_pimpl->queued = 1;
+		} else if (m_pimpl->queued == 1) {
+			for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) { m_pimpl->block_2nd[i] = blocks[i]; }
+			m_pimpl->queued = 2;
+		} else {
+			for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+				dropped[i] = m_pimpl->block_1st[i];
+				m_pimpl->block_1st[i] = m_pimpl->block_2nd[i];
+				m_pimpl->block_2nd[i] = blocks[i];
+			}
+			m_pimpl->block_offset = 0;
+		}
+	}
+	for (audio_block_t *block : dropped) { release(block); }
+}
+
+void SysAudioOutputTDM::_impl::isr(void)
+{
+	// refill the period that just completed, as in SysAudioOutputI2S
+	uint32_t next = (uint32_t)(dma.TCD->DLASTSGA);
+	dma.clearInterrupt();
+	unsigned done = 0;
+	for (unsigned i = 0; i < I2S_PERIODS; i++) {
+		if (next == (uint32_t)tcd[i].TCD) {
+			done = (i + I2S_PERIODS - 2) % I2S_PERIODS;
+			break;
+		}
+	}
+	I2sSample *dest = tdm_tx_buffer[done];
+
+	unsigned offset = block_offset;
+	if (offset + I2S_PERIOD >= AUDIO_BLOCK_SAMPLES) {
+		// the last period of the set, the graph computes the next
+		if (update_responsibility) AudioStream::update_all();
+	}
+
+	if (queued) {
+#if SYS_AUDIO_I2S_BITS > 16
+		for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+			i2sFillChannel(dest + i, block_1st[i], offset, AUDIO_TDM_CHANNELS);
+		}
+#else
+		const int16_t *src[AUDIO_TDM_CHANNELS];
+		for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+			src[i] = block_1st[i] ? block_1st[i]->data + offset : nullptr;
+		}
+		audioInterleaveInt16<AUDIO_TDM_CHANNELS>(dest, src, I2S_PERIOD);
+#endif
+		offset += I2S_PERIOD;
+		if (offset >= AUDIO_BLOCK_SAMPLES) {
+			offset = 0;
+			for (unsigned i = 0; i < AUDIO_TDM_CHANNELS; i++) {
+				AudioStream::release(block_1st[i]);
+				block_1st[i] = block_2nd[i];
+				block_2nd[i] = nullptr;
+			}
+			queued--;
+		}
+	} else {
+		memset(dest, 0, sizeof(tdm_tx_buffer[0]));
+		offset = (offset + I2S_PERIOD) % AUDIO_BLOCK_SAMPLES;
+	}
+	block_offset = offset;
+	arm_dcache_flush_delete(dest, sizeof(tdm_tx_buffer[0]));
+}
+
 
 /////////////
 // SysCodec
@@ -501,6 +1266,7 @@ constexpr unsigned BYPASS_PGA_GAIN = 0x13; // -6 dB Gain
 
 constexpr int WM8731_NUM_REGS = 10; ///< Number of registers in the internal shadow array
 static std::atomic<bool> ctrlBusy(false);
+static bool codecActive = false; // the digital audio interface is active
 
 // use const instead of define for proper scoping
 constexpr int WM8731_I2C_ADDR = 0x1A;
@@ -581,6 +1347,16 @@ constexpr int WM8731_LRSWAP_ADDR = 5;
 constexpr int WM8731_LRSWAP_MASK = 0x20;
 constexpr int WM8731_LRSWAPE_SHIFT = 5;
 
+// Register 7, interface format
+// I2S format, codec is master, word length to match the I2S DMA
+#if SYS_AUDIO_I2S_BITS == 32
+constexpr int WM8731_INTERFACE_CONFIG = 0x4E; // I2S, 32 bit, MCLK master
+#elif SYS_AUDIO_I2S_BITS == 24
+constexpr int WM8731_INTERFACE_CONFIG = 0x4A; // I2S, 24 bit, MCLK master
+#else
+constexpr int WM8731_INTERFACE_CONFIG = 0x42; // I2S, 16 bit, MCLK master
+#endif
+
 // Register 9
 constexpr int WM8731_ACTIVATE_ADDR = 9;
 constexpr int WM8731_ACTIVATE_MASK = 0x1;
@@ -619,6 +1395,7 @@ void SysCodec::_impl::resetInternalReg(void) {
 	regArray[7] = 0xa;
 	regArray[8] = 0;
 	regArray[9] = 0;
+	codecActive = false;
 }
 
 void SysCodec::_impl::setOutputStrength(void)
@@ -685,6 +1462,7 @@ void SysCodec::_impl::setDacSelect(bool val)
 // Activate/deactive the I2S audio interface
 void SysCodec::_impl::setActivate(bool val)
 {
+	codecActive = val;
 	if (val) {
 		write(WM8731_ACTIVATE_ADDR, WM8731_ACTIVATE_MASK);
 	} else {
@@ -956,11 +1734,12 @@ void SysCodec::enable(void)
     m_pimpl->write(WM8731_REG_RHEADOUT, m_pimpl->regArray[WM8731_REG_RHEADOUT]);
 
     /// Configure the audio interface
-    m_pimpl->write(WM8731_REG_INTERFACE, 0x42); // I2S, 16 bit, MCLK master
-    m_pimpl->regArray[WM8731_REG_INTERFACE] = 0x42;
+    m_pimpl->write(WM8731_REG_INTERFACE, WM8731_INTERFACE_CONFIG);
+    m_pimpl->regArray[WM8731_REG_INTERFACE] = WM8731_INTERFACE_CONFIG;
 
-    m_pimpl->write(WM8731_REG_SAMPLING, 0x20);  // 256*Fs, 44.1 kHz, MCLK/1
-    m_pimpl->regArray[WM8731_REG_SAMPLING] = 0x20;
+    m_pimpl->write(WM8731_REG_SAMPLING, i2sRate()->codecSampling);
+    m_pimpl->regArray[WM8731_REG_SAMPLING] = i2sRate()->codecSampling;
+    AudioClock::setNominalSampleRate(i2sRate()->hz);
     delay(100); // wait for interface config
 
     // Activate the audio interface
@@ -1040,4 +1819,84 @@ void SysAudioGlobalBypass::bypass(bool byp) {
 	m_pimpl->m_sysCodec.setAdcBypass(byp);
 }
 
+////////////////
+// Sample rate
+////////////////
+constexpr uint32_t I2S_STOP_TIMEOUT_US = 1000;
+constexpr uint32_t CODEC_RATE_SETTLE_MS = 10;
+
+// Stop the I2S DMA and the SAI and flush the FIFOs
+static void i2sQuiesce(void)
+{
+	if (SysAudioInputI2S::_impl::running) { SysAudioInputI2S::_impl::stop(); }
+	if (SysAudioOutputI2S::_impl::running) { SysAudioOutputI2S::_impl::stop(); }
+
+	// The enables only clear at the end of the frame, so the codec must still
+	// be clocking. Give up after a few frames in case it is not.
+	I2S1_TCSR &= ~(I2S_TCSR_TE | I2S_TCSR_FRDE);
+	I2S1_RCSR &= ~(I2S_RCSR_RE | I2S_RCSR_FRDE);
+	uint32_t start = micros();
+	while (((I2S1_TCSR & I2S_TCSR_TE) || (I2S1_RCSR & I2S_RCSR_RE)) && (micros() - start < I2S_STOP_TIMEOUT_US)) {}
+	I2S1_TCSR |= I2S_TCSR_FR;
+	I2S1_RCSR |= I2S_RCSR_FR;
+}
+
+// Restart the DMA and the SAI of the directions that were running
+static void i2sRestart(void)
+{
+	if (SysAudioInputI2S::_impl::running) {
+		SysAudioInputI2S::_impl::start();
+		I2S1_RCSR = I2S_RCSR_RE | I2S_RCSR_BCE | I2S_RCSR_FRDE | I2S_RCSR_FR;
+	}
+	if (SysAudioOutputI2S::_impl::running) {
+		SysAudioOutputI2S::_impl::start();
+		I2S1_RCSR |= I2S_RCSR_RE | I2S_RCSR_BCE;
+		I2S1_TCSR = I2S_TCSR_TE | I2S_TCSR_BCE | I2S_TCSR_FRDE;
+	}
+}
+
+bool audioSampleRateSupported(uint32_t hz)
+{
+	return i2sFindRate(hz) != nullptr;
+}
+
+uint32_t audioSampleRate()
+{
+	return i2sRate()->hz;
+}
+
+bool audioSetSampleRate(uint32_t hz)
+{
+	const I2sRateConfig *rate = i2sFindRate(hz);
+	if (!rate) { return false; }
+	if (rate == i2sRate()) { return true; }
+	// a TDM codec is configured by the application
+	if (SysAudioInputTDM::_impl::running || SysAudioOutputTDM::_impl::running) { return false; }
+
+	// stop the update before the clocks change under it, the SAI registers
+	// are only clocked once a direction has started
+	bool streaming = SysAudioInputI2S::_impl::running || SysAudioOutputI2S::_impl::running;
+	if (streaming) { i2sQuiesce(); }
+
+	// The codec must be inactive while its clocking changes. If it has not
+	// been enabled yet, enable() picks up the new rate.
+	SysCodec &codec = SysCodec::getCodec();
+	bool active = codecActive;
+	if (active) { codec.writeI2C(WM8731_REG_ACTIVE, 0); }
+#if SYS_AUDIO_TEENSY_MCLK
+	i2sSetMclk(rate->mclkHz);
+#endif
+	i2s_rate = rate;
+	if (active) {
+		codec.writeI2C(WM8731_REG_SAMPLING, rate->codecSampling);
+		codec.writeI2C(WM8731_REG_ACTIVE, WM8731_ACTIVATE_MASK);
+		delay(CODEC_RATE_SETTLE_MS);
+	}
+
+	AudioClock::setNominalSampleRate(rate->hz);
+	AudioGraph::deadline().setPeriod(0); // recomputed from the new block period
+	if (streaming) { i2sRestart(); }
+	return true;
+}
+
 }  // end SysPlatfrom namespace
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+
+/// NVIC line of the low priority audio tier. Any line without a peripheral
+/// attached can be used, override it if 71 is taken.
+#ifndef SYS_AUDIO_LOW_TIER_IRQ
+#define SYS_AUDIO_LOW_TIER_IRQ 71
+#endif
+
+namespace SysPlatform {
+
+/// NVIC priority of the low priority audio tier, less urgent than the audio
+/// software interrupt so the low tier never delays the block update
+constexpr uint8_t AUDIO_LOW_TIER_ISR_PRIORITY = 224;
+
+/// Control of the software interrupt running the low priority audio tier,
+/// the counterpart of SysCpuControl::AudioAttachInterruptVector() and friends
+/// for the block update interrupt.
+/// @{
+void audioLowTierAttach(void (*function)(void), uint8_t priority);
+void audioLowTierEnable();
+void audioLowTierDisable();
+void audioLowTierTrigger();
+/// @}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+/// Set to 1 if the Teensy drives the codec MCLK from PLL4 on pin 23. Any
+/// supported rate can then be selected. Otherwise the codec runs from its own
+/// crystal and only the rates of that crystal's family can be selected.
+#ifndef SYS_AUDIO_TEENSY_MCLK
+#define SYS_AUDIO_TEENSY_MCLK 0
+#endif
+
+/// Frequency of the codec crystal when the Teensy does not drive MCLK.
+/// 11289600 Hz gives 44.1 and 88.2 kHz, 12288000 Hz gives 32, 48 and 96 kHz.
+#ifndef SYS_AUDIO_CODEC_MCLK_HZ
+#define SYS_AUDIO_CODEC_MCLK_HZ 11289600
+#endif
+
+namespace SysPlatform {
+
+/// Change the sample rate of the I2S codec path without a reboot.
+///
+/// The I2S DMA and the SAI are stopped, the codec is deactivated while its
+/// sampling control and, with SYS_AUDIO_TEENSY_MCLK, PLL4 and the SAI1 clock
+/// dividers are reprogrammed, then everything is restarted. Blocks in flight
+/// are dropped, so the output is silent for a few blocks. AudioClock re-anchors
+/// its timeline at the new rate. Thread context only, it blocks on codec I2C
+/// writes.
+///
+/// AUDIO_SAMPLE_RATE_HZ and AUDIO_SAMPLE_RATE_EXACT keep the compile time rate.
+/// Nodes that derive coefficients from the rate, such as filters, oscillators
+/// and delays given in milliseconds, must re-derive them from audioSampleRate()
+/// after a change, for example by setting their parameters again.
+/// @param hz 32000, 44100, 48000, 88200 or 96000
+/// @returns false if the rate cannot be generated with the clock configuration,
+/// or if the TDM classes are streaming, their codec is set up by the application
+bool audioSetSampleRate(uint32_t hz);
+
+/// @returns true if audioSetSampleRate() can select the rate
+bool audioSampleRateSupported(uint32_t hz);
+
+/// @returns the sample rate the I2S codec path is configured for, in Hz
+uint32_t audioSampleRate();
+
+}
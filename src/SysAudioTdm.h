@@ -0,0 +1,63 @@
+#pragma once
+
+#include <memory>
+#include "sysPlatform/AudioStream.h"
+
+/// Slots per TDM frame, 4 or 8. Each slot is one 32-bit channel.
+#ifndef SYS_AUDIO_TDM_CHANNELS
+#define SYS_AUDIO_TDM_CHANNELS 8
+#endif
+
+namespace SysPlatform {
+
+constexpr unsigned AUDIO_TDM_CHANNELS = SYS_AUDIO_TDM_CHANNELS;
+static_assert((AUDIO_TDM_CHANNELS == 4) || (AUDIO_TDM_CHANNELS == 8), "SYS_AUDIO_TDM_CHANNELS must be 4 or 8");
+
+/// Receive AUDIO_TDM_CHANNELS channels from a multichannel codec on SAI1 in
+/// TDM mode, slot n on output n.
+///
+/// The TDM classes share SAI1 and its pins with SysAudioInputI2S and
+/// SysAudioOutputI2S, use one family or the other. As with the WM8731, the
+/// codec is the clock master. It must send a one bit clock frame sync one
+/// bit before slot 0 (DSP mode A) with 32 bit clocks per slot. The word
+/// length follows SYS_AUDIO_I2S_BITS. The codec itself is configured by the
+/// application, SysCodec drives the WM8731 only.
+class SysAudioInputTDM : public AudioStream {
+public:
+    SysAudioInputTDM();
+    virtual ~SysAudioInputTDM();
+    void begin();
+    void enable();
+    void disable();
+    virtual void update(void) override;
+
+    struct _impl;
+
+private:
+    bool m_enable        = false;
+    bool m_isInitialized = false;
+    std::unique_ptr<_impl> m_pimpl;
+};
+
+/// Transmit AUDIO_TDM_CHANNELS channels to a multichannel codec on SAI1 in
+/// TDM mode, input n to slot n. Unconnected inputs play silence. See
+/// SysAudioInputTDM for the frame format.
+class SysAudioOutputTDM : public AudioStream {
+public:
+    SysAudioOutputTDM();
+    virtual ~SysAudioOutputTDM();
+    void begin();
+    void enable();
+    void disable();
+    virtual void update(void) override;
+
+    struct _impl;
+
+private:
+    bool m_enable        = false;
+    bool m_isInitialized = false;
+    audio_block_t *inputQueueArray[AUDIO_TDM_CHANNELS];
+    std::unique_ptr<_impl> m_pimpl;
+};
+
+}
@@ -3,6 +3,7 @@
 #include "usb_audio.h"
 #include "SysWatchdog.h"
 #include "SysAudio.h"
+#include "SysCriticalSection.h"
 
 namespace SysPlatform {
 
@@ -46,15 +47,18 @@ void SysAudioInputUsb::update(void)
 	if (!m_enable) { return; }
 	audio_block_t *left, *right;
 
-	__disable_irq();
-	left = AudioInputUSB::ready_left;
-	AudioInputUSB::ready_left = NULL;
-	right = AudioInputUSB::ready_right;
-	AudioInputUSB::ready_right = NULL;
-	uint16_t c = AudioInputUSB::incoming_count;
-	uint8_t f = AudioInputUSB::receive_flag;
-	AudioInputUSB::receive_flag = 0;
-	__enable_irq();
+	uint16_t c;
+	uint8_t f;
+	{
+		SysIrqGuard guard;
+		left = AudioInputUSB::ready_left;
+		AudioInputUSB::ready_left = NULL;
+		right = AudioInputUSB::ready_right;
+		AudioInputUSB::ready_right = NULL;
+		c = AudioInputUSB::incoming_count;
+		f = AudioInputUSB::receive_flag;
+		AudioInputUSB::receive_flag = 0;
+	}
 	if (f) {
 		int diff = AUDIO_BLOCK_SAMPLES/2 - (int)c;
 		feedback_accumulator += diff * 1;
@@ -180,7 +184,7 @@ void SysAudioOutputUsb::update(void)
 		//memset(right->data, 0, sizeof(right->data));
 		memset(right->data, 0, sizeof(int16_t)*AUDIO_SAMPLES_PER_BLOCK);
 	}
-	__disable_irq();
+	SysIrqGuard guard;
 	if (AudioOutputUSB::left_1st == NULL) {
 		AudioOutputUSB::left_1st = left;
 		AudioOutputUSB::right_1st = right;
@@ -201,7 +205,6 @@ void SysAudioOutputUsb::update(void)
 		release(discard1);  discard1 = nullptr; // we know left_1st is not NULL
 		if (discard2) { release(discard2); discard2 = nullptr; }
 	}
-	__enable_irq();
 }
 
 void SysAudioOutputUsb::begin(void)
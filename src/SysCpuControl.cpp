@@ -2,6 +2,7 @@
 #include "sysPlatform/SysTypes.h"
 #include "sysPlatform/SysCpuControl.h"
 #include "sysPlatform/SysWatchdog.h"
+#include "SysAudioInterrupts.h"
 
 namespace SysPlatform
 {
@@ -26,14 +27,30 @@ namespace SysPlatform
         ::yield();
     }
 
+    // disableIrqs()/enableIrqs() nest. The outermost disableIrqs() saves
+    // PRIMASK and the matching enableIrqs() restores it, so interrupts are
+    // only re-enabled if they were enabled to begin with.
+    static volatile unsigned irqNesting = 0;
+    static uint32_t irqSavedPrimask = 0;
+
     void SysCpuControl::disableIrqs()
     {
+        uint32_t primask;
+        asm volatile("mrs %0, primask" : "=r"(primask) :: "memory");
         __disable_irq();
+        if (irqNesting++ == 0) { irqSavedPrimask = primask; }
     }
 
     void SysCpuControl::enableIrqs()
     {
-        __enable_irq();
+        if (irqNesting == 0) {
+            // unbalanced call, keep the original behaviour
+            __enable_irq();
+            return;
+        }
+        if (--irqNesting == 0) {
+            asm volatile("msr primask, %0" :: "r"(irqSavedPrimask) : "memory");
+        }
     }
 
     void SysCpuControl::AudioNoInterrupts()
@@ -61,6 +78,27 @@ namespace SysPlatform
         attachInterruptVector(IRQ_SOFTWARE, function);
     }
 
+    void audioLowTierAttach(void (*function)(void), uint8_t priority)
+    {
+        attachInterruptVector((IRQ_NUMBER_t)SYS_AUDIO_LOW_TIER_IRQ, function);
+        NVIC_SET_PRIORITY(SYS_AUDIO_LOW_TIER_IRQ, priority);
+    }
+
+    void audioLowTierEnable()
+    {
+        NVIC_ENABLE_IRQ(SYS_AUDIO_LOW_TIER_IRQ);
+    }
+
+    void audioLowTierDisable()
+    {
+        NVIC_DISABLE_IRQ(SYS_AUDIO_LOW_TIER_IRQ);
+    }
+
+    void audioLowTierTrigger()
+    {
+        NVIC_SET_PENDING(SYS_AUDIO_LOW_TIER_IRQ);
+    }
+
     void SysCpuControl::SysDataSyncBarrier()
     {
         asm("DSB");
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+
+namespace SysPlatform {
+
+/// NVIC priority of the audio software interrupt that runs the audio update
+constexpr uint8_t AUDIO_SOFTWARE_ISR_PRIORITY = 208;
+
+/// Scoped critical section that masks all configurable interrupts.
+///
+/// PRIMASK is saved on entry and restored on exit, so guards nest, and a guard
+/// used where interrupts are already disabled leaves them disabled.
+/// It also nests inside SysCpuControl::disableIrqs(). Do not mix either with
+/// raw __disable_irq()/__enable_irq() pairs: a raw __enable_irq() turns
+/// interrupts back on inside any enclosing guard or disableIrqs() section.
+class SysIrqGuard {
+public:
+    SysIrqGuard() {
+#if defined(__IMXRT1062__)
+        asm volatile("mrs %0, primask" : "=r"(m_primask) :: "memory");
+        asm volatile("cpsid i" ::: "memory");
+#endif
+    }
+    ~SysIrqGuard() {
+#if defined(__IMXRT1062__)
+        asm volatile("msr primask, %0" :: "r"(m_primask) : "memory");
+#endif
+    }
+    SysIrqGuard(const SysIrqGuard&) = delete;
+    SysIrqGuard& operator=(const SysIrqGuard&) = delete;
+
+private:
+    uint32_t m_primask = 0;
+};
+
+/// Scoped lock against the audio update.
+///
+/// Raises BASEPRI to AUDIO_SOFTWARE_ISR_PRIORITY, which masks the audio
+/// software interrupt and everything of equal or lower urgency, while USB, the
+/// I2S and SPI DMA interrupts and the system tick keep running. Use it for
+/// state shared only with the audio update, such as the connection lists and
+/// the compiled plan. BASEPRI is only ever raised here, so locks nest, and a
+/// lock taken from a more urgent context has no effect.
+class SysAudioLock {
+public:
+    SysAudioLock() {
+#if defined(__IMXRT1062__)
+        asm volatile("mrs %0, basepri" : "=r"(m_basepri) :: "memory");
+        asm volatile("msr basepri_max, %0" :: "r"((uint32_t)AUDIO_SOFTWARE_ISR_PRIORITY) : "memory");
+#endif
+    }
+    ~SysAudioLock() {
+#if defined(__IMXRT1062__)
+        asm volatile("msr basepri, %0" :: "r"(m_basepri) : "memory");
+#endif
+    }
+    SysAudioLock(const SysAudioLock&) = delete;
+    SysAudioLock& operator=(const SysAudioLock&) = delete;
+
+private:
+    uint32_t m_basepri = 0;
+};
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+namespace SysPlatform {
+
+/// Extends a free running 32-bit counter, such as ARM_DWT_CYCCNT, to 64 bits.
+///
+/// Each call compares the counter with the previous call and counts a wrap
+/// when it went backwards, so extend() must run at least once per wrap period,
+/// about 7 s at 600 MHz. Not thread safe, callers serialize access.
+class CycleCounterExtender {
+public:
+    constexpr CycleCounterExtender() = default;
+
+    /// @param low current value of the 32-bit counter
+    /// @returns the 64-bit count
+    uint64_t extend(uint32_t low) {
+        if (low < m_last) { m_high++; }
+        m_last = low;
+        return (static_cast<uint64_t>(m_high) << 32) | low;
+    }
+
+private:
+    uint32_t m_high = 0;
+    uint32_t m_last = 0;
+};
+
+/// Convert a cycle count to microseconds. The CPU clock is a whole number of MHz.
+inline uint64_t cyclesToMicros(uint64_t cycles, uint32_t cpuHz)
+{
+    uint32_t mhz = cpuHz / 1000000U;
+    return cycles / mhz;
+}
+
+/// Convert a cycle count to nanoseconds. The CPU clock is a whole number of MHz.
+/// Counts whose nanoseconds do not fit in 64 bits, more than 584 years,
+/// saturate at UINT64_MAX.
+inline uint64_t cyclesToNanos(uint64_t cycles, uint32_t cpuHz)
+{
+    uint32_t mhz = cpuHz / 1000000U;
+    uint64_t whole = cycles / mhz;
+    uint32_t part  = static_cast<uint32_t>(cycles % mhz) * 1000U / mhz;
+    if (whole > (UINT64_MAX - part) / 1000U) { return UINT64_MAX; }
+    return whole * 1000U + part;
+}
+
+}
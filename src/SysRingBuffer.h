@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace SysPlatform {
+
+/// Data cache line size of the Cortex-M7
+constexpr unsigned SYS_CACHE_LINE_BYTES = 32;
+
+/// Bounded wait-free queue for exactly one producer and one consumer, e.g.
+/// the audio ISR and a TeensyThreads worker, or a thread and the audio ISR.
+///
+/// The indices run freely and are only wrapped when addressing a slot, so all
+/// Capacity slots are usable. The producer and consumer indices sit on separate
+/// cache lines, each next to a private copy of the other side's index, so in
+/// the common case push() and pop() only read the line they own. All-zero
+/// memory is a valid empty queue, so the ring may live in calloc'd memory or
+/// in .bss without a constructor running. T must be trivially copyable.
+template <typename T, unsigned Capacity>
+class SysSpscRing {
+public:
+    static_assert((Capacity >= 2) && ((Capacity & (Capacity - 1)) == 0), "Capacity must be a power of two");
+
+    constexpr SysSpscRing() = default;
+    SysSpscRing(const SysSpscRing&) = delete;
+    SysSpscRing& operator=(const SysSpscRing&) = delete;
+
+    /// Producer side. @returns false if the queue is full
+    bool push(const T& value) { return pushBatch(&value, 1) == 1; }
+
+    /// Producer side. Queue as many of values as fit, in order.
+    /// @returns the number queued
+    unsigned pushBatch(const T* values, unsigned count) {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        uint32_t free = Capacity - (head - m_tailCache);
+        if (free < count) {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            free = Capacity - (head - m_tailCache);
+        }
+        if (count > free) { count = free; }
+        for (unsigned i = 0; i < count; i++) { m_slots[(head + i) & MASK] = values[i]; }
+        if (count) { m_head.store(head + count, std::memory_order_release); }
+        return count;
+    }
+
+    /// Consumer side. @returns false if the queue is empty
+    bool pop(T& value) { return popBatch(&value, 1) == 1; }
+
+    /// Consumer side. Dequeue up to count values, oldest first.
+    /// @returns the number dequeued
+    unsigned popBatch(T* values, unsigned count) {
+        uint32_t tail      = m_tail.load(std::memory_order_relaxed);
+        uint32_t available = m_headCache - tail;
+        if (available < count) {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            available = m_headCache - tail;
+        }
+        if (count > available) { count = available; }
+        for (unsigned i = 0; i < count; i++) { values[i] = m_slots[(tail + i) & MASK]; }
+        if (count) { m_tail.store(tail + count, std::memory_order_release); }
+        return count;
+    }
+
+    /// Number of queued values. Exact on either side, a snapshot elsewhere.
+    unsigned size() const {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() == Capacity; }
+    static constexpr unsigned capacity() { return Capacity; }
+
+private:
+    friend struct SysRingTestAccess; // lets the host tests start the indices near the 32-bit wrap
+    static constexpr uint32_t MASK = Capacity - 1;
+
+    alignas(SYS_CACHE_LINE_BYTES) std::atomic<uint32_t> m_head{0}; ///< written by the producer
+    uint32_t                                          m_tailCache = 0; ///< producer's copy of m_tail
+    alignas(SYS_CACHE_LINE_BYTES) std::atomic<uint32_t> m_tail{0}; ///< written by the consumer
+    uint32_t                                          m_headCache = 0; ///< consumer's copy of m_head
+    alignas(SYS_CACHE_LINE_BYTES) T                     m_slots[Capacity] = {};
+};
+
+/// Bounded lock-free queue for any number of producers and one consumer, e.g.
+/// several threads and interrupts posting to the audio ISR.
+///
+/// Producers claim slots with a compare-and-swap on the head index, then fill
+/// them and publish each slot through its sequence number, so a producer
+/// preempted between claiming and publishing only delays the consumer at that
+/// slot and never corrupts the queue. pop() never blocks. A consumer that finds
+/// the next slot claimed but not yet published reports the queue as empty.
+/// Unlike SysSpscRing, the constructor must run to seed the sequence numbers.
+/// T must be trivially copyable.
+template <typename T, unsigned Capacity>
+class SysMpscRing {
+public:
+    static_assert((Capacity >= 2) && ((Capacity & (Capacity - 1)) == 0), "Capacity must be a power of two");
+
+    SysMpscRing() {
+        for (uint32_t i = 0; i < Capacity; i++) { m_slots[i].seq.store(i, std::memory_order_relaxed); }
+    }
+    SysMpscRing(const SysMpscRing&) = delete;
+    SysMpscRing& operator=(const SysMpscRing&) = delete;
+
+    /// Any context. @returns false if the queue is full
+    bool push(const T& value) { return pushBatch(&value, 1) == 1; }
+
+    /// Any context. Queue as many of values as fit, as one contiguous run so
+    /// values from one call are never interleaved with other producers.
+    /// @returns the number queued
+    unsigned pushBatch(const T* values, unsigned count) {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        unsigned claimed;
+        do {
+            uint32_t free = Capacity - (head - m_tail.load(std::memory_order_acquire));
+            claimed = (count < free) ? count : free;
+            if (!claimed) { return 0; }
+        } while (!m_head.compare_exchange_weak(head, head + claimed, std::memory_order_relaxed, std::memory_order_relaxed));
+
+        for (unsigned i = 0; i < claimed; i++) {
+            Slot& slot = m_slots[(head + i) & MASK];
+            slot.value = values[i];
+            slot.seq.store(head + i + 1, std::memory_order_release);
+        }
+        return claimed;
+    }
+
+    /// Consumer side. @returns false if the queue is empty
+    bool pop(T& value) { return popBatch(&value, 1) == 1; }
+
+    /// Consumer side. Dequeue up to count published values, oldest first.
+    /// @returns the number dequeued
+    unsigned popBatch(T* values, unsigned count) {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        unsigned n = 0;
+        for (; n < count; n++) {
+            Slot& slot = m_slots[(tail + n) & MASK];
+            if (slot.seq.load(std::memory_order_acquire) != tail + n + 1) { break; }
+            values[n] = slot.value;
+            slot.seq.store(tail + n + Capacity, std::memory_order_relaxed);
+        }
+        if (n) { m_tail.store(tail + n, std::memory_order_release); }
+        return n;
+    }
+
+    /// Number of claimed slots, including ones still being filled. A snapshot.
+    unsigned size() const {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+    static constexpr unsigned capacity() { return Capacity; }
+
+private:
+    friend struct SysRingTestAccess; // lets the host tests start the indices near the 32-bit wrap
+    static constexpr uint32_t MASK = Capacity - 1;
+
+    struct Slot {
+        std::atomic<uint32_t> seq; ///< index + 1 once published, index + Capacity once consumed
+        T                     value;
+    };
+
+    alignas(SYS_CACHE_LINE_BYTES) std::atomic<uint32_t> m_head{0}; ///< claimed by producers
+    alignas(SYS_CACHE_LINE_BYTES) std::atomic<uint32_t> m_tail{0}; ///< written by the consumer
+    alignas(SYS_CACHE_LINE_BYTES) Slot                  m_slots[Capacity];
+};
+
+}
@@ -1,6 +1,8 @@
 #include "Arduino.h"
 #include "sysPlatform/SysTypes.h"
 #include "sysPlatform/SysTimer.h"
+#include "SysCriticalSection.h"
+#include "SysCycleCounter.h"
 
 namespace SysPlatform {
 
@@ -22,9 +24,32 @@ uint32_t SysTimer::cycleCnt32()
     return ARM_DWT_CYCCNT;
 }
 
+static CycleCounterExtender cycleCounter;
+static EventResponder       cycleCounterEvent;
+static MillisTimer          cycleCounterTimer;
+static bool                 cycleCounterTimerStarted = false;
+
+// runs in the systick interrupt
+static void cycleCounterTick(EventResponderRef)
+{
+    SysTimer::cycleCnt64();
+}
+
+// The DWT counter is only 32 bits. Extend it in software. A wrap is only
+// caught if this runs at least once per wrap period, about 7 s at 600 MHz.
+// The audio update calls it every block, and the first call starts a
+// MillisTimer that calls it once a second from the systick interrupt, so
+// wraps are caught whether or not audio runs. Wraps before the first call
+// are not counted.
 uint64_t SysTimer::cycleCnt64()
 {
-    return ARM_DWT_CYCCNT; // Note: Teensy doesn't support 64-bit cycle counter
+    SysIrqGuard guard; // keep the read and the wrap check together
+    if (!cycleCounterTimerStarted) {
+        cycleCounterTimerStarted = true;
+        cycleCounterEvent.attachInterrupt(cycleCounterTick);
+        cycleCounterTimer.beginRepeating(1000, cycleCounterEvent);
+    }
+    return cycleCounter.extend(ARM_DWT_CYCCNT);
 }
 
 void SysTimer::delayMilliseconds(unsigned x)
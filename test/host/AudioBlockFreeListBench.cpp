@@ -0,0 +1,232 @@
+// Host microbenchmark of the audio block allocators under a random
+// alloc/release workload.
+//
+// Compares AudioBlockFreeList with the bitmap scan allocator it replaced in
+// AudioStream. The bitmap allocator is reproduced here as a reference. Its
+// __disable_irq()/__enable_irq() pair is left out because it has no host
+// equivalent, so on target it costs a few more cycles than measured here and it
+// also delays every other interrupt for the whole scan.
+//
+// Each operation is timed on its own, less the cost of reading the timer. The
+// worst case on a host includes the odd preemption by the OS, so the 99.9th
+// percentile is printed as well. The last run times the bitmap allocator's
+// longest scan, a free block in the last word found after emptying the first.
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "AudioBlockFreeList.h"
+
+using namespace SysPlatform;
+
+namespace {
+
+// Float pool size of the default MAX_AUDIO_MEMORY with 128 sample blocks
+constexpr unsigned NUM_BLOCKS = 229376 / 128 / sizeof(float);
+constexpr unsigned NUM_MASKS  = (NUM_BLOCKS + 31) / 32;
+
+#if defined(__x86_64__) || defined(__i386__)
+const char *TICK_UNIT = "TSC ticks";
+inline uint64_t ticks() { return __rdtsc(); }
+#else
+const char *TICK_UNIT = "ns";
+inline uint64_t ticks()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+uint64_t timerOverhead = 0;
+
+// the cheapest back-to-back timer read
+uint64_t measureTimerOverhead()
+{
+    uint64_t best = UINT64_MAX;
+    for (unsigned i = 0; i < 10000; i++) {
+        uint64_t start = ticks();
+        best = std::min(best, ticks() - start);
+    }
+    return best;
+}
+
+// The allocator AudioStream used before AudioBlockFreeList: one bit per free
+// block, scanned from the first word that may have a free bit
+class BitmapAllocator {
+public:
+    void reset(unsigned num) {
+        m_firstMask = 0;
+        for (unsigned i = 0; i < NUM_MASKS; i++) { m_availableMask[i] = 0; }
+        for (unsigned i = 0; i < num; i++) { m_availableMask[i >> 5] |= (1U << (i & 0x1F)); }
+    }
+
+    int pop() {
+        uint32_t *p   = m_availableMask;
+        uint32_t *end = p + NUM_MASKS;
+        uint32_t index = m_firstMask;
+        uint32_t avail;
+        p += index;
+        while (1) {
+            if (p >= end) { return -1; }
+            avail = *p;
+            if (avail) { break; }
+            index++;
+            p++;
+        }
+        uint32_t n = __builtin_clz(avail);
+        avail &= ~(0x80000000U >> n);
+        *p = avail;
+        if (!avail) { index++; }
+        m_firstMask = index;
+        index = p - m_availableMask;
+        return static_cast<int>((index << 5) + (31 - n));
+    }
+
+    void push(unsigned block) {
+        uint32_t mask  = (0x80000000U >> (31 - (block & 0x1F)));
+        uint32_t index = block >> 5;
+        m_availableMask[index] |= mask;
+        if (index < m_firstMask) { m_firstMask = index; }
+    }
+
+private:
+    uint32_t m_availableMask[NUM_MASKS];
+    uint32_t m_firstMask = 0;
+};
+
+class FreeListAllocator {
+public:
+    void reset(unsigned num) { m_list.reset(m_links, num); }
+    int pop() { return m_list.pop(); }
+    void push(unsigned block) { m_list.push(block); }
+
+private:
+    AudioBlockFreeList m_list;
+    uint16_t           m_links[NUM_BLOCKS];
+};
+
+// xorshift32, the same sequence for every allocator
+struct Random {
+    uint32_t state;
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+};
+
+struct OpStats {
+    std::vector<uint32_t> samples;
+
+    void add(uint64_t t) {
+        t = (t > timerOverhead) ? t - timerOverhead : 0;
+        samples.push_back(static_cast<uint32_t>(std::min<uint64_t>(t, UINT32_MAX)));
+    }
+    void print(const char *name) {
+        std::sort(samples.begin(), samples.end());
+        uint64_t sum = 0;
+        for (uint32_t s : samples) { sum += s; }
+        size_t n = samples.size();
+        printf("    %-8s %9zu ops  avg %6.1f  p99.9 %6" PRIu32 "  max %8" PRIu32 "\n", name, n,
+            n ? (double)sum / n : 0.0, n ? samples[n - n / 1000 - 1] : 0, n ? samples.back() : 0);
+    }
+};
+
+// Random alloc/release around a target occupancy. Releases pick a random held
+// block, so the free blocks end up scattered over the pool the way they are
+// after a few seconds of a real graph running.
+template <typename Allocator>
+bool runWorkload(const char *name, unsigned occupancyPercent, unsigned ops, uint32_t seed)
+{
+    static Allocator allocator;
+    allocator.reset(NUM_BLOCKS);
+    std::vector<unsigned> held;
+    std::vector<bool> inUse(NUM_BLOCKS, false);
+    held.reserve(NUM_BLOCKS);
+    Random random{seed};
+    OpStats allocStats, releaseStats;
+    unsigned target = NUM_BLOCKS * occupancyPercent / 100U;
+
+    for (unsigned i = 0; i < ops; i++) {
+        // allocate three times in four below the target, once in four above
+        unsigned odds = (held.size() < target) ? 3U : 1U;
+        bool allocate = held.empty() || ((held.size() < NUM_BLOCKS) && ((random.next() & 3U) < odds));
+        if (allocate) {
+            uint64_t start = ticks();
+            int block = allocator.pop();
+            uint64_t t = ticks() - start;
+            if ((block < 0) || inUse[block]) {
+                printf("%s: bad block %d after %u ops\n", name, block, i);
+                return false;
+            }
+            allocStats.add(t);
+            inUse[block] = true;
+            held.push_back(block);
+        } else {
+            unsigned slot = random.next() % held.size();
+            unsigned block = held[slot];
+            held[slot] = held.back();
+            held.pop_back();
+            inUse[block] = false;
+            uint64_t start = ticks();
+            allocator.push(block);
+            releaseStats.add(ticks() - start);
+        }
+    }
+
+    printf("  %s, %u%% occupancy\n", name, occupancyPercent);
+    allocStats.print("alloc");
+    releaseStats.print("release");
+    return true;
+}
+
+// With every block held, release the first and the last block and allocate
+// twice. The second allocation has to scan from the first word to the last.
+template <typename Allocator>
+bool runWorstCase(const char *name, unsigned ops)
+{
+    static Allocator allocator;
+    allocator.reset(NUM_BLOCKS);
+    for (unsigned i = 0; i < NUM_BLOCKS; i++) { allocator.pop(); }
+    OpStats allocStats;
+    for (unsigned i = 0; i < ops; i++) {
+        allocator.push(0);
+        allocator.push(NUM_BLOCKS - 1);
+        int first = allocator.pop();
+        uint64_t start = ticks();
+        int second = allocator.pop();
+        allocStats.add(ticks() - start);
+        if ((first < 0) || (second < 0) || (first == second) || (allocator.pop() >= 0)) {
+            printf("%s: bad blocks %d, %d after %u ops\n", name, first, second, i);
+            return false;
+        }
+    }
+    printf("  %s, pool full but for the first and last block\n", name);
+    allocStats.print("alloc");
+    return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    unsigned ops = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 2000000U;
+    timerOverhead = measureTimerOverhead();
+    printf("%u blocks, %u ops per run, times in %s less %" PRIu64 " for the timer\n", NUM_BLOCKS, ops, TICK_UNIT, timerOverhead);
+
+    bool ok = true;
+    for (unsigned occupancy : {25U, 75U, 95U}) {
+        ok &= runWorkload<BitmapAllocator>("bitmap", occupancy, ops, 0x1234567U);
+        ok &= runWorkload<FreeListAllocator>("free list", occupancy, ops, 0x1234567U);
+    }
+    ok &= runWorstCase<BitmapAllocator>("bitmap", ops);
+    ok &= runWorstCase<FreeListAllocator>("free list", ops);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+// Host test of AudioDeadlineMonitor.
+//
+// Feeds the monitor a simulated cycle counter, the way software_isr() feeds
+// it ARM_DWT_CYCCNT, including runs across the 32-bit wrap. Covers overrun
+// and late start detection, the shedding and restoring hysteresis, and the
+// period being cleared with setPeriod(0) and recomputed, as
+// audioSetSampleRate() and AudioGraph::beginUpdate() do.
+
+#include <cstdint>
+#include <cstdio>
+#include "AudioDeadline.h"
+
+using namespace SysPlatform;
+
+namespace {
+
+unsigned errorCount = 0;
+
+void check(bool ok, const char *what, unsigned line)
+{
+    if (ok) { return; }
+    errorCount++;
+    if (errorCount <= 16) { printf("ERROR: %s, line %u\n", what, line); }
+}
+#define CHECK(x) check((x), #x, __LINE__)
+
+constexpr uint32_t PERIOD = 100000;
+
+// A cycle counter driving updates one block period apart
+struct Clock {
+    uint32_t now;
+
+    // one update that starts lateCycles after its slot and runs for cycles
+    bool update(AudioDeadlineMonitor& monitor, uint32_t cycles, uint32_t lateCycles = 0) {
+        uint32_t start = now + lateCycles;
+        monitor.beginUpdate(start);
+        bool overrun = monitor.endUpdate(start + cycles);
+        now = start + ((cycles > PERIOD) ? cycles : PERIOD);
+        return overrun;
+    }
+};
+
+uint32_t load(unsigned percent) { return PERIOD * percent / 100U; }
+
+void testOverruns(uint32_t startCycles)
+{
+    AudioDeadlineMonitor monitor;
+    monitor.setPeriod(PERIOD);
+    Clock clock{startCycles};
+
+    CHECK(!clock.update(monitor, load(50)));
+    CHECK(monitor.lastLoadPercent() == 50);
+    CHECK(!clock.update(monitor, PERIOD));
+    CHECK(clock.update(monitor, PERIOD + 1));
+    CHECK(monitor.lastLoadPercent() == 100);
+    CHECK(clock.update(monitor, 3 * PERIOD));
+    CHECK(monitor.lastLoadPercent() == 300);
+    CHECK(!clock.update(monitor, 10));
+
+    const AudioDeadlineStats& stats = monitor.stats();
+    CHECK(stats.updates == 5);
+    CHECK(stats.overruns == 2);
+    CHECK(stats.lastCycles == 10);
+    CHECK(stats.worstCycles == 3 * PERIOD);
+    // the long overrun pushed the following start past the late threshold,
+    // the one cycle overrun did not
+    CHECK(stats.lateStarts == 1);
+    // without shedding enabled nothing is shed
+    CHECK(!monitor.isShedding());
+    CHECK(stats.shedEvents == 0);
+
+    // a start exactly at the threshold is on time, one cycle more is late
+    clock.update(monitor, 10, load(10));
+    CHECK(monitor.stats().lateStarts == 1);
+    clock.update(monitor, 10, load(10) + 1);
+    CHECK(monitor.stats().lateStarts == 2);
+
+    // reset() clears the counters and skips the late check of the next start
+    monitor.reset();
+    clock.update(monitor, 10, PERIOD);
+    CHECK(monitor.stats().updates == 1);
+    CHECK(monitor.stats().lateStarts == 0);
+    CHECK(monitor.stats().worstCycles == 10);
+}
+
+void testShedding(uint32_t startCycles)
+{
+    AudioDeadlineMonitor monitor;
+    monitor.setPeriod(PERIOD);
+    AudioDeadlinePolicy policy;
+    policy.enableShedding     = true;
+    policy.shedLoadPercent    = 90;
+    policy.restoreLoadPercent = 70;
+    policy.restoreHoldUpdates = 20;
+    monitor.setPolicy(policy);
+    Clock clock{startCycles};
+
+    // at the shed load nothing happens, above it shedding starts
+    clock.update(monitor, load(90));
+    CHECK(!monitor.isShedding());
+    clock.update(monitor, load(90) + 1);
+    CHECK(monitor.isShedding());
+    CHECK(monitor.stats().shedEvents == 1);
+
+    // further heavy updates while shedding are the same event
+    clock.update(monitor, load(95));
+    clock.update(monitor, PERIOD + 1);
+    CHECK(monitor.stats().shedEvents == 1);
+
+    // loads between the two thresholds hold the state and the restore count
+    for (unsigned i = 0; i < 100; i++) { clock.update(monitor, load(80)); }
+    CHECK(monitor.isShedding());
+
+    // an interruption of the quiet run starts the count again
+    for (unsigned i = 0; i < 19; i++) { clock.update(monitor, load(50)); }
+    CHECK(monitor.isShedding());
+    clock.update(monitor, load(70));
+    for (unsigned i = 0; i < 19; i++) { clock.update(monitor, load(50)); }
+    CHECK(monitor.isShedding());
+    clock.update(monitor, load(50));
+    CHECK(!monitor.isShedding());
+
+    // an overrun sheds again and counts a new event
+    clock.update(monitor, load(50));
+    CHECK(!monitor.isShedding());
+    clock.update(monitor, PERIOD + 1);
+    CHECK(monitor.isShedding());
+    CHECK(monitor.stats().shedEvents == 2);
+
+    // turning the policy off restores at once
+    policy.enableShedding = false;
+    monitor.setPolicy(policy);
+    CHECK(!monitor.isShedding());
+    clock.update(monitor, 2 * PERIOD);
+    CHECK(!monitor.isShedding());
+    CHECK(monitor.stats().shedEvents == 2);
+}
+
+// setPeriod(0) turns the checks off, as after a sample rate change, until
+// the owner recomputes the period from the new rate
+void testPeriodRecompute()
+{
+    CHECK(audioPeriodCycles(600000000U, 128, 48000.0f) == 1600000U);
+    CHECK(audioPeriodCycles(600000000U, 128, 44100.0f) == 1741497U);
+    CHECK(audioPeriodCycles(600000000U, 128, 96000.0f) == 800000U);
+    CHECK(audioPeriodCycles(600000000U, 32, 48000.0f) == 400000U);
+    CHECK(audioPeriodCycles(816000000U, 128, 48000.0f) == 2176000U);
+
+    AudioDeadlineMonitor monitor;
+    AudioDeadlinePolicy policy;
+    policy.enableShedding = true;
+    monitor.setPolicy(policy);
+    uint32_t now = 0xFFFF0000U;
+    uint32_t period = audioPeriodCycles(600000000U, 128, 48000.0f);
+    monitor.setPeriod(period);
+    monitor.beginUpdate(now);
+    CHECK(monitor.endUpdate(now + period + 1));
+    CHECK(monitor.isShedding());
+
+    // the rate doubles: the period is cleared, then recomputed on the next
+    // update the way AudioGraph::beginUpdate() does
+    monitor.setPeriod(0);
+    CHECK(monitor.period() == 0);
+    now += 2 * period;
+    monitor.beginUpdate(now);
+    CHECK(!monitor.endUpdate(now + 10 * period));
+    CHECK(monitor.lastLoadPercent() == 0);
+    CHECK(monitor.stats().overruns == 1);
+
+    if (!monitor.period()) { monitor.setPeriod(audioPeriodCycles(600000000U, 128, 96000.0f)); }
+    CHECK(monitor.period() == 800000U);
+    now += 10 * period;
+    monitor.beginUpdate(now);
+    CHECK(monitor.endUpdate(now + 800001U));
+    CHECK(monitor.stats().overruns == 2);
+    now += period;
+    monitor.beginUpdate(now);
+    CHECK(!monitor.endUpdate(now + 400000U));
+    CHECK(monitor.lastLoadPercent() == 50);
+}
+
+}
+
+int main()
+{
+    const uint32_t starts[] = { 0, 0xFFFFFFFFU - 3 * PERIOD, 0xFFFFFFFFU };
+    for (uint32_t start : starts) {
+        testOverruns(start);
+        testShedding(start);
+    }
+    testPeriodRecompute();
+
+    if (errorCount == 0) { printf("AudioDeadlineTest PASSED!\n"); }
+    else { printf("AudioDeadlineTest FAILED! %u errors\n", errorCount); }
+    return errorCount ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+// Host test of the AudioLatencyProbe correlation.
+//
+// Simulates the loop the probe measures: the capture is the stimulus delayed
+// by a number of samples, scaled, optionally inverted and smeared by a short
+// filter, plus noise. Covers that the MLS is maximal and balanced, that the
+// MLS and impulse correlations find the delay across the whole period and
+// report the polarity, that the MLS survives noise far above the stimulus,
+// and that noise alone is reported as not valid.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include "AudioLatencyCorrelation.h"
+
+using namespace SysPlatform;
+
+namespace {
+
+unsigned errorCount = 0;
+
+void check(bool ok, const char *what, unsigned line)
+{
+    if (ok) { return; }
+    errorCount++;
+    if (errorCount <= 16) { printf("ERROR: %s, line %u\n", what, line); }
+}
+#define CHECK(x) check((x), #x, __LINE__)
+
+// xorshift32, a fixed sequence so a failure reproduces
+struct Random {
+    uint32_t state;
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    // uniform in [-amplitude, amplitude)
+    float noise(float amplitude) { return amplitude * ((float)(next() >> 8) / 8388608.0f - 1.0f); }
+};
+
+constexpr unsigned PERIOD = AUDIO_PROBE_PERIOD;
+
+uint32_t mls[AUDIO_PROBE_MLS_WORDS];
+float capture[PERIOD];
+float r[PERIOD];
+
+float stimulus(AudioProbeStimulus type, unsigned index)
+{
+    if (type == AudioProbeStimulus::IMPULSE) { return (index == 0) ? 1.0f : 0.0f; }
+    return audioProbeMlsBit(mls, index) ? 1.0f : -1.0f;
+}
+
+// The capture of a loop with the given delay and gain, smeared over three
+// samples like the codec filters do, indexed by the stimulus sample sent with it
+void loop(AudioProbeStimulus type, unsigned delay, float gain, float noise, uint32_t seed)
+{
+    const float smear[] = { 0.25f, 1.0f, 0.25f };
+    Random random{seed};
+    for (unsigned n = 0; n < PERIOD; n++) { capture[n] = random.noise(noise); }
+    for (unsigned k = 0; k < PERIOD; k++) {
+        float s = gain * stimulus(type, k);
+        if (s == 0.0f) { continue; }
+        for (unsigned t = 0; t < 3; t++) { capture[(k + delay + t + PERIOD - 1) % PERIOD] += smear[t] * s; }
+    }
+}
+
+// A maximal length sequence has one more +1 than -1 and a two-valued
+// circular autocorrelation
+void testSequence()
+{
+    audioProbeMls(mls);
+    unsigned ones = 0;
+    for (unsigned i = 0; i < PERIOD; i++) { ones += audioProbeMlsBit(mls, i); }
+    CHECK(ones == (PERIOD + 1) / 2);
+
+    // the circular autocorrelation is PERIOD at lag 0 and -1 everywhere else
+    bool flat = true;
+    for (unsigned lag = 1; lag < PERIOD; lag += 97) {
+        int sum = 0;
+        for (unsigned k = 0; k < PERIOD; k++) {
+            sum += (audioProbeMlsBit(mls, k) == audioProbeMlsBit(mls, (k + lag) % PERIOD)) ? 1 : -1;
+        }
+        flat = flat && (sum == -1);
+    }
+    CHECK(flat);
+    printf("sequence done\n");
+}
+
+void testDelays(AudioProbeStimulus type, float noise)
+{
+    const unsigned delays[] = { 0, 1, 37, 300, 1000, PERIOD / 2, PERIOD - 2 };
+    const float gains[] = { 0.5f, -0.1f };
+    for (unsigned delay : delays) {
+        for (float gain : gains) {
+            loop(type, delay, gain, noise, delay + 1);
+            AudioLatencyResult result;
+            audioProbeCorrelate(result, type, capture, mls, r, 48000.0f);
+            CHECK(result.valid);
+            CHECK(result.latencySamples == delay);
+            CHECK(result.inverted == (gain < 0.0f));
+            CHECK(std::fabs(result.latencyMicros - delay * 1e6f / 48000.0f) < 0.1f);
+        }
+    }
+    printf("%s delays with noise %.2f done\n", (type == AudioProbeStimulus::MLS) ? "MLS" : "impulse", noise);
+}
+
+// Noise alone has no peak that stands out, nor does silence
+void testNoPeak()
+{
+    AudioLatencyResult result;
+    loop(AudioProbeStimulus::MLS, 0, 0.0f, 0.5f, 77);
+    audioProbeCorrelate(result, AudioProbeStimulus::MLS, capture, mls, r, 48000.0f);
+    CHECK(!result.valid);
+    CHECK(result.peakRatio < AUDIO_PROBE_MIN_PEAK_RATIO);
+
+    for (unsigned n = 0; n < PERIOD; n++) { capture[n] = 0.0f; }
+    audioProbeCorrelate(result, AudioProbeStimulus::IMPULSE, capture, mls, r, 48000.0f);
+    CHECK(!result.valid);
+    CHECK(result.peakRatio == 0.0f);
+
+    // a clean impulse stands out without bound
+    capture[5] = 1.0f;
+    audioProbeCorrelate(result, AudioProbeStimulus::IMPULSE, capture, mls, r, 0.0f);
+    CHECK(result.valid);
+    CHECK(result.latencySamples == 5);
+    CHECK(std::isinf(result.peakRatio));
+    CHECK(result.latencyMicros == 0.0f);
+    printf("no peak done\n");
+}
+
+}
+
+int main()
+{
+    testSequence();
+    testDelays(AudioProbeStimulus::IMPULSE, 0.0f);
+    testDelays(AudioProbeStimulus::IMPULSE, 0.01f);
+    testDelays(AudioProbeStimulus::MLS, 0.0f);
+    // noise up to five times the loop gain, the MLS gains about 36 dB
+    testDelays(AudioProbeStimulus::MLS, 0.5f);
+    testNoPeak();
+
+    if (errorCount == 0) { printf("AudioLatencyCorrelationTest PASSED!\n"); }
+    else { printf("AudioLatencyCorrelationTest FAILED! %u errors\n", errorCount); }
+    return errorCount ? 1 : 0;
+}
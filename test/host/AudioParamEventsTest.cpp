@@ -0,0 +1,195 @@
+// Host test of AudioParamEventQueue.
+//
+// Covers the delivery order of events posted out of order and at the same
+// offset, the split of a block into runs at the event offsets, events held
+// back for later blocks, and postAt() with sample times in the past, in the
+// next block, far ahead and beyond the 32-bit offset range.
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "AudioParamEvents.h"
+
+using namespace SysPlatform;
+
+namespace {
+
+unsigned errorCount = 0;
+
+void check(bool ok, const char *what, unsigned line)
+{
+    if (ok) { return; }
+    errorCount++;
+    if (errorCount <= 16) { printf("ERROR: %s, line %u\n", what, line); }
+}
+#define CHECK(x) check((x), #x, __LINE__)
+
+// What one renderBlock() call delivered, runs as start and end pairs and
+// events with the sample they applied at
+struct Block {
+    std::vector<unsigned> runs;
+    std::vector<AudioParamEvent> events;
+    std::vector<unsigned> eventStarts;
+};
+
+template <unsigned Capacity>
+Block render(AudioParamEventQueue<Capacity>& queue)
+{
+    Block block;
+    unsigned position = 0;
+    queue.renderBlock(
+        [&](const AudioParamEvent& event) {
+            block.events.push_back(event);
+            block.eventStarts.push_back(position);
+        },
+        [&](unsigned start, unsigned end) {
+            block.runs.push_back(start);
+            block.runs.push_back(end);
+            position = end;
+        });
+    return block;
+}
+
+// The runs are never empty, follow each other and cover the block
+bool coversBlock(const Block& block)
+{
+    unsigned expect = 0;
+    for (size_t i = 0; i < block.runs.size(); i += 2) {
+        if ((block.runs[i] != expect) || (block.runs[i + 1] <= block.runs[i])) { return false; }
+        expect = block.runs[i + 1];
+    }
+    return expect == AUDIO_BLOCK_SAMPLES;
+}
+
+void testOrder()
+{
+    AudioParamEventQueue<16> queue;
+    CHECK(!queue.pending());
+    Block block = render(queue);
+    CHECK(block.events.empty());
+    CHECK(block.runs.size() == 2);
+    CHECK(coversBlock(block));
+
+    // posted out of order, delivered by offset, equal offsets in post order
+    queue.post(1, 1.0f, 100);
+    queue.post(2, 2.0f, 10);
+    queue.post(3, 3.0f, 10);
+    queue.post(4, 4.0f, 0);
+    queue.post(5, 5.0f, 100);
+    CHECK(queue.pending());
+    block = render(queue);
+    CHECK(!queue.pending());
+    const uint16_t params[] = { 4, 2, 3, 1, 5 };
+    const unsigned starts[] = { 0, 10, 10, 100, 100 };
+    CHECK(block.events.size() == 5);
+    for (unsigned i = 0; (i < 5) && (i < block.events.size()); i++) {
+        CHECK(block.events[i].param == params[i]);
+        CHECK(block.eventStarts[i] == starts[i]);
+    }
+
+    // split at 10 and 100, no empty run at 0
+    const unsigned runs[] = { 0, 10, 10, 100, 100, AUDIO_BLOCK_SAMPLES };
+    CHECK(block.runs.size() == 6);
+    for (unsigned i = 0; (i < 6) && (i < block.runs.size()); i++) { CHECK(block.runs[i] == runs[i]); }
+    CHECK(coversBlock(block));
+
+    // an event on the last sample leaves a one sample run
+    queue.post(6, 6.0f, AUDIO_BLOCK_SAMPLES - 1);
+    block = render(queue);
+    CHECK(block.runs.size() == 4);
+    CHECK(block.runs[2] == AUDIO_BLOCK_SAMPLES - 1);
+    CHECK(coversBlock(block));
+    printf("order done\n");
+}
+
+// Events beyond the block are held back and arrive in their block at their
+// offset within it
+void testHeldBack()
+{
+    AudioParamEventQueue<16> queue;
+    queue.post(1, 1.0f, 3 * AUDIO_BLOCK_SAMPLES + 5);
+    queue.post(2, 2.0f, AUDIO_BLOCK_SAMPLES);
+    queue.post(3, 3.0f, 7);
+
+    Block block = render(queue);
+    CHECK(block.events.size() == 1);
+    CHECK(block.events[0].param == 3);
+    CHECK(queue.pending());
+
+    block = render(queue);
+    CHECK(block.events.size() == 1);
+    CHECK(block.events[0].param == 2);
+    CHECK(block.eventStarts[0] == 0);
+
+    // an event posted meanwhile still sorts against the held one
+    queue.post(4, 4.0f, AUDIO_BLOCK_SAMPLES + 5);
+    queue.post(5, 5.0f, AUDIO_BLOCK_SAMPLES + 4);
+    block = render(queue);
+    CHECK(block.events.empty());
+    CHECK(coversBlock(block));
+    block = render(queue);
+    CHECK(block.events.size() == 3);
+    CHECK((block.events.size() == 3) && (block.events[0].param == 5) && (block.events[1].param == 1) && (block.events[2].param == 4));
+    CHECK((block.eventStarts.size() == 3) && (block.eventStarts[0] == 4) && (block.eventStarts[1] == 5));
+    CHECK(!queue.pending());
+
+    // the full queue drops and counts
+    AudioParamEventQueue<4> small;
+    for (unsigned i = 0; i < 4; i++) { CHECK(small.post(i, 0.0f, i)); }
+    CHECK(!small.post(9, 0.0f));
+    CHECK(small.dropped() == 1);
+    block = render(small);
+    CHECK(block.events.size() == 4);
+    CHECK(small.post(9, 0.0f));
+    printf("held back done\n");
+}
+
+// postAt() against the sample time of the next block, which the short form
+// takes from AudioClock
+void testPostAt()
+{
+    AudioParamEventQueue<16> queue;
+    const uint64_t nextBlock = (1ULL << 33) + 1000 * AUDIO_BLOCK_SAMPLES;
+
+    CHECK(queue.postAt(nextBlock + 20, 1, 1.0f, nextBlock));
+    CHECK(queue.postAt(nextBlock + AUDIO_BLOCK_SAMPLES + 3, 2, 2.0f, nextBlock));
+    CHECK(queue.postAt(nextBlock, 3, 3.0f, nextBlock));
+    CHECK(queue.late() == 0);
+
+    // past samples apply at the start of the block and count as late
+    CHECK(queue.postAt(nextBlock - 1, 4, 4.0f, nextBlock));
+    CHECK(queue.postAt(0, 5, 5.0f, nextBlock));
+    CHECK(queue.late() == 2);
+
+    // beyond the offset range is dropped, just inside it is kept
+    CHECK(!queue.postAt(nextBlock + UINT32_MAX + 1ULL, 6, 6.0f, nextBlock));
+    CHECK(queue.dropped() == 1);
+    CHECK(queue.postAt(nextBlock + UINT32_MAX, 7, 7.0f, nextBlock));
+
+    Block block = render(queue);
+    CHECK(block.events.size() == 4);
+    CHECK((block.events.size() == 4) && (block.events[0].param == 3) && (block.events[1].param == 4) &&
+          (block.events[2].param == 5) && (block.events[3].param == 1));
+    CHECK((block.eventStarts.size() == 4) && (block.eventStarts[3] == 20));
+    CHECK(coversBlock(block));
+
+    block = render(queue);
+    CHECK((block.events.size() == 1) && (block.events[0].param == 2));
+    CHECK((block.eventStarts.size() == 1) && (block.eventStarts[0] == 3));
+    CHECK(queue.pending());
+
+    printf("postAt done\n");
+}
+
+}
+
+int main()
+{
+    testOrder();
+    testHeldBack();
+    testPostAt();
+
+    if (errorCount == 0) { printf("AudioParamEventsTest PASSED!\n"); }
+    else { printf("AudioParamEventsTest FAILED! %u errors\n", errorCount); }
+    return errorCount ? 1 : 0;
+}
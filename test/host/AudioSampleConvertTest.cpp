@@ -0,0 +1,193 @@
+// Host test of the sample conversion kernels.
+//
+// Covers the int16 interleave and deinterleave round trip for 2, 4 and 8
+// channels against a plain frame-by-frame reference, silence for null
+// channels on interleave and skipped null channels on deinterleave, the
+// two-channel interleave, the Q31 and float conversions in place and strided,
+// and the saturation of audioFloatToQ31() at and beyond +-1.0.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "AudioSampleConvert.h"
+
+using namespace SysPlatform;
+
+namespace {
+
+unsigned errorCount = 0;
+
+void check(bool ok, const char *what, unsigned line)
+{
+    if (ok) { return; }
+    errorCount++;
+    if (errorCount <= 16) { printf("ERROR: %s, line %u\n", what, line); }
+}
+#define CHECK(x) check((x), #x, __LINE__)
+
+// xorshift32, a fixed sequence so a failure reproduces
+struct Random {
+    uint32_t state;
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+};
+
+constexpr unsigned FRAMES = 128;
+
+template <unsigned CHANNELS>
+void testInterleave(uint32_t seed)
+{
+    alignas(4) static int16_t channels[CHANNELS][FRAMES];
+    alignas(4) static int16_t frames[CHANNELS * FRAMES];
+    alignas(4) static int16_t back[CHANNELS][FRAMES];
+    Random random{seed};
+    for (unsigned c = 0; c < CHANNELS; c++) {
+        for (unsigned i = 0; i < FRAMES; i++) { channels[c][i] = static_cast<int16_t>(random.next()); }
+    }
+
+    // all channels present, frame i holds sample i of every channel in order
+    const int16_t* src[CHANNELS];
+    int16_t* dst[CHANNELS];
+    for (unsigned c = 0; c < CHANNELS; c++) {
+        src[c] = channels[c];
+        dst[c] = back[c];
+    }
+    audioInterleaveInt16<CHANNELS>(frames, src, FRAMES);
+    bool match = true;
+    for (unsigned i = 0; i < FRAMES; i++) {
+        for (unsigned c = 0; c < CHANNELS; c++) { match = match && (frames[i * CHANNELS + c] == channels[c][i]); }
+    }
+    CHECK(match);
+
+    std::memset(back, 0x55, sizeof(back));
+    audioDeinterleaveInt16<CHANNELS>(dst, frames, FRAMES);
+    CHECK(std::memcmp(back, channels, sizeof(back)) == 0);
+
+    // null source channels are written as silence
+    for (unsigned c = 1; c < CHANNELS; c += 3) { src[c] = nullptr; }
+    audioInterleaveInt16<CHANNELS>(frames, src, FRAMES);
+    match = true;
+    for (unsigned i = 0; i < FRAMES; i++) {
+        for (unsigned c = 0; c < CHANNELS; c++) {
+            int16_t expect = src[c] ? channels[c][i] : 0;
+            match = match && (frames[i * CHANNELS + c] == expect);
+        }
+    }
+    CHECK(match);
+
+    // null destination channels are skipped and leave the others intact
+    std::memset(back, 0x55, sizeof(back));
+    for (unsigned c = 0; c < CHANNELS; c += 3) { dst[c] = nullptr; }
+    audioDeinterleaveInt16<CHANNELS>(dst, frames, FRAMES);
+    match = true;
+    for (unsigned c = 0; c < CHANNELS; c++) {
+        for (unsigned i = 0; i < FRAMES; i++) {
+            int16_t expect = !dst[c] ? 0x5555 : (src[c] ? channels[c][i] : 0);
+            match = match && (back[c][i] == expect);
+        }
+    }
+    CHECK(match);
+    printf("interleave %u channels done\n", CHANNELS);
+}
+
+// The two-channel form matches the template one, including null channels
+void testInterleaveLR()
+{
+    alignas(4) static int16_t left[FRAMES], right[FRAMES];
+    alignas(4) static int16_t frames[2 * FRAMES], expect[2 * FRAMES];
+    Random random{3};
+    for (unsigned i = 0; i < FRAMES; i++) {
+        left[i]  = static_cast<int16_t>(random.next());
+        right[i] = static_cast<int16_t>(random.next());
+    }
+    const int16_t* pairs[][2] = { { left, right }, { nullptr, right }, { left, nullptr }, { nullptr, nullptr } };
+    for (const auto& pair : pairs) {
+        audioInterleaveInt16(frames, pair[0], pair[1], FRAMES);
+        audioInterleaveInt16<2>(expect, pair, FRAMES);
+        CHECK(std::memcmp(frames, expect, sizeof(frames)) == 0);
+    }
+    CHECK(frames[0] == 0 && frames[2 * FRAMES - 1] == 0);
+    printf("interleave LR done\n");
+}
+
+void testQ31()
+{
+    // full scale, saturation at +1.0 and clipping beyond it
+    CHECK(audioFloatToQ31(0.0f) == 0);
+    CHECK(audioFloatToQ31(-1.0f) == INT32_MIN);
+    CHECK(audioFloatToQ31(1.0f) == INT32_MAX);
+    CHECK(audioFloatToQ31(1.5f) == INT32_MAX);
+    CHECK(audioFloatToQ31(-1.5f) == INT32_MIN);
+    CHECK(audioFloatToQ31(1e30f) == INT32_MAX);
+    CHECK(audioFloatToQ31(-1e30f) == INT32_MIN);
+    CHECK(audioFloatToQ31(0.5f) == 0x40000000);
+    CHECK(audioFloatToQ31(-0.5f) == -0x40000000);
+    CHECK(audioQ31ToFloat(INT32_MIN) == -1.0f);
+    CHECK(audioQ31ToFloat(0x40000000) == 0.5f);
+    CHECK(audioQ31ToFloat(INT32_MAX) < 1.0f + 1e-6f);
+
+    // the block forms saturate the same way
+    const float samples[] = { 1.0f, -1.0f, 2.0f, -2.0f, 0.25f, -0.25f, 0.999f, -0.999f };
+    int32_t words[8];
+    audioFloatToQ31(words, samples, 8);
+    for (unsigned i = 0; i < 8; i++) { CHECK(words[i] == audioFloatToQ31(samples[i])); }
+
+    // in place: the buffer the DMA filled with words becomes floats
+    static_assert(sizeof(float) == sizeof(int32_t), "in-place conversion needs 32-bit floats");
+    Random random{9};
+    union { int32_t words[FRAMES]; float samples[FRAMES]; } block;
+    int32_t original[FRAMES];
+    for (unsigned i = 0; i < FRAMES; i++) { block.words[i] = original[i] = static_cast<int32_t>(random.next()); }
+    audioQ31ToFloat(block.samples, block.words, FRAMES);
+    bool match = true;
+    for (unsigned i = 0; i < FRAMES; i++) { match = match && (block.samples[i] == audioQ31ToFloat(original[i])); }
+    CHECK(match);
+
+    // strided: one channel of interleaved frames each way, the other untouched
+    int32_t interleaved[2 * FRAMES];
+    float channel[FRAMES], restored[FRAMES];
+    for (unsigned i = 0; i < FRAMES; i++) {
+        channel[i] = static_cast<float>(static_cast<int32_t>(random.next() % 2001) - 1000) / 1000.0f;
+        interleaved[2 * i + 1] = 12345;
+    }
+    audioFloatToQ31(interleaved, channel, FRAMES, 2);
+    audioQ31ToFloat(restored, interleaved, FRAMES, 2);
+    match = true;
+    for (unsigned i = 0; i < FRAMES; i++) {
+        match = match && (interleaved[2 * i + 1] == 12345);
+        float error = restored[i] - channel[i];
+        match = match && (error < 1e-6f) && (error > -1e-6f);
+    }
+    CHECK(match);
+
+    // int16 widens to the top half of the word
+    const int16_t narrow[] = { 0, 1, -1, INT16_MAX, INT16_MIN, 100, -100, 0x1234 };
+    int32_t wide[16];
+    audioZeroStrided(wide, 16);
+    audioInt16ToQ31(wide, narrow, 8, 2);
+    match = true;
+    for (unsigned i = 0; i < 8; i++) {
+        match = match && (wide[2 * i] == static_cast<int32_t>(narrow[i]) * 65536) && (wide[2 * i + 1] == 0);
+    }
+    CHECK(match);
+    printf("q31 done\n");
+}
+
+}
+
+int main()
+{
+    testInterleave<2>(1);
+    testInterleave<4>(2);
+    testInterleave<8>(4);
+    testInterleaveLR();
+    testQ31();
+
+    if (errorCount == 0) { printf("AudioSampleConvertTest PASSED!\n"); }
+    else { printf("AudioSampleConvertTest FAILED! %u errors\n", errorCount); }
+    return errorCount ? 1 : 0;
+}
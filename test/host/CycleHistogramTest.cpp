@@ -0,0 +1,180 @@
+// Host test of CycleHistogram.
+//
+// Covers the bucket bounds over the whole 32-bit range, the percentile
+// queries against a sorted copy of the measurements, the halving of all
+// counters when one would overflow, and the EWMA across differences above
+// 2^31.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "CycleHistogram.h"
+
+using namespace SysPlatform;
+
+namespace {
+
+unsigned errorCount = 0;
+
+void check(bool ok, const char *what, unsigned line)
+{
+    if (ok) { return; }
+    errorCount++;
+    if (errorCount <= 16) { printf("ERROR: %s, line %u\n", what, line); }
+}
+#define CHECK(x) check((x), #x, __LINE__)
+
+// xorshift32, a fixed sequence so a failure reproduces
+struct Random {
+    uint32_t state;
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+};
+
+// Every count lands in a bucket whose upper bound is at least the count and
+// within 1/SUB_BUCKETS of it, and the buckets are contiguous
+void testBuckets()
+{
+    for (unsigned b = 1; b < CycleHistogram::NUM_BUCKETS; b++) {
+        CHECK(CycleHistogram::bucketIndex(CycleHistogram::bucketUpper(b - 1) + 1) == b);
+        CHECK(CycleHistogram::bucketIndex(CycleHistogram::bucketUpper(b)) == b);
+    }
+    CHECK(CycleHistogram::bucketUpper(CycleHistogram::NUM_BUCKETS - 1) == UINT32_MAX);
+
+    Random random{7};
+    for (unsigned i = 0; i < 1000000; i++) {
+        uint32_t cycles = random.next() >> (random.next() % 32);
+        uint32_t upper  = CycleHistogram::bucketUpper(CycleHistogram::bucketIndex(cycles));
+        CHECK(upper >= cycles);
+        CHECK((upper - cycles) <= cycles / CycleHistogram::SUB_BUCKETS);
+    }
+    printf("buckets done\n");
+}
+
+// A percentile is the upper bound of the bucket holding the exact quantile,
+// capped at the maximum
+void checkPercentile(const CycleHistogram& h, std::vector<uint32_t> sorted, float fraction)
+{
+    std::sort(sorted.begin(), sorted.end());
+    size_t rank = static_cast<size_t>(fraction * sorted.size());
+    if (rank >= sorted.size()) { rank = sorted.size() - 1; }
+    uint32_t exact  = sorted[rank];
+    uint32_t expect = std::min(CycleHistogram::bucketUpper(CycleHistogram::bucketIndex(exact)), sorted.back());
+    CHECK(h.percentile(fraction) == expect);
+}
+
+void testPercentiles()
+{
+    CycleHistogram h;
+    CHECK(h.p50() == 0);
+    CHECK(h.p999() == 0);
+
+    // a spread like node updates, mostly near 20000 cycles with a long tail
+    Random random{11};
+    std::vector<uint32_t> values;
+    for (unsigned i = 0; i < 50000; i++) {
+        uint32_t cycles = 18000 + random.next() % 4000;
+        if ((random.next() % 100) == 0) { cycles += random.next() % 200000; }
+        values.push_back(cycles);
+        h.record(cycles);
+    }
+    for (float fraction : {0.0f, 0.1f, 0.5f, 0.9f, 0.99f, 0.999f, 1.0f}) { checkPercentile(h, values, fraction); }
+    CHECK(h.max() == *std::max_element(values.begin(), values.end()));
+    CHECK(h.last() == values.back());
+    CHECK(h.count() == values.size());
+
+    // a single value reports itself at every quantile
+    h.reset();
+    CHECK(h.count() == 0);
+    h.record(12345);
+    CHECK(h.p50() == 12345);
+    CHECK(h.p999() == 12345);
+    CHECK(h.ewma() == 12345);
+    printf("percentiles done\n");
+}
+
+// Filling one counter halves every counter, the proportions and so the
+// percentiles survive while count() keeps counting
+void testHalving()
+{
+    CycleHistogram h;
+    unsigned low  = CycleHistogram::bucketIndex(100);
+    unsigned high = CycleHistogram::bucketIndex(100000);
+    for (unsigned i = 0; i < 1000; i++) { h.record(100000); }
+    for (unsigned i = 0; i < UINT16_MAX; i++) { h.record(100); }
+    CHECK(h.bucketCount(low) == UINT16_MAX);
+    CHECK(h.bucketCount(high) == 1000);
+
+    h.record(100);
+    CHECK(h.bucketCount(low) == UINT16_MAX / 2 + 1);
+    CHECK(h.bucketCount(high) == 500);
+    CHECK(h.count() == 1000U + UINT16_MAX + 1U);
+    CHECK(h.p50() == CycleHistogram::bucketUpper(low));
+    CHECK(h.p999() == 100000);
+    CHECK(h.max() == 100000);
+
+    // the next overflow halves the old tail again
+    while (h.bucketCount(low) < UINT16_MAX) { h.record(100); }
+    CHECK(h.bucketCount(high) == 500);
+    h.record(100);
+    CHECK(h.bucketCount(low) == UINT16_MAX / 2 + 1);
+    CHECK(h.bucketCount(high) == 250);
+    CHECK(h.p50() == CycleHistogram::bucketUpper(low));
+    printf("halving done\n");
+}
+
+// The EWMA follows steps in both directions across differences above 2^31,
+// matching a 64-bit reference
+void testEwma()
+{
+    CycleHistogram h;
+    int64_t reference = 0;
+    auto record = [&](uint32_t cycles) {
+        if (h.count() == 0) { reference = cycles; }
+        else { reference += (static_cast<int64_t>(cycles) - reference) >> CycleHistogram::EWMA_SHIFT; }
+        h.record(cycles);
+        CHECK(h.ewma() == static_cast<uint32_t>(reference));
+    };
+
+    // a step up from 0 to near the top rises steadily
+    record(0);
+    uint32_t previous = 0;
+    for (unsigned i = 0; i < 400; i++) {
+        record(0xF0000000U);
+        CHECK(h.ewma() >= previous);
+        previous = h.ewma();
+    }
+    CHECK(h.ewma() > 0xE0000000U);
+
+    // and a step back down falls steadily
+    for (unsigned i = 0; i < 400; i++) {
+        record(10);
+        CHECK(h.ewma() <= previous);
+        previous = h.ewma();
+    }
+    CHECK(h.ewma() < 0x10000000U);
+
+    // random values over the whole range never leave it
+    Random random{5};
+    for (unsigned i = 0; i < 1000000; i++) { record(random.next()); }
+    printf("ewma done\n");
+}
+
+}
+
+int main()
+{
+    testBuckets();
+    testPercentiles();
+    testHalving();
+    testEwma();
+
+    if (errorCount == 0) { printf("CycleHistogramTest PASSED!\n"); }
+    else { printf("CycleHistogramTest FAILED! %u errors\n", errorCount); }
+    return errorCount ? 1 : 0;
+}
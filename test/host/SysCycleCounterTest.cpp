@@ -0,0 +1,154 @@
+// Host test of CycleCounterExtender and the cycle conversion helpers.
+//
+// A simulated 64-bit cycle count is fed to the extender as its low 32 bits,
+// the way ARM_DWT_CYCCNT presents it, and run through many 2^32 wraps. The
+// conversions are checked against 128-bit arithmetic, including counts near
+// the 64-bit limit.
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include "SysCycleCounter.h"
+
+using namespace SysPlatform;
+
+namespace {
+
+unsigned errorCount = 0;
+
+void check(bool ok, const char *what, uint64_t value)
+{
+    if (ok) { return; }
+    errorCount++;
+    if (errorCount <= 16) { printf("ERROR: %s at 0x%016" PRIx64 "\n", what, value); }
+}
+
+// xorshift64, a fixed sequence so a failure reproduces
+struct Random {
+    uint64_t state;
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+
+constexpr uint64_t WRAP = 1ULL << 32;
+
+// Random steps from one cycle to just under a wrap period, so consecutive
+// calls see between none and one wrap, as the audio update and the systick
+// timer guarantee on target
+void testRandomSteps()
+{
+    CycleCounterExtender extender;
+    Random random{0x9E3779B97F4A7C15ULL};
+    uint64_t count = 0;
+    unsigned wraps = 0;
+    for (unsigned i = 0; i < 2000000; i++) {
+        uint64_t step = 1 + (random.next() % (WRAP - 1));
+        if ((count % WRAP) + step >= WRAP) { wraps++; }
+        count += step;
+        check(extender.extend(static_cast<uint32_t>(count)) == count, "random step", count);
+    }
+    printf("random steps: %u wraps, final count 0x%016" PRIx64 "\n", wraps, count);
+}
+
+// Single cycle steps across each wrap, and repeated reads of the same value
+void testAroundWraps()
+{
+    CycleCounterExtender extender;
+    uint64_t count = 0;
+    check(extender.extend(0) == 0, "first read", 0);
+    for (unsigned wrap = 1; wrap <= 1000; wrap++) {
+        // jump to just before the wrap, then step over it one cycle at a time
+        count = wrap * WRAP - 4;
+        check(extender.extend(static_cast<uint32_t>(count)) == count, "before wrap", count);
+        for (unsigned i = 0; i < 8; i++) {
+            count++;
+            check(extender.extend(static_cast<uint32_t>(count)) == count, "across wrap", count);
+            check(extender.extend(static_cast<uint32_t>(count)) == count, "same value", count);
+        }
+    }
+}
+
+// The longest step that is still caught is one cycle short of a wrap period.
+// A whole period between calls is indistinguishable from no time passing.
+void testLongestStep()
+{
+    CycleCounterExtender extender;
+    uint64_t count = 5;
+    extender.extend(static_cast<uint32_t>(count));
+    for (unsigned i = 0; i < 1000; i++) {
+        count += WRAP - 1;
+        check(extender.extend(static_cast<uint32_t>(count)) == count, "longest step", count);
+    }
+    count += WRAP;
+    check(extender.extend(static_cast<uint32_t>(count)) == count - WRAP, "missed wrap", count);
+}
+
+uint64_t referenceNanos(uint64_t cycles, uint32_t mhz)
+{
+    unsigned __int128 ns = static_cast<unsigned __int128>(cycles) * 1000U / mhz;
+    return (ns > UINT64_MAX) ? UINT64_MAX : static_cast<uint64_t>(ns);
+}
+
+void checkConversions(uint64_t cycles, uint32_t mhz)
+{
+    check(cyclesToMicros(cycles, mhz * 1000000U) == cycles / mhz, "cyclesToMicros", cycles);
+    check(cyclesToNanos(cycles, mhz * 1000000U) == referenceNanos(cycles, mhz), "cyclesToNanos", cycles);
+}
+
+void testConversions()
+{
+    // Teensy 4 clocks from the slowest to overclocked, and 1 GHz and up
+    // where the nanoseconds never exceed the cycles
+    const uint32_t clocks[] = { 1, 24, 150, 396, 528, 600, 720, 816, 912, 1000, 1008, 4000 };
+    Random random{0x2545F4914F6CDD1DULL};
+    for (uint32_t mhz : clocks) {
+        for (uint64_t c = 0; c < 100000; c++) { checkConversions(c, mhz); }
+        for (unsigned i = 0; i < 100000; i++) {
+            checkConversions(random.next(), mhz);
+            checkConversions(random.next() >> (random.next() % 64), mhz);
+        }
+        for (uint64_t k = 0; k < 10000; k++) { checkConversions(UINT64_MAX - k, mhz); }
+
+        // either side of the first count whose nanoseconds no longer fit
+        unsigned __int128 limit = (static_cast<unsigned __int128>(UINT64_MAX) + 1) * mhz;
+        limit = (limit + 999U) / 1000U;
+        if (limit <= UINT64_MAX) {
+            for (uint64_t c = static_cast<uint64_t>(limit) - 2000; c != static_cast<uint64_t>(limit) + 2000; c++) {
+                checkConversions(c, mhz);
+            }
+            check(cyclesToNanos(static_cast<uint64_t>(limit), mhz * 1000000U) == UINT64_MAX, "first count that saturates",
+                static_cast<uint64_t>(limit));
+        }
+    }
+}
+
+// A long run through the extender converted at 600 MHz
+void testExtendedConversions()
+{
+    CycleCounterExtender extender;
+    Random random{12345};
+    uint64_t count = 0;
+    for (unsigned i = 0; i < 100000; i++) {
+        count += 1 + (random.next() % (WRAP - 1));
+        checkConversions(extender.extend(static_cast<uint32_t>(count)), 600);
+    }
+}
+
+}
+
+int main()
+{
+    testRandomSteps();
+    testAroundWraps();
+    testLongestStep();
+    testConversions();
+    testExtendedConversions();
+
+    if (errorCount == 0) { printf("SysCycleCounterTest PASSED!\n"); }
+    else { printf("SysCycleCounterTest FAILED! %u errors\n", errorCount); }
+    return errorCount ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+// Host throughput benchmark of SysSpscRing and SysMpscRing.
+//
+// Streams 32-bit values from producer threads to a consumer thread at
+// several batch sizes, next to a mutex protected ring of the same capacity as
+// the baseline the lock-free rings replace. The single thread round trip
+// matches benchmarkRingBuffers() on target.
+//
+// With fewer cores than threads the streaming numbers mostly measure the
+// scheduler, the producer and consumer take turns filling and draining the
+// whole ring.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "SysRingBuffer.h"
+
+using namespace SysPlatform;
+
+namespace {
+
+constexpr unsigned RING_CAPACITY = 1024;
+constexpr unsigned MAX_BATCH     = 64;
+
+// Ring with the same interface serialized by a mutex
+template <typename T, unsigned Capacity>
+class MutexRing {
+public:
+    unsigned pushBatch(const T* values, unsigned count) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        unsigned free = Capacity - (m_head - m_tail);
+        if (count > free) { count = free; }
+        for (unsigned i = 0; i < count; i++) { m_slots[(m_head + i) % Capacity] = values[i]; }
+        m_head += count;
+        return count;
+    }
+    unsigned popBatch(T* values, unsigned count) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        unsigned available = m_head - m_tail;
+        if (count > available) { count = available; }
+        for (unsigned i = 0; i < count; i++) { values[i] = m_slots[(m_tail + i) % Capacity]; }
+        m_tail += count;
+        return count;
+    }
+
+private:
+    std::mutex m_mutex;
+    uint32_t   m_head = 0;
+    uint32_t   m_tail = 0;
+    T          m_slots[Capacity] = {};
+};
+
+void backOff()
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(1));
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// push then pop from one thread, no contention
+template <typename Ring>
+void runRoundTrip(const char *name, unsigned values, unsigned batch)
+{
+    static Ring ring;
+    uint32_t buffer[MAX_BATCH] = {};
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned n = 0; n < values; n += batch) {
+        ring.pushBatch(buffer, batch);
+        ring.popBatch(buffer, batch);
+    }
+    double seconds = secondsSince(start);
+    printf("  %-10s round trip, batch %2u: %7.2f ns/value\n", name, batch, seconds * 1e9 / values);
+}
+
+// producer threads stream to the calling thread
+template <typename Ring>
+void runStream(const char *name, unsigned values, unsigned batch, unsigned producers)
+{
+    static Ring ring;
+    unsigned perProducer = values / producers;
+    values = perProducer * producers;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned p = 0; p < producers; p++) {
+        threads.emplace_back([perProducer, batch]() {
+            uint32_t buffer[MAX_BATCH];
+            for (unsigned i = 0; i < MAX_BATCH; i++) { buffer[i] = i; }
+            unsigned sent = 0;
+            while (sent < perProducer) {
+                unsigned count = (batch < perProducer - sent) ? batch : perProducer - sent;
+                unsigned pushed = ring.pushBatch(buffer, count);
+                if (!pushed) { backOff(); }
+                sent += pushed;
+            }
+        });
+    }
+
+    uint32_t buffer[MAX_BATCH];
+    unsigned received = 0;
+    while (received < values) {
+        unsigned popped = ring.popBatch(buffer, batch);
+        if (!popped) { backOff(); }
+        received += popped;
+    }
+    for (auto& t : threads) { t.join(); }
+    double seconds = secondsSince(start);
+    printf("  %-10s %u producer%s, batch %2u: %7.2f Mvalues/s\n", name, producers, (producers > 1) ? "s" : " ", batch,
+        values / seconds / 1e6);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    unsigned values = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 4000000U;
+    printf("%u values per run, %u slot rings, %u hardware threads\n", values, RING_CAPACITY, std::thread::hardware_concurrency());
+
+    using Spsc  = SysSpscRing<uint32_t, RING_CAPACITY>;
+    using Mpsc  = SysMpscRing<uint32_t, RING_CAPACITY>;
+    using Mutex = MutexRing<uint32_t, RING_CAPACITY>;
+
+    for (unsigned batch : {1U, 8U, 64U}) {
+        runRoundTrip<Spsc>("SPSC", values, batch);
+        runRoundTrip<Mpsc>("MPSC", values, batch);
+        runRoundTrip<Mutex>("mutex", values, batch);
+    }
+    for (unsigned batch : {1U, 8U, 64U}) {
+        runStream<Spsc>("SPSC", values, batch, 1);
+        runStream<Mutex>("mutex", values, batch, 1);
+    }
+    for (unsigned producers : {1U, 2U, 4U}) {
+        for (unsigned batch : {1U, 8U, 64U}) {
+            runStream<Mpsc>("MPSC", values, batch, producers);
+            runStream<Mutex>("mutex", values, batch, producers);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,276 @@
+// Host test of SysSpscRing and SysMpscRing.
+//
+// Covers the full and empty edges, partial pushBatch()/popBatch(), indices
+// running past 2^32, a producer and consumer on separate threads, and for
+// SysMpscRing that the values of one pushBatch() call are never interleaved
+// with those of other producers.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "SysRingBuffer.h"
+
+namespace SysPlatform {
+
+// Starts an empty ring at an arbitrary index, which would otherwise take 2^32
+// values to reach
+struct SysRingTestAccess {
+    template <typename T, unsigned Capacity>
+    static void setIndex(SysSpscRing<T, Capacity>& ring, uint32_t index) {
+        ring.m_head.store(index);
+        ring.m_tail.store(index);
+        ring.m_tailCache = index;
+        ring.m_headCache = index;
+    }
+
+    template <typename T, unsigned Capacity>
+    static void setIndex(SysMpscRing<T, Capacity>& ring, uint32_t index) {
+        ring.m_head.store(index);
+        ring.m_tail.store(index);
+        for (uint32_t i = 0; i < Capacity; i++) { ring.m_slots[(index + i) & (Capacity - 1)].seq.store(index + i); }
+    }
+};
+
+}
+
+using namespace SysPlatform;
+
+namespace {
+
+unsigned errorCount = 0;
+
+void check(bool ok, const char *what, unsigned line)
+{
+    if (ok) { return; }
+    errorCount++;
+    if (errorCount <= 16) { printf("ERROR: %s, line %u\n", what, line); }
+}
+#define CHECK(x) check((x), #x, __LINE__)
+
+// xorshift32, a fixed sequence so a failure reproduces
+struct Random {
+    uint32_t state;
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+};
+
+// Called by a thread that cannot make progress. A short sleep rather than a
+// yield, which on a single core keeps picking the spinning thread until its
+// run time catches up with the other one.
+void backOff()
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(1));
+}
+
+constexpr unsigned CAPACITY = 8;
+
+// The single threaded behaviour both rings share. next is the value the
+// following push writes, expect the value the following pop returns.
+template <typename Ring>
+void testEdges(Ring& ring, uint32_t startIndex)
+{
+    SysRingTestAccess::setIndex(ring, startIndex);
+    uint32_t values[2 * CAPACITY];
+    uint32_t value = 0;
+    uint32_t next = 100, expect = 100;
+
+    // empty
+    CHECK(ring.empty());
+    CHECK(ring.size() == 0);
+    CHECK(!ring.pop(value));
+    CHECK(ring.popBatch(values, CAPACITY) == 0);
+
+    // one in, one out
+    CHECK(ring.push(next++));
+    CHECK(ring.size() == 1);
+    CHECK(ring.pop(value) && (value == expect++));
+    CHECK(ring.empty());
+
+    // fill one at a time, then nothing more fits
+    for (unsigned i = 0; i < CAPACITY; i++) { CHECK(ring.push(next++)); }
+    CHECK(ring.size() == CAPACITY);
+    CHECK(!ring.push(next));
+    CHECK(ring.pushBatch(values, 1) == 0);
+
+    // a partial pop, then a batch larger than the free space only queues what fits
+    CHECK(ring.popBatch(values, 3) == 3);
+    for (unsigned i = 0; i < 3; i++) { CHECK(values[i] == expect++); }
+    for (unsigned i = 0; i < 2 * CAPACITY; i++) { values[i] = next + i; }
+    CHECK(ring.pushBatch(values, 2 * CAPACITY) == 3);
+    next += 3;
+    CHECK(ring.size() == CAPACITY);
+
+    // a batch larger than the contents returns them all, oldest first
+    CHECK(ring.popBatch(values, 2 * CAPACITY) == CAPACITY);
+    for (unsigned i = 0; i < CAPACITY; i++) { CHECK(values[i] == expect++); }
+    CHECK(ring.empty());
+    CHECK(!ring.pop(value));
+
+    // zero length batches do nothing
+    CHECK(ring.pushBatch(values, 0) == 0);
+    CHECK(ring.popBatch(values, 0) == 0);
+    CHECK(ring.empty());
+
+    // odd sized batches so the slot index wraps at every position, and with
+    // a start near 2^32 the free running indices wrap as well
+    Random random{startIndex | 1U};
+    unsigned queued = 0;
+    for (unsigned n = 0; n < 10000; n++) {
+        unsigned count = random.next() % (CAPACITY + 2);
+        if (random.next() & 1U) {
+            for (unsigned i = 0; i < count; i++) { values[i] = next + i; }
+            unsigned pushed = ring.pushBatch(values, count);
+            CHECK(pushed == ((count < CAPACITY - queued) ? count : CAPACITY - queued));
+            next += pushed;
+            queued += pushed;
+        } else {
+            unsigned popped = ring.popBatch(values, count);
+            CHECK(popped == ((count < queued) ? count : queued));
+            for (unsigned i = 0; i < popped; i++) { CHECK(values[i] == expect++); }
+            queued -= popped;
+        }
+        CHECK(ring.size() == queued);
+    }
+}
+
+// Wrapping the slot index each time the free running index wraps needs a
+// power of two capacity, which the rings enforce
+template <template <typename, unsigned> class Ring>
+void testAllEdges(const char *name)
+{
+    const uint32_t starts[] = { 0, 5, 0xFFFFFFFFU - 2 * CAPACITY, 0xFFFFFFFFU - 3, 0xFFFFFFFFU };
+    for (uint32_t start : starts) {
+        Ring<uint32_t, CAPACITY> ring;
+        testEdges(ring, start);
+    }
+    printf("%s edges done\n", name);
+}
+
+// One producer and one consumer thread, random batch sizes, every value
+// arrives once and in order
+template <template <typename, unsigned> class Ring>
+void testThreaded(const char *name, uint32_t startIndex)
+{
+    constexpr uint32_t NUM_VALUES = 500000;
+    static Ring<uint32_t, 64> ring;
+    SysRingTestAccess::setIndex(ring, startIndex);
+
+    std::thread producer([]() {
+        Random random{1};
+        uint32_t values[80];
+        uint32_t next = 0;
+        while (next < NUM_VALUES) {
+            unsigned count = 1 + random.next() % 80;
+            if (count > NUM_VALUES - next) { count = NUM_VALUES - next; }
+            for (unsigned i = 0; i < count; i++) { values[i] = next + i; }
+            unsigned pushed = ring.pushBatch(values, count);
+            if (!pushed) { backOff(); }
+            next += pushed;
+        }
+    });
+
+    Random random{2};
+    uint32_t values[80];
+    uint32_t expect = 0;
+    unsigned misordered = 0;
+    while (expect < NUM_VALUES) {
+        unsigned popped = ring.popBatch(values, 1 + random.next() % 80);
+        if (!popped) { backOff(); }
+        for (unsigned i = 0; i < popped; i++) {
+            if (values[i] != expect++) { misordered++; }
+        }
+    }
+    producer.join();
+    CHECK(misordered == 0);
+    CHECK(ring.empty());
+    printf("%s threaded from index 0x%08x done\n", name, (unsigned)startIndex);
+}
+
+// Several producers push runs of values tagged with the producer and a per
+// producer sequence number. The consumer sees each producer's values in
+// order, and only switches producer at the end of a pushBatch() call.
+void testMpscProducers(uint32_t startIndex)
+{
+    constexpr unsigned NUM_PRODUCERS = 4;
+    constexpr uint32_t PER_PRODUCER  = 100000;
+    static SysMpscRing<uint32_t, 64> ring;
+    SysRingTestAccess::setIndex(ring, startIndex);
+
+    // the sequence number each producer's calls started at
+    std::vector<std::vector<bool>> callStarts(NUM_PRODUCERS, std::vector<bool>(PER_PRODUCER + 1, false));
+    std::vector<std::thread> producers;
+    for (unsigned p = 0; p < NUM_PRODUCERS; p++) {
+        producers.emplace_back([p, &callStarts]() {
+            Random random{p + 10};
+            uint32_t values[24];
+            uint32_t next = 0;
+            while (next < PER_PRODUCER) {
+                unsigned count = 1 + random.next() % 24;
+                if (count > PER_PRODUCER - next) { count = PER_PRODUCER - next; }
+                for (unsigned i = 0; i < count; i++) { values[i] = (p << 24) | (next + i); }
+                unsigned pushed = ring.pushBatch(values, count);
+                if (pushed) { callStarts[p][next] = true; }
+                else { backOff(); }
+                next += pushed;
+            }
+            callStarts[p][PER_PRODUCER] = true;
+        });
+    }
+
+    std::vector<uint32_t> received;
+    received.reserve(NUM_PRODUCERS * PER_PRODUCER);
+    Random random{3};
+    uint32_t values[40];
+    while (received.size() < NUM_PRODUCERS * PER_PRODUCER) {
+        unsigned popped = ring.popBatch(values, 1 + random.next() % 40);
+        if (!popped) { backOff(); }
+        received.insert(received.end(), values, values + popped);
+    }
+    for (auto& t : producers) { t.join(); }
+    CHECK(ring.empty());
+
+    uint32_t expect[NUM_PRODUCERS] = {};
+    unsigned misordered = 0, interleaved = 0;
+    for (size_t i = 0; i < received.size(); i++) {
+        unsigned p   = received[i] >> 24;
+        uint32_t seq = received[i] & 0xFFFFFFU;
+        if ((p >= NUM_PRODUCERS) || (seq != expect[p])) { misordered++; continue; }
+        expect[p]++;
+        // a switch must leave the previous producer at a call boundary and
+        // enter this one at the start of a call
+        unsigned prev = (i > 0) ? received[i - 1] >> 24 : p;
+        if (prev != p) {
+            if (!callStarts[p][seq] || !callStarts[prev][expect[prev]]) { interleaved++; }
+        }
+    }
+    CHECK(misordered == 0);
+    CHECK(interleaved == 0);
+    printf("MPSC %u producers from index 0x%08x done\n", NUM_PRODUCERS, (unsigned)startIndex);
+}
+
+}
+
+int main()
+{
+    testAllEdges<SysSpscRing>("SPSC");
+    testAllEdges<SysMpscRing>("MPSC");
+
+    testThreaded<SysSpscRing>("SPSC", 0);
+    testThreaded<SysSpscRing>("SPSC", 0xFFFFFFFFU - 1000);
+    testThreaded<SysMpscRing>("MPSC", 0);
+    testThreaded<SysMpscRing>("MPSC", 0xFFFFFFFFU - 1000);
+
+    testMpscProducers(0);
+    testMpscProducers(0xFFFFFFFFU - 1000);
+
+    if (errorCount == 0) { printf("SysRingBufferTest PASSED!\n"); }
+    else { printf("SysRingBufferTest FAILED! %u errors\n", errorCount); }
+    return errorCount ? 1 : 0;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// Host stand-in for the block constants of the platform AudioStream.h, for
+// the tests of headers that need no more of it than these.
+
+#ifndef AUDIO_BLOCK_SAMPLES
+#define AUDIO_BLOCK_SAMPLES 128
+#endif
+#ifndef AUDIO_SAMPLE_RATE_EXACT
+#define AUDIO_SAMPLE_RATE_EXACT 48000.0f
+#endif